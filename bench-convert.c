@@ -0,0 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "raff.h"
+
+// Measures sample conversion throughput, in GB/s of interleaved
+// samples, for each sample type to and from planar floats at each
+// level of SIMD the CPU has.  Stereo by default, so deinterleaving
+// is measured along with the conversion.
+//
+//     ./bench-convert [frames] [channels] [repeats]
+
+static double
+now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char const* typeNames[] = { "int16", "int24", "int32", "float32" };
+static char const* simdNames[] = { "scalar", "sse2", "avx2" };
+
+int
+main( int argc, char** argv ) {
+    size_t   frames   = argc > 1 ? strtoul( argv[1], NULL, 10 ) : 1 << 18;
+    unsigned channels = argc > 2 ? atoi( argv[2] ) : 2;
+    int      repeats  = argc > 3 ? atoi( argv[3] ) : 50;
+    if( channels < 1 )
+        channels = 1;
+    
+    float** planes = malloc( channels*sizeof(float*) );
+    for( unsigned c = 0 ; c < channels ; c++ ) {
+        planes[c] = malloc( frames*sizeof(float) );
+        for( size_t i = 0 ; i < frames ; i++ )
+            planes[c][i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+    char* bytes = malloc( frames*channels*4 );
+    
+    printf( "%-8s %-8s %-8s %8s\n", "type", "to", "simd", "GB/s" );
+    for( int type = raff_SAMPLE_INT16 ; type <= raff_SAMPLE_FLOAT32 ; type++ ) {
+        double size = (double)frames*channels*raff_sampleWidth( (raff_SampleType)type );
+        for( int level = raff_SIMD_NONE ; level <= raff_SIMD_AVX2 ; level++ ) {
+            if( raff_setSimd( (raff_Simd)level ) != level )
+                continue;
+            
+            double start = now();
+            for( int r = 0 ; r < repeats ; r++ )
+                raff_samplesFromPlanar( (raff_SampleType)type, channels,
+                                        (float const* const*)planes, bytes, frames );
+            double encode = now() - start;
+            
+            start = now();
+            for( int r = 0 ; r < repeats ; r++ )
+                raff_samplesToPlanar( (raff_SampleType)type, channels, bytes, planes, frames );
+            double decode = now() - start;
+            
+            printf( "%-8s %-8s %-8s %8.2f\n", typeNames[type], "planar",
+                    simdNames[level], size*repeats / decode / 1e9 );
+            printf( "%-8s %-8s %-8s %8.2f\n", "planar", typeNames[type],
+                    simdNames[level], size*repeats / encode / 1e9 );
+        }
+    }
+    
+    for( unsigned c = 0 ; c < channels ; c++ )
+        free( planes[c] );
+    free( planes );
+    free( bytes );
+    return 0;
+}
@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "raff.h"
+
+// Measures how batch opening scales with the number of workers.
+// A set of files (1000 by default) is generated, each with a
+// few dozen chunks and a nested list, and read once to warm the
+// page cache.  Then they're opened with raff_openFiles() using
+// 1, 2, 4, ... workers up to the number of cores (or the given
+// max), walking each root list before closing it.  The files
+// are removed afterwards.
+//
+//     ./bench-open [files] [chunks per file] [max workers]
+
+static double
+now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+generate( char const* path, int chunks ) {
+    raff_File* file = raff_newFile();
+    raff_List* root = raff_newList( file, raff_newID( "BNCH" ) );
+    
+    char buf[512];
+    for( int c = 0 ; c < chunks ; c++ ) {
+        char id[5];
+        sprintf( id, "c%03d", c % 1000 );
+        memset( buf, c, sizeof(buf) );
+        
+        size_t size = 64 + ( c*37 ) % ( sizeof(buf) - 64 );
+        raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( id ), buf, size ) ) );
+    }
+    
+    raff_List* sub = raff_newList( file, raff_newID( "sub " ) );
+    raff_append( sub, raff_dataAsChunk( raff_newData( file, raff_newID( "leaf" ), buf, 16 ) ) );
+    raff_append( root, raff_listAsChunk( sub, false ) );
+    
+    raff_serializeChunkToFile( raff_listAsChunk( root, true ), path );
+    raff_closeFile( file );
+}
+
+static void
+openedCb( size_t index, raff_File* file, raff_Error err, void* user ) {
+    if( !file ) {
+        fprintf( stderr, "Open %zu failed: %d\n", index, (int)err );
+        exit( 1 );
+    }
+    
+    raff_List* root = raff_chunkAsList( raff_fileAsChunk( file ) );
+    size_t     n    = 0;
+    raff_start( root );
+    while( raff_next( root ) )
+        n++;
+    if( n == 0 )
+        exit( 1 );
+    raff_closeFile( file );
+}
+
+static double
+run( char const* const* paths, size_t count, unsigned workers ) {
+    double start = now();
+    raff_openFiles( paths, count, workers, openedCb, NULL );
+    return now() - start;
+}
+
+int
+main( int argc, char** argv ) {
+    size_t count  = argc > 1 ? strtoul( argv[1], NULL, 10 ) : 1000;
+    int    chunks = argc > 2 ? atoi( argv[2] ) : 64;
+    long   cores  = argc > 3 ? atol( argv[3] ) : sysconf( _SC_NPROCESSORS_ONLN );
+    if( cores < 1 )
+        cores = 1;
+    
+    char** paths = malloc( count*sizeof(char*) );
+    for( size_t i = 0 ; i < count ; i++ ) {
+        paths[i] = malloc( 64 );
+        sprintf( paths[i], "bench-open-%05zu.riff", i );
+        generate( paths[i], chunks );
+    }
+    
+    // Once to warm the page cache.
+    run( (char const* const*)paths, count, 1 );
+    
+    double   base    = 0;
+    unsigned workers = 1;
+    printf( "%8s %10s %12s %8s\n", "workers", "seconds", "files/s", "speedup" );
+    for( ;; ) {
+        double secs = run( (char const* const*)paths, count, workers );
+        if( workers == 1 )
+            base = secs;
+        printf( "%8u %10.3f %12.0f %8.2f\n", workers, secs, count / secs, base / secs );
+        
+        if( workers == (unsigned)cores )
+            break;
+        workers = workers*2 > (unsigned)cores ? (unsigned)cores : workers*2;
+    }
+    
+    for( size_t i = 0 ; i < count ; i++ ) {
+        remove( paths[i] );
+        free( paths[i] );
+    }
+    free( paths );
+    return 0;
+}
@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "raff.h"
+
+// Measures serialization throughput for a large WAV file.
+// A single 'data' chunk of the requested size (in MiB, 1024
+// by default) is wrapped in a WAVE RIFF chunk and written
+// out with raff_serializeChunkToFile(), and then again by
+// pulling blocks from raff_serializeChunk()'s stream.  The
+// output file is removed afterwards.
+//
+//     ./bench-write [MiB] [path]
+
+static double
+now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report( char const* name, size_t bytes, double secs ) {
+    double mib = bytes / ( 1024.0 * 1024.0 );
+    printf( "%-24s %10.1f MiB %8.3f s %10.1f MiB/s\n",
+            name, mib, secs, mib / secs );
+}
+
+int
+main( int argc, char** argv ) {
+    size_t      mib  = argc > 1 ? strtoul( argv[1], NULL, 10 ) : 1024;
+    char const* path = argc > 2 ? argv[2] : "bench-write.wav";
+    size_t      size = mib * 1024 * 1024;
+    
+    char* samples = malloc( size );
+    if( !samples ) {
+        fprintf( stderr, "Couldn't allocate %zu MiB\n", mib );
+        return 1;
+    }
+    for( size_t i = 0 ; i < size ; i++ )
+        samples[i] = (char)( i * 31 );
+    
+    // 16 bit stereo at 44.1kHz.
+    char fmtBuf[16] = {
+        1, 0, 2, 0, 0x44, 0xAC, 0, 0, 0x10, 0xB1, 2, 0, 4, 0, 16, 0
+    };
+    
+    raff_File* file = raff_newFile();
+    raff_Data* fmt  = raff_newData( file, raff_newID( "fmt " ), fmtBuf, 16 );
+    raff_Data* data = raff_newData( file, raff_newID( "data" ), samples, size );
+    free( samples );
+    
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( fmt ) );
+    raff_append( wave, raff_dataAsChunk( data ) );
+    raff_Chunk* riff  = raff_listAsChunk( wave, true );
+    size_t      total = raff_dataSize( data ) + 16 + 8 + 8 + 12;
+    
+    double start = now();
+    if( raff_serializeChunkToFile( riff, path ) != raff_ERR_NONE ) {
+        fprintf( stderr, "Write failed: %s\n", raff_errorMsg() );
+        return 1;
+    }
+    report( "serializeChunkToFile", total, now() - start );
+    
+    size_t blockSize = 1 << 20;
+    char*  block     = malloc( blockSize );
+    FILE*  out       = fopen( path, "wb" );
+    
+    start = now();
+    raff_StreamEx* stream = (raff_StreamEx*)raff_serializeChunk( riff );
+    size_t n;
+    while( ( n = stream->read( &stream->stream, block, blockSize ) ) > 0 )
+        fwrite( block, 1, n, out );
+    stream->stream.close( &stream->stream );
+    fclose( out );
+    report( "serializeChunk read()", total, now() - start );
+    
+    free( block );
+    remove( path );
+    raff_closeFile( file );
+    return 0;
+}
@@ -0,0 +1,332 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "raff.h"
+
+// Benchmarks the core of the library on synthetic files of a few
+// shapes: one huge data chunk, lots of tiny chunks, deeply nested
+// lists, and a wide AVI like movi list.  For each shape the file
+// is written, then opened, parsed, searched, encoded, copied, and
+// serialized a number of times, and the time of each run kept.
+//
+// Results are printed as tab separated lines, one per shape and
+// operation, with the number of runs, bytes handled per run, and
+// the mean and percentiles of the run times in microseconds; so
+// the output of two commits can be saved and compared with:
+//
+//     ./bench [repeats] [scale] > before.tsv
+//     ./bench [repeats] [scale] > after.tsv
+//     ./bench compare before.tsv after.tsv
+//
+// Scale multiplies the size of every shape, 1 by default.
+
+static char const* path    = "bench.riff";
+static char const* outPath = "bench-out.riff";
+
+#define FIND_RUNS 1000
+
+static double
+now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+compareTimes( void const* a, void const* b ) {
+    double x = *(double const*)a;
+    double y = *(double const*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile( double const* sorted, size_t n, double p ) {
+    size_t i = (size_t)( p*( n - 1 ) + 0.5 );
+    return sorted[i];
+}
+
+static void
+report( char const* shape, char const* op, double* times, size_t n, double bytes ) {
+    double total = 0;
+    for( size_t i = 0 ; i < n ; i++ )
+        total += times[i];
+    qsort( times, n, sizeof(double), compareTimes );
+    
+    double mean = total / n;
+    printf( "%s\t%s\t%zu\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+            shape, op, n, bytes, mean*1e6,
+            percentile( times, n, 0.5 )*1e6, percentile( times, n, 0.9 )*1e6,
+            percentile( times, n, 0.99 )*1e6, times[n - 1]*1e6,
+            mean > 0 ? bytes / mean / 1e6 : 0 );
+    fflush( stdout );
+}
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content, size_t size ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, size ) );
+}
+
+// Builds the tree of a shape in a new file, returning its root.
+// The ID to look up in the biggest list is given back in findID.
+static raff_Chunk*
+buildShape( raff_File* file, char const* shape, double scale, raff_ID* findID ) {
+    if( !strcmp( shape, "huge" ) ) {
+        size_t size = (size_t)( 64*1024*1024*scale );
+        char*  buf  = malloc( size );
+        memset( buf, 0x5A, size );
+        
+        raff_List* root = raff_newList( file, raff_newID( "BNCH" ) );
+        raff_append( root, newData( file, "fmt ", "format..", 8 ) );
+        raff_append( root, newData( file, "data", buf, size ) );
+        free( buf );
+        *findID = raff_newID( "data" );
+        return raff_listAsChunk( root, true );
+    }
+    
+    if( !strcmp( shape, "tiny" ) ) {
+        size_t     count = (size_t)( 1000000*scale );
+        raff_List* root  = raff_newList( file, raff_newID( "BNCH" ) );
+        for( size_t i = 0 ; i < count ; i++ ) {
+            char id[16];
+            sprintf( id, "%04zu", i % 10000 );
+            raff_append( root, newData( file, id, "tiny", 4 ) );
+        }
+        *findID = raff_newID( "9999" );
+        return raff_listAsChunk( root, true );
+    }
+    
+    if( !strcmp( shape, "deep" ) ) {
+        size_t      depth = (size_t)( 1000*scale );
+        raff_Chunk* inner = NULL;
+        for( size_t i = 0 ; i < depth ; i++ ) {
+            raff_List* list = raff_newList( file, raff_newID( "nest" ) );
+            raff_append( list, newData( file, "leaf", "leaf data", 9 ) );
+            if( inner )
+                raff_append( list, inner );
+            inner = raff_listAsChunk( list, false );
+        }
+        raff_List* root = raff_newList( file, raff_newID( "BNCH" ) );
+        raff_append( root, inner );
+        *findID = raff_newID( "nest" );
+        return raff_listAsChunk( root, true );
+    }
+    
+    // An AVI like file, with a few headers and a wide movi list
+    // of interleaved video and audio chunks.
+    size_t frames = (size_t)( 100000*scale );
+    char   video[256];
+    char   audio[64];
+    memset( video, 0x11, sizeof(video) );
+    memset( audio, 0x22, sizeof(audio) );
+    
+    raff_List* hdrl = raff_newList( file, raff_newID( "hdrl" ) );
+    raff_append( hdrl, newData( file, "avih", video, 56 ) );
+    raff_List* movi = raff_newList( file, raff_newID( "movi" ) );
+    for( size_t i = 0 ; i < frames ; i++ ) {
+        raff_append( movi, newData( file, "00dc", video, sizeof(video) - i % 7 ) );
+        raff_append( movi, newData( file, "01wb", audio, sizeof(audio) ) );
+    }
+    raff_List* root = raff_newList( file, raff_newID( "AVI " ) );
+    raff_append( root, raff_listAsChunk( hdrl, false ) );
+    raff_append( root, raff_listAsChunk( movi, false ) );
+    *findID = raff_newID( "ix00" );
+    return raff_listAsChunk( root, true );
+}
+
+// Parses every list in a tree, returning the number of chunks.
+static size_t
+parseAll( raff_List* list ) {
+    size_t      count = 0;
+    raff_Chunk* iter;
+    raff_start( list );
+    while( ( iter = raff_next( list ) ) ) {
+        raff_List* sub = raff_chunkAsList( iter );
+        count += 1 + ( sub ? parseAll( sub ) : 0 );
+    }
+    return count;
+}
+
+// Finds the list with the most chunks in a parsed tree, giving
+// back how many it has.
+static raff_List*
+biggestList( raff_List* list, size_t* count ) {
+    raff_List*  best = list;
+    raff_Chunk* iter;
+    *count = 0;
+    raff_start( list );
+    while( raff_next( list ) )
+        (*count)++;
+    
+    size_t most = *count;
+    raff_start( list );
+    while( ( iter = raff_next( list ) ) ) {
+        raff_List* sub = raff_chunkAsList( iter );
+        size_t     subCount;
+        raff_List* inner = sub ? biggestList( sub, &subCount ) : NULL;
+        if( inner && subCount > most ) {
+            best = inner;
+            most = subCount;
+        }
+    }
+    *count = most;
+    return best;
+}
+
+static raff_File*
+openOrDie( void ) {
+    raff_File* file = raff_openFile( path );
+    if( !file ) {
+        fprintf( stderr, "Couldn't open %s: %s\n", path, raff_errorMsg() );
+        exit( 1 );
+    }
+    return file;
+}
+
+static void
+runShape( char const* shape, int repeats, double scale ) {
+    double* times = malloc( ( repeats > FIND_RUNS ? repeats : FIND_RUNS )*sizeof(double) );
+    
+    // Writing the file built in memory.
+    raff_ID     findID;
+    raff_File*  built = raff_newFile();
+    raff_Chunk* root  = buildShape( built, shape, scale, &findID );
+    for( int r = 0 ; r < repeats ; r++ ) {
+        double start = now();
+        if( raff_serializeChunkToFile( root, path ) != raff_ERR_NONE ) {
+            fprintf( stderr, "Couldn't write %s\n", path );
+            exit( 1 );
+        }
+        times[r] = now() - start;
+    }
+    raff_closeFile( built );
+    
+    FILE* f = fopen( path, "rb" );
+    fseek( f, 0, SEEK_END );
+    double size = ftell( f );
+    fclose( f );
+    report( shape, "write", times, repeats, size );
+    
+    for( int r = 0 ; r < repeats ; r++ ) {
+        double     start = now();
+        raff_File* file  = openOrDie();
+        times[r] = now() - start;
+        raff_closeFile( file );
+    }
+    report( shape, "open", times, repeats, size );
+    
+    for( int r = 0 ; r < repeats ; r++ ) {
+        raff_File* file  = openOrDie();
+        double     start = now();
+        parseAll( raff_chunkAsList( raff_fileAsChunk( file ) ) );
+        times[r] = now() - start;
+        raff_closeFile( file );
+    }
+    report( shape, "parse", times, repeats, size );
+    
+    // Lookups in the biggest list, the first of which builds any
+    // index the list gets.
+    size_t     count;
+    raff_File* file = openOrDie();
+    raff_List* list = biggestList( raff_chunkAsList( raff_fileAsChunk( file ) ), &count );
+    for( int r = 0 ; r < FIND_RUNS ; r++ ) {
+        double start = now();
+        raff_findID( list, findID );
+        times[r] = now() - start;
+    }
+    raff_closeFile( file );
+    report( shape, "find", times, FIND_RUNS, 0 );
+    
+    for( int r = 0 ; r < repeats ; r++ ) {
+        file = openOrDie();
+        raff_List* rootList = raff_chunkAsList( raff_fileAsChunk( file ) );
+        double     start    = now();
+        raff_listAsChunk( rootList, false );
+        times[r] = now() - start;
+        raff_closeFile( file );
+    }
+    report( shape, "encode", times, repeats, size );
+    
+    file = openOrDie();
+    for( int r = 0 ; r < repeats ; r++ ) {
+        raff_File* into  = raff_newFile();
+        double     start = now();
+        raff_copyChunkTo( into, raff_fileAsChunk( file ) );
+        times[r] = now() - start;
+        raff_closeFile( into );
+    }
+    report( shape, "copy", times, repeats, size );
+    
+    for( int r = 0 ; r < repeats ; r++ ) {
+        double start = now();
+        raff_serializeChunkToFile( raff_fileAsChunk( file ), outPath );
+        times[r] = now() - start;
+    }
+    raff_closeFile( file );
+    report( shape, "serialize", times, repeats, size );
+    
+    remove( path );
+    remove( outPath );
+    free( times );
+}
+
+// Prints the change in median time of each operation between two
+// saved runs, flagging those more than 10% slower.
+static int
+compare( char const* beforePath, char const* afterPath ) {
+    FILE* before = fopen( beforePath, "r" );
+    FILE* after  = fopen( afterPath, "r" );
+    if( !before || !after ) {
+        fprintf( stderr, "Couldn't open results to compare\n" );
+        return 1;
+    }
+    
+    printf( "%-8s %-10s %12s %12s %8s\n", "shape", "op", "before us", "after us", "ratio" );
+    char a[512], b[512];
+    int  slower = 0;
+    while( fgets( a, sizeof(a), before ) && fgets( b, sizeof(b), after ) ) {
+        if( a[0] == '#' )
+            continue;
+        
+        char   shapeA[32], opA[32], shapeB[32], opB[32];
+        double p50A, p50B, skip;
+        size_t n;
+        if( sscanf( a, "%31s %31s %zu %lf %lf %lf", shapeA, opA, &n, &skip, &skip, &p50A ) != 6 ||
+            sscanf( b, "%31s %31s %zu %lf %lf %lf", shapeB, opB, &n, &skip, &skip, &p50B ) != 6 ||
+            strcmp( shapeA, shapeB ) || strcmp( opA, opB ) ) {
+            fprintf( stderr, "Results don't line up\n" );
+            return 1;
+        }
+        
+        double ratio = p50A > 0 ? p50B / p50A : 1;
+        printf( "%-8s %-10s %12.1f %12.1f %8.2f%s\n", shapeA, opA, p50A, p50B, ratio,
+                ratio > 1.1 ? "  slower" : "" );
+        slower += ratio > 1.1;
+    }
+    fclose( before );
+    fclose( after );
+    return slower > 0;
+}
+
+int
+main( int argc, char** argv ) {
+    if( argc > 1 && !strcmp( argv[1], "compare" ) ) {
+        if( argc < 4 ) {
+            fprintf( stderr, "Usage: %s compare before.tsv after.tsv\n", argv[0] );
+            return 1;
+        }
+        return compare( argv[2], argv[3] );
+    }
+    
+    int    repeats = argc > 1 ? atoi( argv[1] ) : 10;
+    double scale   = argc > 2 ? atof( argv[2] ) : 1;
+    if( repeats < 1 )
+        repeats = 1;
+    
+    printf( "# shape\top\truns\tbytes\tmean_us\tp50_us\tp90_us\tp99_us\tmax_us\tMB/s\n" );
+    char const* shapes[] = { "huge", "tiny", "deep", "avi" };
+    for( size_t i = 0 ; i < sizeof(shapes)/sizeof(shapes[0]) ; i++ )
+        runShape( shapes[i], repeats, scale );
+    return 0;
+}
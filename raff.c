@@ -1,19 +1,135 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "raff.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#define RAFF_POSIX
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define RAFF_SSE2
+#endif
+
+// AVX2 code is compiled in with GCC and Clang whatever the target,
+// and only used if the CPU turns out to have it.
+#if defined(RAFF_SSE2) && ( defined(__GNUC__) || defined(__clang__) )
+#include <immintrin.h>
+#define RAFF_AVX2
+#define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+
+#ifdef RAFF_STATS
+#include <time.h>
+#endif
+
+// Pool allocations are carved out of large slabs by bumping a
+// pointer, so allocating is cheap and releasing a file's pool
+// only has to free its slabs.  Allocations too big to share a
+// slab get a slab of their own.
+typedef struct raff_Slab {
+    struct raff_Slab* next;
+    size_t            size;
+    union {
+        long double ld;
+        long long   ll;
+        void*       p;
+    } data[];
+} raff_Slab;
+
+#define ALIGN sizeof(((raff_Slab*)0)->data[0])
+
+typedef struct Arena {
+    raff_Slab* slabs;
+    char*      bump;
+    size_t     left;
+    
+#ifdef RAFF_STATS
+    // Counts for the work done with this pool, a file's pool has
+    // the counts for the file.  Workers parsing in parallel count
+    // into their own, which are added in with their slabs.
+    raff_Stats stats;
+#endif
+} Arena;
+
+// Sizes from the ds64 chunk of an RF64 (or BW64) file, which
+// stand in for sizes too big for the size field of a chunk.
+// The size of the 'data' chunk has its own field, the rest are
+// kept in a table by ID.
+typedef struct Ds64Entry {
+    raff_ID            id;
+    unsigned long long size;
+} Ds64Entry;
+
+typedef struct Ds64 {
+    unsigned long long riffSize;
+    unsigned long long dataSize;
+    unsigned long long sampleCount;
+    size_t             count;
+    Ds64Entry          table[];
+} Ds64;
 
-typedef struct raff_Alloc {
-    struct raff_Alloc* next;
-    char data[];
-} raff_Alloc;
+// The buffer or mapping a file's content was loaded into, or a
+// buffer adopted by raff_adoptData().  Chunks copied to other
+// files keep pointing into it rather than being copied, so it's
+// counted how many files use it; and it's freed (or given back
+// through its release callback) when the last of them is closed.
+typedef struct Payload {
+    size_t       refs;
+    char*        bytes;
+    size_t       size;
+    bool         mapped;
+    raff_Release release;
+    void*        user;
+} Payload;
 
 typedef struct raff_File {
-    raff_Alloc*  allocs;
+    Arena        arena;
     raff_Chunk*  chunk;
     size_t size;
-    char   data[];
+    char*  data;
+    
+    // If the file was opened with raff_mapFile() then data
+    // points into this read-only mapping of the whole file
+    // instead of into a buffer owned by the file.
+    void*  map;
+    size_t mapSize;
+    
+    // If the file was opened lazily then this is the seekable
+    // stream it was opened from, and data is NULL.  Chunk
+    // headers and payloads are read from here on demand.
+    raff_StreamEx* source;
+    
+    // Path the file was opened from, if it was opened from a
+    // path; needed for editing the file in place.
+    char*        path;
+    
+    // For RF64 files, the sizes from the ds64 chunk.
+    Ds64*        ds64;
+    
+    // The file's own payload, if it was loaded or mapped; and the
+    // payloads of other files that chunks copied to it point into.
+    Payload*     payload;
+    Payload**    held;
+    size_t       heldCount;
+    size_t       heldCapacity;
 } raff_File;
 
 typedef enum raff_Type {
@@ -31,16 +147,84 @@ typedef struct raff_Chunk {
     size_t             size;
     char*              start;
     
+    // Offset of the chunk's content (after the header) from the
+    // start of the file it was parsed from.  For chunks of lazily
+    // opened files start is NULL until the content is loaded
+    // from this offset.
+    unsigned long long offset;
+    
+    // Lists encoded by raff_listAsChunk() aren't flattened into
+    // a buffer until needed, instead they keep the chunks they
+    // contained (at the time of encoding), and the offset of
+    // the end of each (including header and padding) within
+    // the list's content.  start is NULL until flattened.
+    struct raff_Chunk** parts;
+    size_t*            partEnds;
+    size_t             partCount;
+    
+    // Next chunk in the same list with the same ID, only valid
+    // while the list has an index.
+    struct raff_Chunk* nextSame;
+    
+    // Position of the chunk in its list's child table, if the
+    // list has one.
+    size_t             slot;
+    
     raff_List*         asList;
     raff_Data*         asData;
 } raff_Chunk;
 
+// A slot of a list's ID index; which holds the first and last
+// chunks in the list with the given ID, the rest are linked
+// between them through their nextSame field.
+typedef struct IndexSlot {
+    raff_ID     id;
+    raff_Chunk* first;
+    raff_Chunk* last;
+} IndexSlot;
+
+// Lists parsed from a file keep their chunks in a table, with
+// each field in an array of its own, instead of as a linked list
+// of raff_Chunks.  So walking and searching the list doesn't have
+// to touch a chunk per entry, and IDs can be compared several at
+// a time.  Chunk handles are only made for entries as they're
+// asked for.
+typedef struct ChildTable {
+    uint32_t*           ids;
+    unsigned char*      types;
+    size_t*             sizes;
+    unsigned long long* offsets;
+    
+    // Handles made so far, NULL until the first is.
+    raff_Chunk**        handles;
+    
+    // Content of the list and its offset in the file, to find
+    // the content of entries from; base is NULL for lists of
+    // lazily opened files that haven't been loaded.
+    char*               base;
+    unsigned long long  baseOffset;
+    
+    size_t              cursor;
+} ChildTable;
+
 typedef struct raff_List {
     raff_File*  file;
     raff_ID     id;
     raff_Chunk* cursor;
     raff_Chunk* first;
     raff_Chunk* last;
+    size_t      count;
+    
+    // The child table, until the list's changed or needed as a
+    // linked list; first, last, and cursor aren't used until then.
+    ChildTable* table;
+    
+    // Open addressed hash table of the list's chunk IDs, built
+    // by the first raff_findID() on a list with enough chunks
+    // to make it worthwhile.  NULL if not built.
+    IndexSlot*  index;
+    unsigned    indexBits;
+    size_t      indexUsed;
     
     raff_Chunk* asChunk;
 } raff_List;
@@ -54,50 +238,509 @@ typedef struct raff_Data {
     raff_Chunk* asChunk;
 } raff_Data;
 
-static raff_Error errnum = raff_ERR_NONE;
+// Error state is kept per thread, so files can be parsed on
+// different threads at the same time.
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+static THREAD_LOCAL raff_Error errnum = raff_ERR_NONE;
+
+// Counters shared between threads.  Without compiler support they
+// fall back to plain arithmetic, so aren't safe to share there.
+#if defined(__GNUC__) || defined(__clang__)
+#define ATOMIC_ADD( var, n ) __atomic_fetch_add( &(var), (n), __ATOMIC_RELAXED )
+#define ATOMIC_SUB( var, n ) __atomic_sub_fetch( &(var), (n), __ATOMIC_ACQ_REL )
+#define ATOMIC_GET( var )    __atomic_load_n( &(var), __ATOMIC_ACQUIRE )
+#else
+#define ATOMIC_ADD( var, n ) ( (var) += (n) )
+#define ATOMIC_SUB( var, n ) ( (var) -= (n) )
+#define ATOMIC_GET( var )    (var)
+#endif
+
+// Stats are counted into the file they're for, and at the same
+// time into the global counts, which are shared by all threads
+// so are added to atomically.  Without RAFF_STATS the counting
+// and timing compiles to nothing.
+#ifdef RAFF_STATS
+static raff_Stats globalStats;
+static raff_Hook  hook     = NULL;
+static void*      hookUser = NULL;
+
+#define COUNT_GLOBAL( field, n ) ATOMIC_ADD( globalStats.field, (n) )
+#define COUNT( stats, field, n ) \
+    do { (stats)->field += (n); COUNT_GLOBAL( field, n ); } while( 0 )
+
+static unsigned long long
+nanoTime( void ) {
+#ifdef RAFF_POSIX
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+#else
+    return (unsigned long long)clock()*( 1000000000 / CLOCKS_PER_SEC );
+#endif
+}
+
+// Hooks mustn't change the error of whatever they're around.
+static void
+callHook( raff_Phase phase, bool end, raff_File* file ) {
+    raff_Error err = errnum;
+    hook( phase, end, file, hookUser );
+    errnum = err;
+}
+
+static unsigned long long
+beginPhase( raff_Phase phase, raff_File* file ) {
+    if( hook )
+        callHook( phase, false, file );
+    return nanoTime();
+}
+
+// The hook isn't called until the time's been taken, so the time
+// it takes isn't counted.
+static void
+endPhase( raff_Phase phase, raff_File* file, unsigned long long start ) {
+    unsigned long long time  = nanoTime() - start;
+    raff_Stats         none;
+    raff_Stats*        stats = file ? &file->arena.stats : &none;
+    switch( phase ) {
+        case raff_PHASE_OPEN:
+            COUNT( stats, openTime, time );
+            break;
+        case raff_PHASE_PARSE:
+            COUNT( stats, parseTime, time );
+            break;
+        case raff_PHASE_SERIALIZE:
+            COUNT( stats, serializeTime, time );
+            break;
+    }
+    
+    if( hook )
+        callHook( phase, true, file );
+}
+
+#define BEGIN_PHASE( phase, file ) \
+    unsigned long long phaseStart = beginPhase( phase, file )
+#define END_PHASE( phase, file ) endPhase( phase, file, phaseStart )
+#else
+// Still statements, so they can be the body of an if.
+#define COUNT_GLOBAL( field, n )   ((void)0)
+#define COUNT( stats, field, n )   ((void)0)
+#define BEGIN_PHASE( phase, file ) ((void)0)
+#define END_PHASE( phase, file )   ((void)0)
+#endif
+
+static int
+snext( raff_StreamEx* stream ) {
+    return stream->stream.next( &stream->stream );
+}
+
+// Read up to size bytes from the stream into buf, returns the
+// number of bytes actually read, which is less than size only
+// if the stream ended.  Uses the stream's bulk read() when it
+// has one and falls back to next() otherwise.
+static size_t
+sread( raff_StreamEx* stream, char* buf, size_t size ) {
+    size_t got = 0;
+    if( stream->read ) {
+        while( got < size ) {
+            size_t n = stream->read( &stream->stream, buf + got, size - got );
+            if( n == 0 )
+                break;
+            got += n;
+        }
+        return got;
+    }
+    
+    while( got < size ) {
+        int n = snext( stream );
+        if( n < 0 )
+            break;
+        buf[got++] = n;
+    }
+    return got;
+}
+
+// Skip over size bytes of the stream, returns the number
+// of bytes actually skipped.
+static size_t
+sskip( raff_StreamEx* stream, size_t size ) {
+    if( stream->skip )
+        return stream->skip( &stream->stream, size );
+    
+    char   buf[4096];
+    size_t skipped = 0;
+    while( skipped < size ) {
+        size_t want = size - skipped;
+        if( want > sizeof(buf) )
+            want = sizeof(buf);
+        
+        size_t n = sread( stream, buf, want );
+        skipped += n;
+        if( n < want )
+            break;
+    }
+    return skipped;
+}
+
+#ifdef RAFF_STATS
+// Stands in for the stream a file is opened from, counting the
+// calls made to it and the bytes it gives before passing them on.
+// Until the file has been made the counts go in early.  Those of
+// lazily opened files are kept until the file's closed, so are
+// allocated and freed when they're closed.
+typedef struct CountingStream {
+    raff_StreamEx  stream;
+    raff_StreamEx* inner;
+    raff_Stats*    stats;
+    raff_Stats     early;
+    bool           owned;
+} CountingStream;
 
 static int
-snext( raff_Stream* stream ) {
-    return stream->next( stream );
+countNextCb( raff_Stream* stream ) {
+    CountingStream* cs = (CountingStream*)stream;
+    int             c  = cs->inner->stream.next( &cs->inner->stream );
+    COUNT( cs->stats, streamCalls, 1 );
+    if( c >= 0 )
+        COUNT( cs->stats, bytesRead, 1 );
+    return c;
+}
+
+static size_t
+countReadCb( raff_Stream* stream, char* buf, size_t size ) {
+    CountingStream* cs = (CountingStream*)stream;
+    size_t          n  = cs->inner->read( &cs->inner->stream, buf, size );
+    COUNT( cs->stats, streamCalls, 1 );
+    COUNT( cs->stats, bytesRead, n );
+    return n;
+}
+
+static size_t
+countSkipCb( raff_Stream* stream, size_t size ) {
+    CountingStream* cs = (CountingStream*)stream;
+    COUNT( cs->stats, streamCalls, 1 );
+    return cs->inner->skip( &cs->inner->stream, size );
+}
+
+static int
+countSeekCb( raff_Stream* stream, unsigned long long offset ) {
+    CountingStream* cs = (CountingStream*)stream;
+    COUNT( cs->stats, streamCalls, 1 );
+    return cs->inner->seek( &cs->inner->stream, offset );
+}
+
+static void
+countCloseCb( raff_Stream* stream ) {
+    CountingStream* cs = (CountingStream*)stream;
+    if( cs->inner->stream.close )
+        cs->inner->stream.close( &cs->inner->stream );
+    if( cs->owned )
+        free( cs );
+}
+
+// Puts a counting stream in front of another, with the same
+// methods missing.
+static raff_StreamEx*
+countStream( CountingStream* cs, raff_StreamEx* inner, bool owned ) {
+    cs->stream.stream.next  = countNextCb;
+    cs->stream.stream.close = countCloseCb;
+    cs->stream.read         = inner->read ? countReadCb : NULL;
+    cs->stream.skip         = inner->skip ? countSkipCb : NULL;
+    cs->stream.seek         = inner->seek ? countSeekCb : NULL;
+    cs->inner = inner;
+    cs->stats = &cs->early;
+    cs->owned = owned;
+    memset( &cs->early, 0, sizeof(raff_Stats) );
+    return (raff_StreamEx*)cs;
+}
+
+static void
+addStats( raff_Stats* into, raff_Stats const* from ) {
+    into->bytesRead       += from->bytesRead;
+    into->streamCalls     += from->streamCalls;
+    into->allocs          += from->allocs;
+    into->allocBytes      += from->allocBytes;
+    into->chunksParsed    += from->chunksParsed;
+    into->listsParsed     += from->listsParsed;
+    into->bytesSerialized += from->bytesSerialized;
+    into->openTime        += from->openTime;
+    into->parseTime       += from->parseTime;
+    into->serializeTime   += from->serializeTime;
+}
+#endif
+
+static void
+addID( char* data, size_t* next, raff_ID id ) {
+    data[(*next)++] = id >> 24;
+    data[(*next)++] = id >> 16;
+    data[(*next)++] = id >> 8;
+    data[(*next)++] = id;
+}
+
+static void
+addSize( char* data, size_t* next, size_t size ) {
+    data[(*next)++] = size;
+    data[(*next)++] = size >> 8;
+    data[(*next)++] = size >> 16;
+    data[(*next)++] = size >> 24;
+}
+
+static void
+addSize64( char* data, size_t* next, unsigned long long size ) {
+    addSize( data, next, (size_t)( size & 0xFFFFFFFF ) );
+    addSize( data, next, (size_t)( size >> 32 ) );
+}
+
+static raff_ID
+decodeID( unsigned char const* b ) {
+    char idstr[5] = { b[0], b[1], b[2], b[3], 0 };
+    return raff_newID( idstr );
+}
+
+static size_t
+decodeSize( unsigned char const* b ) {
+    return (size_t)b[0] | (size_t)b[1] << 8 |
+           (size_t)b[2] << 16 | (size_t)b[3] << 24;
+}
+
+static unsigned long long
+decodeSize64( unsigned char const* b ) {
+    return (unsigned long long)decodeSize( b ) |
+           (unsigned long long)decodeSize( b + 4 ) << 32;
+}
+
+// Size of new slabs, and how many released slabs of that size
+// are kept around for reuse by the next files to be opened.
+// Each thread keeps its own released slabs so no locking is
+// needed to allocate; along with the size they were when it
+// kept them, since another thread can change it.
+static size_t                  slabSize  = 64*1024;
+static THREAD_LOCAL raff_Slab* freeSlabs = NULL;
+static THREAD_LOCAL size_t     freeCount = 0;
+static THREAD_LOCAL size_t     freeSize  = 0;
+
+#define MAX_FREE_SLABS 64
+
+#ifdef RAFF_POSIX
+// A thread's released slabs are freed when it exits, by the
+// destructor of a key that's set once it first keeps one.
+static pthread_key_t     slabKey;
+static pthread_once_t    slabKeyOnce = PTHREAD_ONCE_INIT;
+static THREAD_LOCAL bool slabKeySet  = false;
+
+static void
+freeSlabsAtExit( void* value ) {
+    (void)value;
+    raff_releaseSlabs();
+}
+
+static void
+createSlabKey( void ) {
+    pthread_key_create( &slabKey, freeSlabsAtExit );
+}
+#endif
+
+// Frees the calling thread's released slabs if the slab size has
+// changed since they were kept, so they don't sit there unused.
+static void
+dropStaleSlabs( void ) {
+    if( freeSize != slabSize ) {
+        raff_releaseSlabs();
+        freeSize = slabSize;
+    }
+}
+
+static void
+initArena( Arena* arena ) {
+    arena->slabs = NULL;
+    arena->bump  = NULL;
+    arena->left  = 0;
+#ifdef RAFF_STATS
+    memset( &arena->stats, 0, sizeof(raff_Stats) );
+#endif
+}
+
+static raff_Slab*
+newSlab( size_t size ) {
+    dropStaleSlabs();
+    if( freeSlabs && freeSlabs->size == size ) {
+        raff_Slab* slab = freeSlabs;
+        freeSlabs = slab->next;
+        freeCount--;
+        return slab;
+    }
+    
+    raff_Slab* slab = malloc( sizeof(raff_Slab) + size );
+    slab->size = size;
+    return slab;
+}
+
+static void
+releaseArena( Arena* arena ) {
+    dropStaleSlabs();
+#ifdef RAFF_POSIX
+    if( arena->slabs && !slabKeySet ) {
+        pthread_once( &slabKeyOnce, createSlabKey );
+        pthread_setspecific( slabKey, &slabKeySet );
+        slabKeySet = true;
+    }
+#endif
+    while( arena->slabs ) {
+        raff_Slab* slab = arena->slabs;
+        arena->slabs = slab->next;
+        
+        if( slab->size == slabSize && freeCount < MAX_FREE_SLABS ) {
+            slab->next = freeSlabs;
+            freeSlabs  = slab;
+            freeCount++;
+        }
+        else {
+            free( slab );
+        }
+    }
+    initArena( arena );
+}
+
+static void*
+arenaAlloc( Arena* arena, size_t size ) {
+    size = ( size + ALIGN - 1 ) / ALIGN * ALIGN;
+    COUNT( &arena->stats, allocs, 1 );
+    COUNT( &arena->stats, allocBytes, size );
+    if( size <= arena->left ) {
+        void* ptr = arena->bump;
+        arena->bump += size;
+        arena->left -= size;
+        return ptr;
+    }
+    
+    // Big allocations get their own slab, which goes behind
+    // the current one so what's left of it can still be used.
+    if( size > slabSize / 4 ) {
+        raff_Slab* slab = newSlab( size );
+        if( arena->slabs ) {
+            slab->next = arena->slabs->next;
+            arena->slabs->next = slab;
+        }
+        else {
+            slab->next = NULL;
+            arena->slabs = slab;
+        }
+        return slab->data;
+    }
+    
+    raff_Slab* slab = newSlab( slabSize );
+    slab->next   = arena->slabs;
+    arena->slabs = slab;
+    arena->bump  = (char*)slab->data + size;
+    arena->left  = slabSize - size;
+    return slab->data;
 }
 
 static void*
 alloc( raff_File* file, size_t size ) {
-    raff_Alloc* a = malloc( sizeof(raff_Alloc) + size );
-    a->next = file->allocs;
-    file->allocs = a;
-    return a->data;
+    return arenaAlloc( &file->arena, size );
+}
+
+static Payload*
+newPayload( char* bytes, size_t size, bool mapped ) {
+    Payload* payload = malloc( sizeof(Payload) );
+    payload->refs    = 1;
+    payload->bytes   = bytes;
+    payload->size    = size;
+    payload->mapped  = mapped;
+    payload->release = NULL;
+    payload->user    = NULL;
+    return payload;
+}
+
+static void
+releasePayload( Payload* payload ) {
+    if( ATOMIC_SUB( payload->refs, 1 ) > 0 )
+        return;
+    
+    if( payload->release )
+        payload->release( payload->bytes, payload->size, payload->user );
+    else
+#ifdef RAFF_POSIX
+    if( payload->mapped )
+        munmap( payload->bytes, payload->size );
+    else
+#endif
+    free( payload->bytes );
+    free( payload );
 }
 
-raff_ID*
-parseID( raff_Stream* stream ) {
+static void
+initPayloads( raff_File* file, Payload* payload ) {
+    file->payload      = payload;
+    file->held         = NULL;
+    file->heldCount    = 0;
+    file->heldCapacity = 0;
+}
 
-    long i1 = snext( stream );
-    long i2 = snext( stream );
-    long i3 = snext( stream );
-    long i4 = snext( stream );
-    if( i1 < 0 || i2 < 0 || i3 < 0 || i4 < 0 )
+// Finds the payload, of a file's own or those it holds, that the
+// given content is in; or NULL if it's in the file's pool, or
+// hasn't been loaded.
+static Payload*
+findPayload( raff_File* file, char const* content, size_t size ) {
+    if( !content )
         return NULL;
     
-    char idstr[5] = { i1, i2, i3, i4, 0 };
+    Payload* payload = file->payload;
+    for( size_t i = 0 ; ; i++ ) {
+        if( payload && content >= payload->bytes &&
+            content <= payload->bytes + payload->size &&
+            size <= payload->size - ( content - payload->bytes ) )
+            return payload;
+        if( i >= file->heldCount )
+            return NULL;
+        payload = file->held[i];
+    }
+}
+
+// Makes a file hold a reference to a payload, unless it already
+// does.
+static void
+holdPayload( raff_File* file, Payload* payload ) {
+    if( payload == file->payload )
+        return;
+    for( size_t i = 0 ; i < file->heldCount ; i++ ) {
+        if( file->held[i] == payload )
+            return;
+    }
     
-    static raff_ID id;
-    id = raff_newID( idstr );
-    return &id;
+    if( file->heldCount == file->heldCapacity ) {
+        file->heldCapacity = file->heldCapacity ? file->heldCapacity*2 : 4;
+        file->held         = realloc( file->held, file->heldCapacity*sizeof(Payload*) );
+    }
+    ATOMIC_ADD( payload->refs, 1 );
+    file->held[file->heldCount++] = payload;
 }
 
-size_t*
-parseSize( raff_Stream* stream ) {
-    long s1 = snext( stream );
-    long s2 = snext( stream );
-    long s3 = snext( stream );
-    long s4 = snext( stream );
-    if( s1 < 0 || s2 < 0 || s3 < 0|| s4 < 0 )
-        return NULL;
+static bool
+parseID( raff_StreamEx* stream, raff_ID* id ) {
+    char buf[4];
+    if( sread( stream, buf, 4 ) < 4 )
+        return false;
+    
+    *id = decodeID( (unsigned char*)buf );
+    return true;
+}
+
+static bool
+parseSize( raff_StreamEx* stream, size_t* size ) {
+    char buf[4];
+    if( sread( stream, buf, 4 ) < 4 )
+        return false;
     
-    static size_t size;
-    size = s1 | s2 << 8 | s3 << 16 | s4 << 24;
-    return &size;
+    *size = decodeSize( (unsigned char*)buf );
+    return true;
 }
 
 static raff_ID RIFF_ID =
@@ -106,47 +749,124 @@ static raff_ID RIFF_ID =
 static raff_ID LIST_ID =
     (long)'L' << 24 | (long)'I' << 16 | (long)'S' << 8 | (long)'T';
 
-raff_File*
-openStream( raff_Stream* stream ) {
+static raff_ID RF64_ID =
+    (long)'R' << 24 | (long)'F' << 16 | (long)'6' << 8 | (long)'4';
 
-    raff_ID* idp = parseID( stream );
-    if( !idp || *idp != RIFF_ID ) {
-        errnum = raff_ERR_NOT_RIFF;
+static raff_ID BW64_ID =
+    (long)'B' << 24 | (long)'W' << 16 | (long)'6' << 8 | (long)'4';
+
+static raff_ID DS64_ID =
+    (long)'d' << 24 | (long)'s' << 16 | (long)'6' << 8 | (long)'4';
+
+static raff_ID DATA_ID =
+    (long)'d' << 24 | (long)'a' << 16 | (long)'t' << 8 | (long)'a';
+
+static raff_ID FMT_ID =
+    (long)'f' << 24 | (long)'m' << 16 | (long)'t' << 8 | (long)' ';
+
+static raff_ID JUNK_ID =
+    (long)'J' << 24 | (long)'U' << 16 | (long)'N' << 8 | (long)'K';
+
+// Sizes bigger than this don't fit in a chunk's size field, so
+// are written as SIZE_MARKER with the real size kept in a ds64
+// chunk.  This can be lowered to test RF64 support without
+// making huge files.
+#ifndef RAFF_SIZE_LIMIT
+#define RAFF_SIZE_LIMIT 0xFFFFFFFEull
+#endif
+#define SIZE_MARKER 0xFFFFFFFFull
+
+// Limit on the size of a ds64 chunk, any bigger and it's
+// considered corrupt.
+#define MAX_DS64_SIZE ( 1 << 20 )
+
+// Parses the content of a ds64 chunk into a new Ds64, or
+// returns NULL if it's too short to be one.
+static Ds64*
+parseDs64( unsigned char const* b, size_t size ) {
+    if( size < 28 )
         return NULL;
-    }
     
-    size_t* sizep = parseSize( stream );
-    if( !sizep ) {
-        errnum = raff_ERR_CORRUPT;
-        return NULL;
+    size_t count = decodeSize( b + 24 );
+    if( count > ( size - 28 ) / 12 )
+        count = ( size - 28 ) / 12;
+    
+    Ds64* ds64 = malloc( sizeof(Ds64) + count*sizeof(Ds64Entry) );
+    ds64->riffSize    = decodeSize64( b );
+    ds64->dataSize    = decodeSize64( b + 8 );
+    ds64->sampleCount = decodeSize64( b + 16 );
+    ds64->count       = count;
+    for( size_t i = 0 ; i < count ; i++ ) {
+        ds64->table[i].id   = decodeID( b + 28 + 12*i );
+        ds64->table[i].size = decodeSize64( b + 32 + 12*i );
     }
-    size_t size = *sizep - 4;
+    return ds64;
+}
+
+// Reads the ds64 chunk that has to follow the header of an
+// RF64 file.  The chunk as read (with padding) is left in a
+// malloc()ed buffer in *pre, if pre isn't NULL, so it doesn't
+// have to be read again.
+static raff_Error
+readDs64( raff_StreamEx* stream, Ds64** ds64, char** pre, size_t* preSize ) {
+    raff_ID id;
+    size_t  size;
+    if( !parseID( stream, &id ) || id != DS64_ID ||
+        !parseSize( stream, &size ) || size > MAX_DS64_SIZE )
+        return raff_ERR_CORRUPT;
     
-    raff_ID* listIDp = parseID( stream );
-    if( !listIDp ) {
-        errnum = raff_ERR_CORRUPT;
-        return NULL;
+    size_t total = 8 + size + size % 2;
+    char*  buf   = malloc( total );
+    if( sread( stream, buf + 8, total - 8 ) < total - 8 ) {
+        free( buf );
+        return raff_ERR_CORRUPT;
     }
-    raff_ID listID = *listIDp;
     
-    raff_File* file = malloc( sizeof(raff_File) + size );
-    file->allocs = NULL;
-    file->chunk  = NULL;
-    file->size   = size;
+    *ds64 = parseDs64( (unsigned char*)buf + 8, size );
+    if( !*ds64 || (*ds64)->riffSize < 4 ) {
+        free( *ds64 );
+        free( buf );
+        return raff_ERR_CORRUPT;
+    }
     
-    for( size_t i = 0 ; i < size ; i++ ) {
-        int n = snext( stream );
-        if( n < 0 ) {
-            errnum = raff_ERR_CORRUPT;
-            free( file );
-            return NULL;
-        }
-        file->data[i] = n;
+    if( pre ) {
+        size_t n = 0;
+        addID( buf, &n, DS64_ID );
+        addSize( buf, &n, size );
+        *pre     = buf;
+        *preSize = total;
+    }
+    else {
+        free( buf );
     }
+    return raff_ERR_NONE;
+}
+
+// Returns the real size of a chunk given the ID and size from
+// its header; which is the same size unless it's SIZE_MARKER
+// and there's a ds64 chunk.
+static size_t
+ds64Size( Ds64 const* ds64, raff_ID id, size_t size ) {
+    if( size != SIZE_MARKER || !ds64 )
+        return size;
     
-    if( stream->close )
-        stream->close( stream );
+    if( id == DATA_ID )
+        return ds64->dataSize;
     
+    for( size_t i = 0 ; i < ds64->count ; i++ ) {
+        if( ds64->table[i].id == id )
+            return ds64->table[i].size;
+    }
+    return size;
+}
+
+static size_t
+resolveSize( raff_File* file, raff_ID id, size_t size ) {
+    return ds64Size( file->ds64, id, size );
+}
+
+static void
+addRootChunk( raff_File* file, raff_ID listID ) {
     raff_Chunk* chunk = alloc( file, sizeof(raff_Chunk) );
     chunk->next   = NULL;
     chunk->file   = file;
@@ -155,23 +875,204 @@ openStream( raff_Stream* stream ) {
     chunk->id     = listID;
     chunk->size   = file->size;
     chunk->start  = file->data;
+    chunk->offset = 12;
     chunk->asList = NULL;
     chunk->asData = NULL;
+    chunk->nextSame = NULL;
+    chunk->parts    = NULL;
+    chunk->partEnds = NULL;
+    chunk->partCount = 0;
+    chunk->slot     = 0;
     file->chunk  = chunk;
+}
+
+// Parses the 12 byte RIFF header at the start of a stream,
+// giving the size of the RIFF chunk's content (after the
+// sub-ID) and its sub-ID.  For RF64 and BW64 files *rf64 is
+// set, and the real size has to be read from the ds64 chunk.
+static raff_Error
+parseHeader( raff_StreamEx* stream, size_t* size, raff_ID* listID, bool* rf64 ) {
+    raff_ID id;
+    if( !parseID( stream, &id ) )
+        return raff_ERR_NOT_RIFF;
+    
+    *rf64 = id == RF64_ID || id == BW64_ID;
+    if( id != RIFF_ID && !*rf64 )
+        return raff_ERR_NOT_RIFF;
+    
+    if( !parseSize( stream, size ) || *size < 4 )
+        return raff_ERR_CORRUPT;
+    *size -= 4;
+    
+    if( !parseID( stream, listID ) )
+        return raff_ERR_CORRUPT;
+    
+    return raff_ERR_NONE;
+}
+
+// Reads the size bytes of a file's content, following the preSize
+// bytes already read into pre, which it takes over.  The size comes
+// straight from the file, so unless it's known to be there the
+// buffer starts at a block and doubles as it fills; so a size that
+// could never be read in costs no more than what the stream has.
+static char*
+readContent( raff_StreamEx* stream, char* pre, size_t preSize, size_t size, bool known ) {
+    size_t block = 1 << 20;
+    size_t cap   = known || size < block ? size : block;
+    if( cap < preSize )
+        cap = preSize;
+    
+    char* data = realloc( pre, cap );
+    if( !data && cap > 0 ) {
+        free( pre );
+        return NULL;
+    }
+    
+    size_t got = preSize;
+    while( got < size ) {
+        if( got == cap ) {
+            cap = size - cap < cap ? size : cap*2;
+            char* grown = realloc( data, cap );
+            if( !grown ) {
+                free( data );
+                return NULL;
+            }
+            data = grown;
+        }
+        
+        size_t want = cap - got;
+        size_t n    = sread( stream, data + got, want );
+        got += n;
+        if( n < want ) {
+            free( data );
+            return NULL;
+        }
+    }
+    return data;
+}
+
+// Opens a file from a stream of the given length, or ULLONG_MAX
+// if that isn't known.
+static raff_File*
+openStream( raff_StreamEx* stream, unsigned long long length ) {
+#ifdef RAFF_STATS
+    CountingStream counter;
+    stream = countStream( &counter, stream, false );
+#endif
+    
+    size_t  size;
+    raff_ID listID;
+    bool    rf64;
+    
+    errnum = parseHeader( stream, &size, &listID, &rf64 );
+    if( errnum != raff_ERR_NONE )
+        return NULL;
+    
+    // For RF64 the real size comes from the ds64 chunk, which
+    // has to be read before the rest of the content.
+    Ds64*  ds64    = NULL;
+    char*  pre     = NULL;
+    size_t preSize = 0;
+    if( rf64 ) {
+        errnum = readDs64( stream, &ds64, &pre, &preSize );
+        if( errnum != raff_ERR_NONE )
+            return NULL;
+        
+        size = ds64->riffSize - 4;
+        if( ds64->riffSize < 4 || ds64->riffSize - 4 > SIZE_MAX || size < preSize ) {
+            free( ds64 );
+            free( pre );
+            errnum = raff_ERR_CORRUPT;
+            return NULL;
+        }
+    }
+    
+    // Content that goes past the end of the file can't be there.
+    bool  known = length != ULLONG_MAX;
+    char* data  = NULL;
+    if( !known || ( length >= 12 && size <= length - 12 ) )
+        data = readContent( stream, pre, preSize, size, known );
+    else
+        free( pre );
+    if( !data && size > 0 ) {
+        free( ds64 );
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    
+    raff_File* file = malloc( sizeof(raff_File) );
+    initArena( &file->arena );
+    file->chunk   = NULL;
+    file->size    = size;
+    file->data    = data;
+    file->map     = NULL;
+    file->mapSize = 0;
+    file->source  = NULL;
+    file->path    = NULL;
+    file->ds64    = ds64;
+    initPayloads( file, newPayload( file->data, size, false ) );
+    
+    if( stream->stream.close )
+        stream->stream.close( &stream->stream );
+    
+#ifdef RAFF_STATS
+    addStats( &file->arena.stats, &counter.early );
+#endif
+    addRootChunk( file, listID );
     
     errnum = raff_ERR_NONE;
     return file;
 }
 
+// Plain streams are just next() and close(), as streams were to
+// begin with; so they're wrapped without the other methods, and
+// passed on to from the ones they have.
+typedef struct PlainStream {
+    raff_StreamEx stream;
+    raff_Stream*  inner;
+} PlainStream;
+
+static int
+pnextCb( raff_Stream* stream ) {
+    PlainStream* ps = (PlainStream*)stream;
+    return ps->inner->next( ps->inner );
+}
+
+static void
+pcloseCb( raff_Stream* stream ) {
+    PlainStream* ps = (PlainStream*)stream;
+    if( ps->inner->close )
+        ps->inner->close( ps->inner );
+}
+
 raff_File*
 raff_openStream( raff_Stream* stream ) {
-    return openStream( stream );
+    PlainStream plain;
+    plain.stream.stream.next  = pnextCb;
+    plain.stream.stream.close = pcloseCb;
+    plain.stream.read         = NULL;
+    plain.stream.skip         = NULL;
+    plain.stream.seek         = NULL;
+    plain.inner = stream;
+    
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openStream( &plain.stream, ULLONG_MAX );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
+}
+
+raff_File*
+raff_openStreamEx( raff_StreamEx* stream ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openStream( stream, ULLONG_MAX );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
 }
 
 
 typedef struct FileStream {
-    raff_Stream stream;
-    FILE*       file;
+    raff_StreamEx stream;
+    FILE*         file;
 } FileStream;
 
 static int
@@ -180,41 +1081,541 @@ fnextCb( raff_Stream* stream ) {
     return fgetc( fs->file );
 }
 
-static void
-fcloseCb( raff_Stream* stream ) {
+static size_t
+freadCb( raff_Stream* stream, char* buf, size_t size ) {
     FileStream* fs = (FileStream*)stream;
-    fclose( fs->file );
-    free( stream );
+    return fread( buf, 1, size, fs->file );
 }
 
-raff_File*
-raff_openFile( char const* path ) {
-    FILE* file = fopen( path, "r" );
-    if( !file ) {
-        errnum = raff_ERR_CANT_OPEN;
-        return NULL;
-    }
+static size_t
+fskipCb( raff_Stream* stream, size_t size ) {
+    FileStream* fs = (FileStream*)stream;
+    if( size <= LONG_MAX && fseek( fs->file, size, SEEK_CUR ) == 0 )
+        return size;
+    
+    // Not seekable, so read through it instead.
+    size_t skipped = 0;
+    while( skipped < size && fgetc( fs->file ) >= 0 )
+        skipped++;
+    return skipped;
+}
+
+static int
+fseekCb( raff_Stream* stream, unsigned long long offset ) {
+    FileStream* fs = (FileStream*)stream;
+#if defined(_WIN32)
+    return _fseeki64( fs->file, offset, SEEK_SET );
+#else
+    return fseeko( fs->file, offset, SEEK_SET );
+#endif
+}
+
+static void
+fcloseCb( raff_Stream* stream ) {
+    FileStream* fs = (FileStream*)stream;
+    fclose( fs->file );
+    free( stream );
+}
+
+static raff_StreamEx*
+openFileStream( char const* path ) {
+    FILE* file = fopen( path, "rb" );
+    if( !file )
+        return NULL;
     
     FileStream* stream = malloc( sizeof(FileStream) );
-    stream->stream.next  = fnextCb;
-    stream->stream.close = fcloseCb;
+    stream->stream.stream.next  = fnextCb;
+    stream->stream.stream.close = fcloseCb;
+    stream->stream.read         = freadCb;
+    stream->stream.skip         = fskipCb;
+    stream->stream.seek         = fseekCb;
     stream->file = file;
     
-    return openStream( (raff_Stream*)stream );
+    return (raff_StreamEx*)stream;
 }
 
-void
-raff_closeFile( raff_File* file ) {
-    while( file->allocs ) {
-        raff_Alloc* a = file->allocs;
-        file->allocs = file->allocs->next;
+// Finds the length of a file opened for reading, leaving it at
+// the start; or gives ULLONG_MAX if it can't be told.
+static unsigned long long
+fileLength( FILE* file ) {
+#if defined(_WIN32)
+    long long length = _fseeki64( file, 0, SEEK_END ) == 0 ? _ftelli64( file ) : -1;
+    _fseeki64( file, 0, SEEK_SET );
+#else
+    long long length = fseeko( file, 0, SEEK_END ) == 0 ? ftello( file ) : -1;
+    fseeko( file, 0, SEEK_SET );
+#endif
+    return length < 0 ? ULLONG_MAX : (unsigned long long)length;
+}
+
+static void
+setPath( raff_File* file, char const* path ) {
+    size_t len = strlen( path );
+    file->path = malloc( len + 1 );
+    memcpy( file->path, path, len + 1 );
+}
+
+static raff_File*
+openFile( char const* path ) {
+    raff_StreamEx* stream = openFileStream( path );
+    if( !stream ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    raff_File* file = openStream( stream, fileLength( ((FileStream*)stream)->file ) );
+    if( !file ) {
+        stream->stream.close( &stream->stream );
+        return NULL;
+    }
+    
+    setPath( file, path );
+    return file;
+}
+
+raff_File*
+raff_openFile( char const* path ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openFile( path );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
+}
+
+static raff_File*
+openLazy( raff_StreamEx* stream ) {
+    if( !stream->seek || stream->seek( &stream->stream, 0 ) != 0 ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    size_t  size;
+    raff_ID listID;
+    bool    rf64;
+    
+    errnum = parseHeader( stream, &size, &listID, &rf64 );
+    if( errnum != raff_ERR_NONE )
+        return NULL;
+    
+    Ds64* ds64 = NULL;
+    if( rf64 ) {
+        errnum = readDs64( stream, &ds64, NULL, NULL );
+        if( errnum != raff_ERR_NONE )
+            return NULL;
+        size = ds64->riffSize - 4;
+    }
+    
+    raff_File* file = malloc( sizeof(raff_File) );
+    initArena( &file->arena );
+    file->chunk   = NULL;
+    file->size    = size;
+    file->data    = NULL;
+    file->map     = NULL;
+    file->mapSize = 0;
+    file->source  = stream;
+    file->path    = NULL;
+    file->ds64    = ds64;
+    initPayloads( file, NULL );
+    
+    addRootChunk( file, listID );
+    
+    errnum = raff_ERR_NONE;
+    return file;
+}
+
+// A lazily opened file keeps reading from its stream, so for the
+// stats it keeps the counting stream in front of it too; which is
+// freed without closing the stream if the open fails.
+static raff_File*
+openStreamLazy( raff_StreamEx* stream ) {
+#ifdef RAFF_STATS
+    CountingStream* counter = malloc( sizeof(CountingStream) );
+    raff_File*      file    = openLazy( countStream( counter, stream, true ) );
+    if( !file ) {
+        free( counter );
+        return NULL;
+    }
+    
+    addStats( &file->arena.stats, &counter->early );
+    counter->stats = &file->arena.stats;
+    return file;
+#else
+    return openLazy( stream );
+#endif
+}
+
+raff_File*
+raff_openStreamLazy( raff_StreamEx* stream ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openStreamLazy( stream );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
+}
+
+static raff_File*
+openFileLazy( char const* path ) {
+    raff_StreamEx* stream = openFileStream( path );
+    if( !stream ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    raff_File* file = openStreamLazy( stream );
+    if( !file ) {
+        stream->stream.close( &stream->stream );
+        return NULL;
+    }
+    
+    setPath( file, path );
+    return file;
+}
+
+raff_File*
+raff_openFileLazy( char const* path ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openFileLazy( path );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
+}
+
+static raff_File*
+mapFile( char const* path, raff_Access access ) {
+#ifdef RAFF_POSIX
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    struct stat st;
+    if( fstat( fd, &st ) != 0 ) {
+        close( fd );
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    size_t mapSize = st.st_size;
+    if( mapSize < 12 ) {
+        close( fd );
+        errnum = raff_ERR_NOT_RIFF;
+        return NULL;
+    }
+    
+    void* map = mmap( NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0 );
+    
+    // The mapping holds its own reference to the file, so
+    // the descriptor isn't needed anymore.
+    close( fd );
+    if( map == MAP_FAILED ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    posix_madvise( map, mapSize,
+        access == raff_ACCESS_RANDOM
+            ? POSIX_MADV_RANDOM
+            : POSIX_MADV_SEQUENTIAL );
+    
+    unsigned char const* head = map;
+    raff_ID              id   = decodeID( head );
+    if( id != RIFF_ID && id != RF64_ID && id != BW64_ID ) {
+        munmap( map, mapSize );
+        errnum = raff_ERR_NOT_RIFF;
+        return NULL;
+    }
+    
+    // For RF64 the real size is in the ds64 chunk that has
+    // to come first.
+    size_t size = decodeSize( head + 4 );
+    Ds64*  ds64 = NULL;
+    if( id != RIFF_ID ) {
+        size_t ds64Size = mapSize >= 20 ? decodeSize( head + 16 ) : 0;
+        if( mapSize >= 20 && decodeID( head + 12 ) == DS64_ID &&
+            ds64Size <= mapSize - 20 )
+            ds64 = parseDs64( head + 20, ds64Size );
+        
+        if( !ds64 ) {
+            munmap( map, mapSize );
+            errnum = raff_ERR_CORRUPT;
+            return NULL;
+        }
+        size = ds64->riffSize;
+    }
+    
+    if( size < 4 || size - 4 > mapSize - 12 ) {
+        munmap( map, mapSize );
+        free( ds64 );
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    
+    raff_File* file = malloc( sizeof(raff_File) );
+    initArena( &file->arena );
+    file->chunk   = NULL;
+    file->size    = size - 4;
+    file->data    = (char*)map + 12;
+    file->map     = map;
+    file->mapSize = mapSize;
+    file->source  = NULL;
+    file->path    = NULL;
+    file->ds64    = ds64;
+    initPayloads( file, newPayload( map, mapSize, true ) );
+    
+    addRootChunk( file, decodeID( head + 8 ) );
+    setPath( file, path );
+    
+    errnum = raff_ERR_NONE;
+    return file;
+#else
+    // No mapping support on this platform, so just do
+    // a normal buffered open.
+    (void)access;
+    return openFile( path );
+#endif
+}
+
+raff_File*
+raff_mapFile( char const* path, raff_Access access ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = mapFile( path, access );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
+}
+
+// Works out how many workers to use for the given number of
+// jobs; one per core if 0 was asked for, but no more than one
+// per job.  Without thread support there's only ever one.
+static unsigned
+workerCount( unsigned workers, size_t jobs ) {
+#ifdef RAFF_POSIX
+    if( workers == 0 ) {
+        long cores = sysconf( _SC_NPROCESSORS_ONLN );
+        workers = cores > 0 ? (unsigned)cores : 1;
+    }
+    if( workers > jobs )
+        workers = jobs;
+    return workers > 0 ? workers : 1;
+#else
+    (void)workers;
+    (void)jobs;
+    return 1;
+#endif
+}
+
+// Runs fn on each of the given args, which are argSize bytes
+// apart, each on a thread of its own; except the first, which
+// runs on the calling thread.  Returns once they're all done.
+// If a thread can't be started its arg is just skipped, so fn
+// has to be able to pick up the work of others.
+static void
+runWorkers( unsigned workers, void* (*fn)( void* ), void* args, size_t argSize ) {
+#ifdef RAFF_POSIX
+    pthread_t* threads = malloc( workers*sizeof(pthread_t) );
+    bool*      started = malloc( workers*sizeof(bool) );
+    for( unsigned i = 1 ; i < workers ; i++ ) {
+        void* arg = (char*)args + i*argSize;
+        started[i] = pthread_create( &threads[i], NULL, fn, arg ) == 0;
+    }
+    fn( args );
+    for( unsigned i = 1 ; i < workers ; i++ ) {
+        if( started[i] )
+            pthread_join( threads[i], NULL );
+    }
+    free( started );
+    free( threads );
+#else
+    (void)workers;
+    (void)argSize;
+    fn( args );
+#endif
+}
+
+// A batch open splits the files between its workers as ranges
+// of indices.  Workers take files from the front of their own
+// range, and once that's empty they steal the back half of
+// someone else's.
+typedef struct BatchQueue {
+#ifdef RAFF_POSIX
+    pthread_mutex_t lock;
+#endif
+    size_t          next;
+    size_t          end;
+} BatchQueue;
+
+typedef struct Batch {
+    char const* const* paths;
+    raff_StreamEx**    streams;
+    raff_BatchCb       cb;
+    void*              user;
+    unsigned           workers;
+    BatchQueue*        queues;
+} Batch;
+
+typedef struct BatchWorker {
+    Batch*   batch;
+    unsigned self;
+} BatchWorker;
+
+static void
+batchOpen( Batch* batch, size_t index ) {
+    raff_File* file;
+    if( batch->paths )
+        file = raff_openFile( batch->paths[index] );
+    else
+        file = raff_openStreamEx( batch->streams[index] );
+    
+    // The root list is parsed here as well, so that's done
+    // on the worker too; a file whose root won't parse is no
+    // more use than one that wouldn't open.
+    raff_Error err = errnum;
+    if( file && !raff_chunkAsList( raff_fileAsChunk( file ) ) ) {
+        err = errnum;
+        raff_closeFile( file );
+        file = NULL;
+    }
+    
+    batch->cb( index, file, err, batch->user );
+}
+
+#ifdef RAFF_POSIX
+// Takes the next file for a worker to open, returning false
+// once there are none left anywhere.
+static bool
+batchTake( Batch* batch, unsigned self, size_t* index ) {
+    BatchQueue* own = &batch->queues[self];
+    
+    pthread_mutex_lock( &own->lock );
+    bool got = own->next < own->end;
+    if( got )
+        *index = own->next++;
+    pthread_mutex_unlock( &own->lock );
+    if( got )
+        return true;
+    
+    for( unsigned i = 1 ; i < batch->workers ; i++ ) {
+        BatchQueue* victim = &batch->queues[( self + i ) % batch->workers];
+        
+        pthread_mutex_lock( &victim->lock );
+        size_t left = victim->end - victim->next;
+        size_t from = victim->end - ( left + 1 ) / 2;
+        size_t to   = victim->end;
+        victim->end = from;
+        pthread_mutex_unlock( &victim->lock );
+        
+        // The first stolen file is opened now and the rest
+        // go in the worker's own queue, where they can be
+        // stolen in turn.
+        if( from < to ) {
+            pthread_mutex_lock( &own->lock );
+            own->next = from + 1;
+            own->end  = to;
+            pthread_mutex_unlock( &own->lock );
+            
+            *index = from;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void*
+batchWork( void* arg ) {
+    BatchWorker* worker = arg;
+    size_t       index;
+    while( batchTake( worker->batch, worker->self, &index ) )
+        batchOpen( worker->batch, index );
+    
+    // Threads other than the caller's are done with now, so
+    // their cached slabs would otherwise be lost.
+    if( worker->self != 0 )
+        raff_releaseSlabs();
+    return NULL;
+}
+#endif
+
+static void
+openBatch( Batch* batch, size_t count ) {
+    batch->workers = workerCount( batch->workers, count );
+    
+#ifdef RAFF_POSIX
+    if( batch->workers > 1 ) {
+        unsigned     workers = batch->workers;
+        BatchWorker* jobs    = malloc( workers*sizeof(BatchWorker) );
+        
+        batch->queues = malloc( workers*sizeof(BatchQueue) );
+        for( unsigned i = 0 ; i < workers ; i++ ) {
+            pthread_mutex_init( &batch->queues[i].lock, NULL );
+            batch->queues[i].next = count*i/workers;
+            batch->queues[i].end  = count*( i + 1 )/workers;
+            jobs[i].batch = batch;
+            jobs[i].self  = i;
+        }
         
-        free( a );
+        // Files of workers that can't be started just get
+        // stolen by those that are.
+        runWorkers( workers, batchWork, jobs, sizeof(BatchWorker) );
+        
+        for( unsigned i = 0 ; i < workers ; i++ )
+            pthread_mutex_destroy( &batch->queues[i].lock );
+        free( batch->queues );
+        free( jobs );
+        return;
     }
+#endif
+    
+    // Without threads the files are just opened in order.
+    for( size_t i = 0 ; i < count ; i++ )
+        batchOpen( batch, i );
+}
+
+void
+raff_openFiles( char const* const* paths, size_t count, unsigned workers,
+                raff_BatchCb cb, void* user ) {
+    Batch batch = { paths, NULL, cb, user, workers, NULL };
+    openBatch( &batch, count );
+}
+
+void
+raff_openStreams( raff_StreamEx** streams, size_t count, unsigned workers,
+                  raff_BatchCb cb, void* user ) {
+    Batch batch = { NULL, streams, cb, user, workers, NULL };
+    openBatch( &batch, count );
+}
+
+void
+raff_closeFile( raff_File* file ) {
+    releaseArena( &file->arena );
+    
+    if( file->payload )
+        releasePayload( file->payload );
+    for( size_t i = 0 ; i < file->heldCount ; i++ )
+        releasePayload( file->held[i] );
+    free( file->held );
+    
+    if( file->source && file->source->stream.close )
+        file->source->stream.close( &file->source->stream );
+    
+    free( file->path );
+    free( file->ds64 );
     
     free( file );
 }
 
+void
+raff_setSlabSize( size_t size ) {
+    raff_releaseSlabs();
+    slabSize = size < 1024 ? 1024 : ( size + ALIGN - 1 ) / ALIGN * ALIGN;
+}
+
+void
+raff_releaseSlabs( void ) {
+    while( freeSlabs ) {
+        raff_Slab* slab = freeSlabs;
+        freeSlabs = slab->next;
+        free( slab );
+    }
+    freeCount = 0;
+}
+
 raff_Error
 raff_errorNum( void ) {
     return errnum;
@@ -235,15 +1636,29 @@ raff_errorMsg( void ) {
             return "Invalid or corrup formatting";
         case raff_ERR_CANT_OPEN:
             return "Couldn't open file";
+        case raff_ERR_CANT_WRITE:
+            return "Couldn't write file";
+        case raff_ERR_BAD_QUERY:
+            return "Invalid query";
+        case raff_ERR_CANT_EDIT:
+            return "Chunk can't be edited in place";
+        case raff_ERR_NOT_AVI:
+            return "File is not an AVI";
+        case raff_ERR_NOT_WAVE:
+            return "File is not a WAVE file";
+        case raff_ERR_BAD_FORMAT:
+            return "Samples are of an unsupported format";
+        case raff_ERR_BAD_INDEX:
+            return "Index is missing, broken, or out of date";
         default:
             return "You shouldn't get this";
     }
 }
 
 typedef struct ChunkStream {
-    raff_Stream  stream;
-    raff_Chunk*  chunk;
-    size_t       next;
+    raff_StreamEx stream;
+    raff_Chunk*   chunk;
+    size_t        next;
 } ChunkStream;
 
 static int
@@ -255,127 +1670,479 @@ cnextCb( raff_Stream* stream ) {
     return (unsigned char)cs->chunk->start[cs->next++];
 }
 
+static size_t
+creadCb( raff_Stream* stream, char* buf, size_t size ) {
+    ChunkStream* cs = (ChunkStream*)stream;
+    if( cs->next >= cs->chunk->size )
+        return 0;
+    
+    size_t left = cs->chunk->size - cs->next;
+    if( size > left )
+        size = left;
+    
+    memcpy( buf, cs->chunk->start + cs->next, size );
+    cs->next += size;
+    return size;
+}
+
+static size_t
+cskipCb( raff_Stream* stream, size_t size ) {
+    ChunkStream* cs = (ChunkStream*)stream;
+    
+    // Skipping is allowed to run past the end of the chunk,
+    // so the caller can tell a truncated chunk apart from
+    // one that fits; though not so far it wraps around.
+    if( size > SIZE_MAX - cs->next )
+        size = SIZE_MAX - cs->next;
+    cs->next += size;
+    return size;
+}
+
 static ChunkStream
 makeChunkStream( raff_Chunk* chunk ) {
     ChunkStream stream;
-    stream.stream.next  = cnextCb;
-    stream.stream.close = NULL;
+    stream.stream.stream.next  = cnextCb;
+    stream.stream.stream.close = NULL;
+    stream.stream.read         = creadCb;
+    stream.stream.skip         = cskipCb;
+    stream.stream.seek         = NULL;
     stream.chunk = chunk;
     stream.next  = 0;
     
     return stream;
 }
 
-static raff_Chunk*
-parseNextChunk( raff_File* file, ChunkStream* stream ) {
-    raff_ID* idp = parseID( (raff_Stream*)stream );
-    if( !idp ) {
-        errnum = raff_ERR_CORRUPT;
-        return NULL;
-    }
-    raff_ID id = *idp;
-    
-    size_t* sizep = parseSize( (raff_Stream*)stream );
-    if( !sizep ) {
+// The header of a chunk found while parsing a list.
+typedef struct ChunkHead {
+    raff_Type          type;
+    raff_ID            id;
+    size_t             size;
+    unsigned long long offset;
+} ChunkHead;
+
+static bool
+parseNextHead( raff_File* file, ChunkStream* stream, ChunkHead* head ) {
+    raff_ID id;
+    size_t  size;
+    if( !parseID( (raff_StreamEx*)stream, &id ) ||
+        !parseSize( (raff_StreamEx*)stream, &size ) ) {
         errnum = raff_ERR_CORRUPT;
-        return NULL;
+        return false;
     }
-    size_t size = *sizep;
+    size = resolveSize( file, id, size );
     
     // If size is odd then we need to skip the padding byte.
     bool pad = size % 2;
     
-    raff_Chunk* chunk = alloc( file, sizeof(raff_Chunk) );
-    chunk->next   = NULL;
-    chunk->file   = file;
-    chunk->list   = NULL;
-    chunk->asList = NULL;
-    chunk->asData = NULL;
     if( id == LIST_ID || id == RIFF_ID ) {
-        raff_ID* listIDp = parseID( (raff_Stream*)stream );
-        if( !listIDp ) {
+        raff_ID listID;
+        if( size < 4 || !parseID( (raff_StreamEx*)stream, &listID ) ) {
             errnum = raff_ERR_CORRUPT;
-            return NULL;
+            return false;
         }
-        raff_ID listID = *listIDp;
         
         size -= 4;
         
-        chunk->type = id == LIST_ID ? TYPE_LIST : TYPE_RIFF;
-        chunk->id   = listID;
+        head->type = id == LIST_ID ? TYPE_LIST : TYPE_RIFF;
+        head->id   = listID;
     }
     else {
-        chunk->type = TYPE_OTHER;
-        chunk->id   = id;
+        head->type = TYPE_OTHER;
+        head->id   = id;
     }
-    chunk->size  = size;
-    chunk->start = stream->chunk->start + stream->next;
+    head->size   = size;
+    head->offset = stream->chunk->offset + stream->next;
     
-    stream->next += size + pad;
-    if( stream->next > stream->chunk->size ) {
+    // Sizes from the ds64 chunk can be anything, so they're
+    // checked against what's left before being added.
+    size_t left = stream->chunk->size - stream->next;
+    if( size > left || pad > left - size ) {
         errnum = raff_ERR_CORRUPT;
-        return NULL;
+        return false;
     }
+    sskip( (raff_StreamEx*)stream, size + pad );
     
     errnum = raff_ERR_NONE;
-    return chunk;
+    return true;
 }
 
-raff_Chunk*
-raff_fileAsChunk( raff_File* file ) {
-    return file->chunk;
-}
+static size_t encodeHeader( raff_Chunk* chunk, char* head );
+static bool   ropeRead( raff_Chunk* chunk, size_t offset, char* buf, size_t size );
 
-raff_List*
-raff_chunkAsList( raff_Chunk* chunk ) {
-    if( chunk->type == TYPE_OTHER ) {
-        errnum = raff_ERR_NOT_LIST;
-        return NULL;
+// Copies size bytes of a chunk's content, starting at offset,
+// into buf; reading them from the file's source if the chunk
+// hasn't been loaded, or from its parts if it's an encoded
+// list that hasn't been flattened.  Returns false if they
+// can't be read.
+static bool
+chunkRead( raff_Chunk* chunk, size_t offset, char* buf, size_t size ) {
+    if( chunk->start ) {
+        memcpy( buf, chunk->start + offset, size );
+        return true;
     }
     
-    if( chunk->asList ) {
-        errnum = raff_ERR_NONE;
-        return chunk->asList;
+    if( chunk->parts )
+        return ropeRead( chunk, offset, buf, size );
+    
+    raff_StreamEx* source = chunk->file->source;
+    if( !source || source->seek( &source->stream, chunk->offset + offset ) != 0 )
+        return false;
+    
+    return sread( source, buf, size ) == size;
+}
+
+// Returns a chunk's content, loading it into the file's pool
+// first if the chunk belongs to a lazily opened file and
+// hasn't been loaded yet, or flattening it if it's an encoded
+// list.  Returns NULL and sets the error if the content can't
+// be read.
+static char*
+chunkBytes( raff_Chunk* chunk ) {
+    if( chunk->start )
+        return chunk->start;
+    
+    char* buf = alloc( chunk->file, chunk->size );
+    if( !chunkRead( chunk, 0, buf, chunk->size ) ) {
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
     }
     
-    raff_List* list = alloc( chunk->file, sizeof(raff_List) );
-    list->file    = chunk->file;
-    list->id      = chunk->id;
-    list->asChunk = chunk;
+    chunk->start = buf;
+    if( chunk->asData )
+        chunk->asData->start = buf;
+    return buf;
+}
+
+// Like parseNextHead(), but for chunks of lazily opened files;
+// reads the header at *pos from the file's source and then
+// skips over the content without reading it.
+static bool
+parseLazyHead( raff_File* file, unsigned long long* pos,
+               unsigned long long end, ChunkHead* out ) {
+    raff_StreamEx* source = file->source;
     
-    ChunkStream cs = makeChunkStream( chunk );
+    char head[12];
+    if( end - *pos < 8 || source->seek( &source->stream, *pos ) != 0 ||
+        sread( source, head, 8 ) < 8 ) {
+        errnum = raff_ERR_CORRUPT;
+        return false;
+    }
+    raff_ID id     = decodeID( (unsigned char*)head );
+    size_t  size   = decodeSize( (unsigned char*)head + 4 );
+    size_t  header = 8;
+    size = resolveSize( file, id, size );
     
-    raff_Chunk* firstChunk = NULL;
-    raff_Chunk* lastChunk  = NULL;
-    while( cs.next < chunk->size ) {
-        
-        raff_Chunk* sub = parseNextChunk( list->file, &cs );
-        if( !sub )
-            return NULL;
-        
-        sub->list = list;
-        if( !firstChunk ) {
-            firstChunk = sub;
-            lastChunk  = sub;
-        }
-        else {
-            lastChunk->next = sub;
-            lastChunk = sub;
+    if( id == LIST_ID || id == RIFF_ID ) {
+        if( size < 4 || end - *pos < 12 ||
+            sread( source, head + 8, 4 ) < 4 ) {
+            errnum = raff_ERR_CORRUPT;
+            return false;
         }
+        
+        out->type = id == LIST_ID ? TYPE_LIST : TYPE_RIFF;
+        out->id   = decodeID( (unsigned char*)head + 8 );
+        size   -= 4;
+        header += 4;
+    }
+    else {
+        out->type = TYPE_OTHER;
+        out->id   = id;
     }
+    out->size   = size;
+    out->offset = *pos + header;
     
-    list->cursor  = firstChunk;
-    list->first   = firstChunk;
-    list->last    = lastChunk;
+    // If size is odd then we need to skip the padding byte.
+    // Sizes from the ds64 chunk can be anything, so they're
+    // checked against what's left before being added.
+    unsigned long long left = end - *pos - header;
+    if( size > left || size % 2 > left - size ) {
+        errnum = raff_ERR_CORRUPT;
+        return false;
+    }
+    *pos += header + size + size % 2;
     
-    chunk->asList = list;
     errnum = raff_ERR_NONE;
-    return list;
+    return true;
 }
 
-raff_Data*
-raff_chunkAsData( raff_Chunk* chunk ) {
-    if( chunk->type != TYPE_OTHER ) {
+raff_Chunk*
+raff_fileAsChunk( raff_File* file ) {
+    return file->chunk;
+}
+
+static raff_Chunk*
+copyChunkIn( raff_Chunk* chunk, Arena* arena ) {
+    
+    raff_Chunk* copy = arenaAlloc( arena, sizeof(raff_Chunk) );
+    copy->next   = NULL;
+    copy->file   = chunk->file;
+    copy->list   = NULL;
+    copy->type   = chunk->type;
+    copy->id     = chunk->id;
+    copy->size   = chunk->size;
+    copy->start  = chunk->start;
+    copy->offset = chunk->offset;
+    copy->asList = NULL;
+    copy->asData = NULL;
+    copy->nextSame = NULL;
+    copy->parts    = chunk->parts;
+    copy->partEnds = chunk->partEnds;
+    copy->partCount = chunk->partCount;
+    copy->slot     = 0;
+    
+    return copy;
+}
+
+// Does the work of raff_chunkAsList(), allocating from the given
+// arena; which is the file's own, except when parsing a tree in
+// parallel where each worker has its own.
+static raff_List*
+parseList( raff_Chunk* chunk, Arena* arena ) {
+    if( chunk->type == TYPE_OTHER ) {
+        errnum = raff_ERR_NOT_LIST;
+        return NULL;
+    }
+    
+    if( chunk->asList ) {
+        errnum = raff_ERR_NONE;
+        return chunk->asList;
+    }
+    
+    raff_List* list = arenaAlloc( arena, sizeof(raff_List) );
+    list->file    = chunk->file;
+    list->id      = chunk->id;
+    list->asChunk = chunk;
+    list->cursor  = NULL;
+    list->first   = NULL;
+    list->last    = NULL;
+    list->count   = 0;
+    list->table   = NULL;
+    list->index   = NULL;
+    
+    // Encoded lists that haven't been flattened just get copies
+    // of their parts.
+    if( !chunk->start && chunk->parts ) {
+        for( size_t i = 0 ; i < chunk->partCount ; i++ ) {
+            raff_Chunk* sub = copyChunkIn( chunk->parts[i], arena );
+            sub->list = list;
+            if( list->last )
+                list->last->next = sub;
+            else
+                list->first = sub;
+            list->last = sub;
+        }
+        list->cursor = list->first;
+        list->count  = chunk->partCount;
+        COUNT( &arena->stats, listsParsed, 1 );
+        COUNT( &arena->stats, chunksParsed, chunk->partCount );
+        
+        chunk->asList = list;
+        errnum = raff_ERR_NONE;
+        return list;
+    }
+    
+    // Others get a child table, which is filled in temporary
+    // arrays first since the number of chunks isn't known
+    // until they've all been found.  Chunks of lazily opened
+    // files that haven't been loaded are parsed straight from
+    // the source, header by header.
+    ChunkStream        cs   = makeChunkStream( chunk );
+    bool               lazy = !chunk->start;
+    unsigned long long pos  = chunk->offset;
+    unsigned long long end  = chunk->offset + chunk->size;
+    
+    ChildTable tmp      = { NULL, NULL, NULL, NULL, NULL, NULL, 0, 0 };
+    size_t     count    = 0;
+    size_t     capacity = 0;
+    bool       ok       = true;
+    while( lazy ? pos < end : cs.next < chunk->size ) {
+        ChunkHead head;
+        ok = lazy ? parseLazyHead( list->file, &pos, end, &head )
+                  : parseNextHead( list->file, &cs, &head );
+        if( !ok )
+            break;
+        
+        if( count == capacity ) {
+            capacity    = capacity ? capacity*2 : 16;
+            tmp.ids     = realloc( tmp.ids, capacity*sizeof(uint32_t) );
+            tmp.types   = realloc( tmp.types, capacity );
+            tmp.sizes   = realloc( tmp.sizes, capacity*sizeof(size_t) );
+            tmp.offsets = realloc( tmp.offsets, capacity*sizeof(unsigned long long) );
+        }
+        tmp.ids[count]     = (uint32_t)head.id;
+        tmp.types[count]   = head.type;
+        tmp.sizes[count]   = head.size;
+        tmp.offsets[count] = head.offset;
+        count++;
+    }
+    
+    if( ok ) {
+        ChildTable* table = arenaAlloc( arena, sizeof(ChildTable) );
+        table->ids        = arenaAlloc( arena, count*sizeof(uint32_t) );
+        table->types      = arenaAlloc( arena, count );
+        table->sizes      = arenaAlloc( arena, count*sizeof(size_t) );
+        table->offsets    = arenaAlloc( arena, count*sizeof(unsigned long long) );
+        table->handles    = NULL;
+        table->base       = chunk->start;
+        table->baseOffset = chunk->offset;
+        table->cursor     = 0;
+        if( count > 0 ) {
+            memcpy( table->ids, tmp.ids, count*sizeof(uint32_t) );
+            memcpy( table->types, tmp.types, count );
+            memcpy( table->sizes, tmp.sizes, count*sizeof(size_t) );
+            memcpy( table->offsets, tmp.offsets, count*sizeof(unsigned long long) );
+        }
+        
+        list->table = table;
+        list->count = count;
+    }
+    free( tmp.ids );
+    free( tmp.types );
+    free( tmp.sizes );
+    free( tmp.offsets );
+    if( !ok )
+        return NULL;
+    
+    COUNT( &arena->stats, listsParsed, 1 );
+    COUNT( &arena->stats, chunksParsed, count );
+    
+    chunk->asList = list;
+    errnum = raff_ERR_NONE;
+    return list;
+}
+
+// Returns the handle for entry i of a list's child table, making
+// it from the given arena if there isn't one yet.
+static raff_Chunk*
+childAt( raff_List* list, size_t i, Arena* arena ) {
+    ChildTable* table = list->table;
+    if( !table->handles ) {
+        table->handles = arenaAlloc( arena, list->count*sizeof(raff_Chunk*) );
+        for( size_t k = 0 ; k < list->count ; k++ )
+            table->handles[k] = NULL;
+    }
+    if( table->handles[i] )
+        return table->handles[i];
+    
+    raff_Chunk* chunk = arenaAlloc( arena, sizeof(raff_Chunk) );
+    chunk->next   = NULL;
+    chunk->file   = list->file;
+    chunk->list   = list;
+    chunk->type   = table->types[i];
+    chunk->id     = table->ids[i];
+    chunk->size   = table->sizes[i];
+    chunk->start  = NULL;
+    chunk->offset = table->offsets[i];
+    chunk->asList = NULL;
+    chunk->asData = NULL;
+    chunk->nextSame = NULL;
+    chunk->parts    = NULL;
+    chunk->partEnds = NULL;
+    chunk->partCount = 0;
+    chunk->slot     = i;
+    if( table->base )
+        chunk->start = table->base + ( chunk->offset - table->baseOffset );
+    
+    table->handles[i] = chunk;
+    return chunk;
+}
+
+// First and next chunks of a list, whether it's linked or has a
+// child table; handles are made from the given arena as needed.
+static raff_Chunk*
+firstChild( raff_List* list, Arena* arena ) {
+    if( !list->table )
+        return list->first;
+    return list->count > 0 ? childAt( list, 0, arena ) : NULL;
+}
+
+static raff_Chunk*
+nextChild( raff_List* list, raff_Chunk* chunk, Arena* arena ) {
+    if( !list->table )
+        return chunk->next;
+    return chunk->slot + 1 < list->count ? childAt( list, chunk->slot + 1, arena ) : NULL;
+}
+
+// Turns a list with a child table into a linked list, before
+// it's changed or needed that way.
+static void
+linkList( raff_List* list ) {
+    ChildTable* table = list->table;
+    if( !table )
+        return;
+    
+    raff_Chunk* prev = NULL;
+    for( size_t i = 0 ; i < list->count ; i++ ) {
+        raff_Chunk* chunk = childAt( list, i, &list->file->arena );
+        if( prev )
+            prev->next = chunk;
+        else
+            list->first = chunk;
+        prev = chunk;
+    }
+    list->last   = prev;
+    list->cursor = table->cursor < list->count ? table->handles[table->cursor] : NULL;
+    list->table  = NULL;
+}
+
+// Finds the first entry of a child table from the given one on
+// with the given ID, or returns count if there isn't one.  Where
+// SSE2 is available IDs are compared sixteen at a time, then four
+// at a time for what's left over.
+static size_t
+findPackedID( uint32_t const* ids, size_t from, size_t count, raff_ID id ) {
+    if( id < 0 || id > 0xFFFFFFFF )
+        return count;
+    
+    uint32_t want = (uint32_t)id;
+    size_t   i    = from;
+#ifdef RAFF_SSE2
+    __m128i key = _mm_set1_epi32( (int)want );
+    for( ; i + 16 <= count ; i += 16 ) {
+        __m128i a = _mm_cmpeq_epi32( _mm_loadu_si128( (__m128i const*)( ids + i ) ), key );
+        __m128i b = _mm_cmpeq_epi32( _mm_loadu_si128( (__m128i const*)( ids + i + 4 ) ), key );
+        __m128i c = _mm_cmpeq_epi32( _mm_loadu_si128( (__m128i const*)( ids + i + 8 ) ), key );
+        __m128i d = _mm_cmpeq_epi32( _mm_loadu_si128( (__m128i const*)( ids + i + 12 ) ), key );
+        __m128i any = _mm_or_si128( _mm_or_si128( a, b ), _mm_or_si128( c, d ) );
+        if( _mm_movemask_epi8( any ) )
+            break;
+    }
+    for( ; i + 4 <= count ; i += 4 ) {
+        __m128i v    = _mm_loadu_si128( (__m128i const*)( ids + i ) );
+        int     mask = _mm_movemask_epi8( _mm_cmpeq_epi32( v, key ) );
+        if( mask ) {
+            for( int k = 0 ; k < 4 ; k++ ) {
+                if( mask >> ( k*4 ) & 0xF )
+                    return i + k;
+            }
+        }
+    }
+#endif
+    for( ; i < count ; i++ ) {
+        if( ids[i] == want )
+            return i;
+    }
+    return count;
+}
+
+raff_List*
+raff_chunkAsList( raff_Chunk* chunk ) {
+#ifdef RAFF_STATS
+    // Only the lists that actually get parsed are timed.
+    if( chunk->type != TYPE_OTHER && !chunk->asList ) {
+        BEGIN_PHASE( raff_PHASE_PARSE, chunk->file );
+        raff_List* list = parseList( chunk, &chunk->file->arena );
+        END_PHASE( raff_PHASE_PARSE, chunk->file );
+        return list;
+    }
+#endif
+    return parseList( chunk, &chunk->file->arena );
+}
+
+// Does the work of raff_chunkAsData(), like parseList().
+static raff_Data*
+parseData( raff_Chunk* chunk, Arena* arena ) {
+    if( chunk->type != TYPE_OTHER ) {
         errnum = raff_ERR_IS_LIST;
         return NULL;
     }
@@ -384,7 +2151,7 @@ raff_chunkAsData( raff_Chunk* chunk ) {
         return chunk->asData;
     }
     
-    raff_Data* data = alloc( chunk->file, sizeof(raff_Data) );
+    raff_Data* data = arenaAlloc( arena, sizeof(raff_Data) );
     data->file    = chunk->file;
     data->id      = chunk->id;
     data->size    = chunk->size;
@@ -396,20 +2163,435 @@ raff_chunkAsData( raff_Chunk* chunk ) {
     return data;
 }
 
+raff_Data*
+raff_chunkAsData( raff_Chunk* chunk ) {
+    return parseData( chunk, &chunk->file->arena );
+}
+
+// Moves the slabs of one arena into another, behind its current
+// slab so that one can still be used.
 static void
-addID( char* data, size_t* next, raff_ID id ) {
-    data[(*next)++] = id >> 24;
-    data[(*next)++] = id >> 16;
-    data[(*next)++] = id >> 8;
-    data[(*next)++] = id;
+spliceArena( Arena* into, Arena* from ) {
+#ifdef RAFF_STATS
+    addStats( &into->stats, &from->stats );
+#endif
+    if( !from->slabs ) {
+        initArena( from );
+        return;
+    }
+    
+    if( !into->slabs ) {
+        into->slabs = from->slabs;
+        into->bump  = from->bump;
+        into->left  = from->left;
+        initArena( from );
+        return;
+    }
+    
+    raff_Slab* last = from->slabs;
+    while( last->next )
+        last = last->next;
+    last->next = into->slabs->next;
+    into->slabs->next = from->slabs;
+    initArena( from );
+}
+
+// A list being parsed with everything in it, and its next chunk.
+typedef struct TreeFrame {
+    raff_List*  list;
+    raff_Chunk* next;
+} TreeFrame;
+
+// Parses a list and everything in it.  The lists being parsed are
+// kept on a stack rather than recursed into, so however deep they
+// nest they can't run out of stack.
+static raff_Error
+parseSubtree( raff_Chunk* chunk, Arena* arena ) {
+    raff_List* list = parseList( chunk, arena );
+    if( !list )
+        return errnum;
+    
+    size_t     capacity = 8;
+    size_t     depth    = 1;
+    TreeFrame* frames   = malloc( capacity*sizeof(TreeFrame) );
+    frames[0].list = list;
+    frames[0].next = firstChild( list, arena );
+    
+    raff_Error err = raff_ERR_NONE;
+    while( depth > 0 ) {
+        TreeFrame*  frame = &frames[depth - 1];
+        raff_Chunk* iter  = frame->next;
+        if( !iter ) {
+            depth--;
+            continue;
+        }
+        frame->next = nextChild( frame->list, iter, arena );
+        
+        if( iter->type == TYPE_OTHER ) {
+            parseData( iter, arena );
+            continue;
+        }
+        
+        list = parseList( iter, arena );
+        if( !list ) {
+            err = errnum;
+            break;
+        }
+        if( depth == capacity ) {
+            capacity *= 2;
+            frames    = realloc( frames, capacity*sizeof(TreeFrame) );
+        }
+        frames[depth].list = list;
+        frames[depth].next = firstChild( list, arena );
+        depth++;
+    }
+    
+    free( frames );
+    return err;
+}
+
+// A parallel tree parse hands out subtrees, biggest first, to
+// workers that each parse into an arena of their own; and the
+// arenas are moved into the file's once they're done.
+typedef struct TreeJob {
+#ifdef RAFF_POSIX
+    pthread_mutex_t lock;
+#endif
+    raff_Chunk**    tasks;
+    size_t          count;
+    size_t          next;
+    raff_Error      err;
+} TreeJob;
+
+typedef struct TreeWorker {
+    TreeJob* job;
+    Arena    arena;
+} TreeWorker;
+
+static void*
+treeWork( void* arg ) {
+    TreeWorker* worker = arg;
+    TreeJob*    job    = worker->job;
+    
+    for( ;; ) {
+        raff_Chunk* chunk = NULL;
+#ifdef RAFF_POSIX
+        pthread_mutex_lock( &job->lock );
+#endif
+        if( job->next < job->count && job->err == raff_ERR_NONE )
+            chunk = job->tasks[job->next++];
+#ifdef RAFF_POSIX
+        pthread_mutex_unlock( &job->lock );
+#endif
+        if( !chunk )
+            break;
+        
+        raff_Error err = parseSubtree( chunk, &worker->arena );
+        if( err != raff_ERR_NONE ) {
+#ifdef RAFF_POSIX
+            pthread_mutex_lock( &job->lock );
+#endif
+            if( job->err == raff_ERR_NONE )
+                job->err = err;
+#ifdef RAFF_POSIX
+            pthread_mutex_unlock( &job->lock );
+#endif
+        }
+    }
+    return NULL;
+}
+
+static int
+compareSizes( void const* a, void const* b ) {
+    size_t sa = ( *(raff_Chunk* const*)a )->size;
+    size_t sb = ( *(raff_Chunk* const*)b )->size;
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static raff_Error
+parseTree( raff_Chunk* chunk, unsigned workers ) {
+    raff_File* file  = chunk->file;
+    Arena*     arena = &file->arena;
+    
+    if( chunk->type == TYPE_OTHER ) {
+        parseData( chunk, arena );
+        return errnum;
+    }
+    
+    // Lazily opened files all read from the one source, so
+    // can't be parsed by more than one thread.
+    workers = workerCount( workers, (size_t)-1 );
+    if( workers == 1 || file->source ) {
+        errnum = parseSubtree( chunk, arena );
+        return errnum;
+    }
+    
+    // Split the tree into enough subtrees to keep the workers
+    // busy, by parsing the biggest list found so far and taking
+    // its lists in its place; until there are enough of them,
+    // or none left.
+    size_t       want     = workers*4;
+    size_t       count    = 1;
+    size_t       capacity = 16;
+    raff_Chunk** tasks    = malloc( capacity*sizeof(raff_Chunk*) );
+    tasks[0] = chunk;
+    while( count > 0 && count < want ) {
+        size_t big = 0;
+        for( size_t i = 1 ; i < count ; i++ ) {
+            if( tasks[i]->size > tasks[big]->size )
+                big = i;
+        }
+        raff_Chunk* next = tasks[big];
+        tasks[big] = tasks[--count];
+        
+        raff_List* list = parseList( next, arena );
+        if( !list ) {
+            free( tasks );
+            return errnum;
+        }
+        
+        for( raff_Chunk* iter = firstChild( list, arena ) ; iter ;
+             iter = nextChild( list, iter, arena ) ) {
+            if( iter->type == TYPE_OTHER ) {
+                parseData( iter, arena );
+                continue;
+            }
+            
+            if( count == capacity ) {
+                capacity *= 2;
+                tasks     = realloc( tasks, capacity*sizeof(raff_Chunk*) );
+            }
+            tasks[count++] = iter;
+        }
+    }
+    
+    qsort( tasks, count, sizeof(raff_Chunk*), compareSizes );
+    
+    TreeJob job;
+#ifdef RAFF_POSIX
+    pthread_mutex_init( &job.lock, NULL );
+#endif
+    job.tasks = tasks;
+    job.count = count;
+    job.next  = 0;
+    job.err   = raff_ERR_NONE;
+    
+    workers = workerCount( workers, count );
+    TreeWorker* jobs = malloc( workers*sizeof(TreeWorker) );
+    for( unsigned i = 0 ; i < workers ; i++ ) {
+        jobs[i].job = &job;
+        initArena( &jobs[i].arena );
+    }
+    
+    runWorkers( workers, treeWork, jobs, sizeof(TreeWorker) );
+    
+    for( unsigned i = 0 ; i < workers ; i++ )
+        spliceArena( arena, &jobs[i].arena );
+    
+#ifdef RAFF_POSIX
+    pthread_mutex_destroy( &job.lock );
+#endif
+    free( jobs );
+    free( tasks );
+    
+    errnum = job.err;
+    return errnum;
+}
+
+raff_Error
+raff_parseTree( raff_Chunk* chunk, unsigned workers ) {
+    BEGIN_PHASE( raff_PHASE_PARSE, chunk->file );
+    raff_Error err = parseTree( chunk, workers );
+    END_PHASE( raff_PHASE_PARSE, chunk->file );
+    return err;
+}
+
+// State of a walk, and whether the visitor's stopped it.
+typedef struct Walk {
+    raff_Visitor visit;
+    void*        user;
+    bool         stopped;
+} Walk;
+
+// Like parseNextHead(), but reads the header at *next in a list's
+// bytes straight from them rather than through a stream, since a
+// walk does nothing else with most chunks.
+static bool
+walkNextHead( raff_Chunk* list, size_t* next, ChunkHead* head ) {
+    unsigned char const* b      = (unsigned char const*)list->start + *next;
+    size_t               left   = list->size - *next;
+    size_t               header = 8;
+    if( left < 8 ) {
+        errnum = raff_ERR_CORRUPT;
+        return false;
+    }
+    raff_ID id   = decodeID( b );
+    size_t  size = resolveSize( list->file, id, decodeSize( b + 4 ) );
+    
+    if( id == LIST_ID || id == RIFF_ID ) {
+        if( size < 4 || left < 12 ) {
+            errnum = raff_ERR_CORRUPT;
+            return false;
+        }
+        head->type = id == LIST_ID ? TYPE_LIST : TYPE_RIFF;
+        head->id   = decodeID( b + 8 );
+        size   -= 4;
+        header += 4;
+    }
+    else {
+        head->type = TYPE_OTHER;
+        head->id   = id;
+    }
+    head->size   = size;
+    head->offset = list->offset + *next + header;
+    
+    // If size is odd then there's a padding byte to skip too.
+    if( size > left - header || size % 2 > left - header - size ) {
+        errnum = raff_ERR_CORRUPT;
+        return false;
+    }
+    *next += header + size + size % 2;
+    return true;
 }
 
+// Fills in a stand-in for a chunk found while walking, on the
+// stack; with just enough of it to be walked in turn.
 static void
-addSize( char* data, size_t* next, size_t size ) {
-    data[(*next)++] = size;
-    data[(*next)++] = size >> 8;
-    data[(*next)++] = size >> 16;
-    data[(*next)++] = size >> 24;
+walkHead( raff_Chunk* sub, raff_Chunk* parent, ChunkHead const* head ) {
+    sub->file   = parent->file;
+    sub->type   = head->type;
+    sub->id     = head->id;
+    sub->size   = head->size;
+    sub->offset = head->offset;
+    sub->start  = parent->start ? parent->start + ( head->offset - parent->offset ) : NULL;
+    sub->parts  = NULL;
+}
+
+// A list being walked, and where its next chunk is; an offset into
+// its bytes, an index into its parts, or a position in the source
+// of its lazily opened file.  Lists found while walking that were
+// only read as headers are stand-ins kept in their own frame, with
+// chunk left NULL; since the frames move as the stack grows.
+typedef struct WalkFrame {
+    raff_Chunk*        chunk;
+    raff_Chunk         found;
+    unsigned long long next;
+} WalkFrame;
+
+// Visits a chunk, returning what the visitor wants done; and if
+// that's to stop, then stops.
+static raff_WalkAction
+walkVisit( Walk* walk, raff_Chunk* chunk, unsigned depth ) {
+    raff_Visit visit;
+    visit.depth   = depth;
+    visit.list    = chunk->type != TYPE_OTHER;
+    visit.riff    = chunk->type == TYPE_RIFF;
+    visit.id      = chunk->id;
+    visit.size    = chunk->size;
+    visit.offset  = chunk->offset;
+    visit.content = chunk->start;
+    
+    raff_WalkAction action = walk->visit( &visit, walk->user );
+    if( action == raff_WALK_STOP )
+        walk->stopped = true;
+    return action;
+}
+
+// Finds the next chunk of a list being walked, filling in sub if
+// it's only been read as a header.  Returns NULL at the end of the
+// list, or if something's corrupt; in which case the error value
+// is set to raff_ERR_CORRUPT.
+static raff_Chunk*
+walkNext( WalkFrame* frame, raff_Chunk* sub ) {
+    raff_Chunk* list = frame->chunk ? frame->chunk : &frame->found;
+    ChunkHead   head;
+    errnum = raff_ERR_NONE;
+    if( list->start ) {
+        size_t next = frame->next;
+        if( next >= list->size || !walkNextHead( list, &next, &head ) )
+            return NULL;
+        frame->next = next;
+    }
+    else
+    if( list->parts ) {
+        if( frame->next >= list->partCount )
+            return NULL;
+        return list->parts[frame->next++];
+    }
+    else {
+        unsigned long long end = list->offset + list->size;
+        if( frame->next >= end || !parseLazyHead( list->file, &frame->next, end, &head ) )
+            return NULL;
+    }
+    
+    walkHead( sub, list, &head );
+    return sub;
+}
+
+// Visits a chunk, then if it's a list the chunks in it; from its
+// bytes if it has them, from its parts if it's an encoded list,
+// otherwise from the source of its lazily opened file.  The lists
+// being walked are kept on a stack rather than recursed into, so
+// however deep they're nested they can't run out of stack.
+// Returns false once the walk's been stopped, or something's
+// corrupt.
+static bool
+walkChunk( Walk* walk, raff_Chunk* chunk ) {
+    raff_WalkAction action = walkVisit( walk, chunk, 0 );
+    if( action == raff_WALK_STOP )
+        return false;
+    if( action == raff_WALK_SKIP || chunk->type == TYPE_OTHER )
+        return true;
+    
+    size_t     capacity = 8;
+    size_t     depth    = 1;
+    WalkFrame* frames   = malloc( capacity*sizeof(WalkFrame) );
+    frames[0].chunk = chunk;
+    frames[0].next  = chunk->start || chunk->parts ? 0 : chunk->offset;
+    
+    bool ok = true;
+    while( depth > 0 ) {
+        raff_Chunk  sub;
+        raff_Chunk* child = walkNext( &frames[depth - 1], &sub );
+        if( !child ) {
+            if( errnum != raff_ERR_NONE ) {
+                ok = false;
+                break;
+            }
+            depth--;
+            continue;
+        }
+        
+        action = walkVisit( walk, child, depth );
+        if( action == raff_WALK_STOP ) {
+            ok = false;
+            break;
+        }
+        if( action == raff_WALK_SKIP || child->type == TYPE_OTHER )
+            continue;
+        
+        if( depth == capacity ) {
+            capacity *= 2;
+            frames    = realloc( frames, capacity*sizeof(WalkFrame) );
+        }
+        WalkFrame* frame = &frames[depth++];
+        frame->chunk = child == &sub ? NULL : child;
+        frame->found = sub;
+        frame->next  = child->start || child->parts ? 0 : child->offset;
+    }
+    
+    free( frames );
+    return ok;
+}
+
+raff_Error
+raff_walk( raff_Chunk* chunk, raff_Visitor visit, void* user ) {
+    Walk walk = { visit, user, false };
+    if( walkChunk( &walk, chunk ) || walk.stopped )
+        errnum = raff_ERR_NONE;
+    else
+        errnum = raff_ERR_CORRUPT;
+    return errnum;
 }
 
 raff_Chunk*
@@ -419,16 +2601,20 @@ raff_listAsChunk( raff_List* list, bool riff ) {
         return list->asChunk;
     }
     
-    // Figure out list size.
-    size_t      size = 0;
-    raff_Chunk* iter = list->first;
+    // Instead of encoding the list's chunks into a new buffer
+    // we just keep track of them, and where they'd be in the
+    // encoded content.  The content is only flattened if it's
+    // actually needed in one piece.
+    raff_Chunk** parts    = alloc( list->file, list->count*sizeof(raff_Chunk*) );
+    size_t*      partEnds = alloc( list->file, list->count*sizeof(size_t) );
+    
+    size_t      size  = 0;
+    size_t      count = 0;
+    raff_Chunk* iter  = firstChild( list, &list->file->arena );
     while( iter ) {
         
-        // Size of chunk ID.
-        size += 4;
-        
-        // Size of chunk size.
-        size += 4;
+        // Size of chunk ID and size.
+        size += 8;
         
         // If chunk is LIST or RIFF then size of sub ID.
         if( iter->type != TYPE_OTHER )
@@ -441,7 +2627,11 @@ raff_listAsChunk( raff_List* list, bool riff ) {
         if( iter->size % 2 == 1 )
             size += 1;
         
-        iter = iter->next;
+        parts[count]    = iter;
+        partEnds[count] = size;
+        count++;
+        
+        iter = nextChild( list, iter, &list->file->arena );
     }
     
     // Allocate chunk.
@@ -452,52 +2642,77 @@ raff_listAsChunk( raff_List* list, bool riff ) {
     chunk->type   = riff ? TYPE_RIFF : TYPE_LIST;
     chunk->id     = list->id;
     chunk->size   = size;
-    chunk->start  = alloc( list->file, size );
+    chunk->start  = NULL;
+    chunk->offset = 0;
     chunk->asList = list;
     chunk->asData = NULL;
+    chunk->nextSame = NULL;
+    chunk->parts    = parts;
+    chunk->partEnds = partEnds;
+    chunk->partCount = count;
+    chunk->slot     = 0;
     
-    // Serialize list chunks.
-    size_t i = 0;
-    iter = list->first;
-    while( iter ) {
+    list->asChunk = chunk;
+    
+    errnum = raff_ERR_NONE;
+    return chunk;
+}
+
+// Reads part of the content of an encoded list that hasn't
+// been flattened, by encoding the headers of its parts and
+// reading their content in turn.
+static bool
+ropeRead( raff_Chunk* chunk, size_t offset, char* buf, size_t size ) {
+    
+    // Find the first part that ends after the offset.
+    size_t lo = 0;
+    size_t hi = chunk->partCount;
+    while( lo < hi ) {
+        size_t mid = lo + ( hi - lo ) / 2;
+        if( chunk->partEnds[mid] <= offset )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    size_t i = lo;
+    while( size > 0 ) {
+        if( i >= chunk->partCount )
+            return false;
         
-        if( iter->type != TYPE_OTHER ) {
-            // Add 'LIST' or 'RIFF' ID.
-            if( iter->type == TYPE_RIFF )
-                addID( chunk->start, &i, RIFF_ID );
-            else
-                addID( chunk->start, &i, LIST_ID );
-            
-            // Add chunk size.
-            addSize( chunk->start, &i, iter->size + 4 );
-            
-            // Add sub-ID.
-            addID( chunk->start, &i, iter->id );
+        raff_Chunk* part      = chunk->parts[i];
+        size_t      partStart = i > 0 ? chunk->partEnds[i - 1] : 0;
+        size_t      rel       = offset - partStart;
+        
+        char   head[12];
+        size_t headSize = encodeHeader( part, head );
+        
+        size_t n;
+        if( rel < headSize ) {
+            n = headSize - rel < size ? headSize - rel : size;
+            memcpy( buf, head + rel, n );
+        }
+        else
+        if( rel < headSize + part->size ) {
+            rel -= headSize;
+            n = part->size - rel < size ? part->size - rel : size;
+            if( !chunkRead( part, rel, buf, n ) )
+                return false;
         }
         else {
-            // Add ID.
-            addID( chunk->start, &i, iter->id );
-            
-            // Add chunk size.
-            addSize( chunk->start, &i, iter->size );
+            // Padding byte.
+            n = 1;
+            *buf = 0;
         }
         
-        // Add data.
-        for( size_t j = 0 ; j < iter->size ; j++ )
-            chunk->start[i++] = iter->start[j];
-        
-        // If chunk size is odd then add padding byte.
-        if( iter->size % 2 == 1 )
-            chunk->start[i++] = 0;
-        
-        iter = iter->next;
+        buf    += n;
+        offset += n;
+        size   -= n;
+        if( offset == chunk->partEnds[i] )
+            i++;
     }
     
-    
-    list->asChunk = chunk;
-    
-    errnum = raff_ERR_NONE;
-    return chunk;
+    return true;
 }
 
 raff_Chunk*
@@ -515,7 +2730,14 @@ raff_dataAsChunk( raff_Data* data ) {
     chunk->id     = data->id;
     chunk->size   = data->size;
     chunk->start  = data->start;
+    chunk->offset = 0;
+    chunk->asList = NULL;
     chunk->asData = data;
+    chunk->nextSame = NULL;
+    chunk->parts    = NULL;
+    chunk->partEnds = NULL;
+    chunk->partCount = 0;
+    chunk->slot     = 0;
     
     data->asChunk = chunk;
     
@@ -523,21 +2745,118 @@ raff_dataAsChunk( raff_Data* data ) {
     return chunk;
 }
 
-void
-raff_start( raff_List* list ) {
-    list->cursor = list->first;
+// Lists with fewer chunks than this are just searched.
+#define INDEX_MIN 8
+
+static IndexSlot*
+indexSlot( raff_List* list, raff_ID id ) {
+    size_t mask = ( (size_t)1 << list->indexBits ) - 1;
+    size_t i    = (size_t)( (unsigned long long)id * 0x9E3779B97F4A7C15ull
+                            >> ( 64 - list->indexBits ) );
+    while( list->index[i].first && list->index[i].id != id )
+        i = ( i + 1 ) & mask;
+    return &list->index[i];
+}
+
+// Adds a chunk that's just been added to the list to its index,
+// if it has one.  If this would fill the index too much then
+// it's dropped instead, to be rebuilt larger when next needed.
+static void
+indexAdd( raff_List* list, raff_Chunk* chunk, bool front ) {
+    if( !list->index )
+        return;
+    
+    IndexSlot* slot = indexSlot( list, chunk->id );
+    if( !slot->first ) {
+        if( ( list->indexUsed + 1 ) * 2 > (size_t)1 << list->indexBits ) {
+            list->index = NULL;
+            return;
+        }
+        
+        slot->id    = chunk->id;
+        slot->first = chunk;
+        slot->last  = chunk;
+        chunk->nextSame = NULL;
+        list->indexUsed++;
+    }
+    else
+    if( front ) {
+        chunk->nextSame = slot->first;
+        slot->first = chunk;
+    }
+    else {
+        slot->last->nextSame = chunk;
+        slot->last = chunk;
+        chunk->nextSame = NULL;
+    }
+}
+
+static void
+buildIndex( raff_List* list ) {
+    unsigned bits = 4;
+    while( (size_t)1 << bits < list->count * 2 )
+        bits++;
+    
+    size_t slots = (size_t)1 << bits;
+    list->index     = alloc( list->file, slots*sizeof(IndexSlot) );
+    list->indexBits = bits;
+    list->indexUsed = 0;
+    for( size_t i = 0 ; i < slots ; i++ )
+        list->index[i].first = NULL;
+    
+    raff_Chunk* iter = list->first;
+    while( iter ) {
+        indexAdd( list, iter, false );
+        iter = iter->next;
+    }
+}
+
+void
+raff_start( raff_List* list ) {
+    if( list->table )
+        list->table->cursor = 0;
+    list->cursor = list->first;
 }
 
 raff_Chunk*
 raff_next( raff_List* list ) {
+    ChildTable* table = list->table;
+    if( table ) {
+        if( table->cursor >= list->count )
+            return NULL;
+        return childAt( list, table->cursor++, &list->file->arena );
+    }
+    
     raff_Chunk* next = list->cursor;
     if( list->cursor )
         list->cursor = list->cursor->next;
     return next;
 }
 
+bool
+raff_nextInfo( raff_List* list, raff_ID* id, size_t* size ) {
+    ChildTable* table = list->table;
+    if( table ) {
+        if( table->cursor >= list->count )
+            return false;
+        *id   = table->ids[table->cursor];
+        *size = table->sizes[table->cursor];
+        table->cursor++;
+        return true;
+    }
+    
+    raff_Chunk* next = raff_next( list );
+    if( !next )
+        return false;
+    *id   = next->id;
+    *size = next->size;
+    return true;
+}
+
 void
 raff_prepend( raff_List* list, raff_Chunk* chunk ) {
+    linkList( list );
+    
     // Since we're updating the list it'll no longer
     // reflect its ->asChunk field, so we clear it
     // and ->asChunk->asList first if this is set to
@@ -558,10 +2877,15 @@ raff_prepend( raff_List* list, raff_Chunk* chunk ) {
     list->first = chunk;
     if( !list->last )
         list->last = list->first;
+    
+    list->count++;
+    indexAdd( list, chunk, true );
 }
 
 void
 raff_append( raff_List* list, raff_Chunk* chunk ) {
+    linkList( list );
+    
     // Since we're updating the list it'll no longer
     // reflect its ->asChunk field, so we clear it
     // and ->asChunk->asList first if this is set to
@@ -583,14 +2907,24 @@ raff_append( raff_List* list, raff_Chunk* chunk ) {
     list->last = chunk;
     if( !list->first )
         list->first = list->last;
+    
+    list->count++;
+    indexAdd( list, chunk, false );
 }
 
 raff_File*
 raff_newFile( void ) {
     raff_File* file = malloc( sizeof(raff_File) );
-    file->allocs = NULL;
-    file->chunk  = NULL;
-    file->size   = 0;
+    initArena( &file->arena );
+    file->chunk   = NULL;
+    file->size    = 0;
+    file->data    = NULL;
+    file->map     = NULL;
+    file->mapSize = 0;
+    file->source  = NULL;
+    file->path    = NULL;
+    file->ds64    = NULL;
+    initPayloads( file, NULL );
     
     return file;
 }
@@ -609,6 +2943,32 @@ raff_newData( raff_File* file, raff_ID id, char const* content, size_t size ) {
     return data;
 }
 
+raff_Data*
+raff_borrowData( raff_File* file, raff_ID id, char const* content, size_t size ) {
+    raff_Data* data = alloc( file, sizeof(raff_Data) );
+    data->file    = file;
+    data->id      = id;
+    data->size    = size;
+    data->start   = (char*)content;
+    data->asChunk = NULL;
+    
+    return data;
+}
+
+raff_Data*
+raff_adoptData( raff_File* file, raff_ID id, char* content, size_t size,
+                raff_Release release, void* user ) {
+    // The file holds the only reference, which is added when
+    // it's held.
+    Payload* payload = newPayload( content, size, false );
+    payload->refs    = 0;
+    payload->release = release;
+    payload->user    = user;
+    holdPayload( file, payload );
+    
+    return raff_borrowData( file, id, content, size );
+}
+
 raff_List*
 raff_newList( raff_File* file, raff_ID id ) {
     raff_List* list = alloc( file, sizeof(raff_List) );
@@ -617,6 +2977,9 @@ raff_newList( raff_File* file, raff_ID id ) {
     list->cursor  = NULL;
     list->first   = NULL;
     list->last    = NULL;
+    list->count   = 0;
+    list->table   = NULL;
+    list->index   = NULL;
     list->asChunk = false;
     
     return list;
@@ -624,23 +2987,26 @@ raff_newList( raff_File* file, raff_ID id ) {
 
 raff_ID
 raff_newID( char const* idstr ) {
-    raff_ID id = 0;
+    // Bytes are taken as unsigned, so IDs with high bits set come
+    // out the same as when packed in a child table.
+    unsigned char const* b  = (unsigned char const*)idstr;
+    raff_ID              id = 0;
     
-    if( !idstr[0] )
+    if( !b[0] )
         return id;
-    id |= (long)idstr[0] << 24;
+    id |= (raff_ID)b[0] << 24;
     
-    if( !idstr[1] )
+    if( !b[1] )
         return id;
-    id |= (long)idstr[1] << 16;
+    id |= (raff_ID)b[1] << 16;
     
-    if( !idstr[2] )
+    if( !b[2] )
         return id;
-    id |= (long)idstr[2] << 8;
+    id |= (raff_ID)b[2] << 8;
     
-    if( !idstr[3] )
+    if( !b[3] )
         return id;
-    id |= idstr[3];
+    id |= b[3];
     
     return id;
 }
@@ -652,6 +3018,15 @@ raff_getID( raff_Chunk* chunk ) {
 
 raff_Chunk*
 raff_findID( raff_List* list, raff_ID id ) {
+    if( list->table ) {
+        size_t i = findPackedID( list->table->ids, 0, list->count, id );
+        return i < list->count ? childAt( list, i, &list->file->arena ) : NULL;
+    }
+    
+    if( !list->index && list->count >= INDEX_MIN )
+        buildIndex( list );
+    if( list->index )
+        return indexSlot( list, id )->first;
     
     raff_Chunk* iter = list->first;
     while( iter ) {
@@ -664,28 +3039,343 @@ raff_findID( raff_List* list, raff_ID id ) {
     return NULL;
 }
 
-
 raff_Chunk*
-raff_copyChunk( raff_Chunk* chunk ) {
+raff_findNextID( raff_List* list, raff_Chunk* chunk ) {
+    if( list->table ) {
+        size_t i = findPackedID( list->table->ids, chunk->slot + 1, list->count, chunk->id );
+        return i < list->count ? childAt( list, i, &list->file->arena ) : NULL;
+    }
     
-    raff_Chunk* copy = alloc( chunk->file, sizeof(raff_Chunk) );
-    copy->next   = NULL;
-    copy->file   = chunk->file;
-    copy->list   = NULL;
-    copy->type   = chunk->type;
-    copy->id     = chunk->id;
-    copy->size   = chunk->size;
-    copy->start  = chunk->start;
-    copy->asList = NULL;
-    copy->asData = NULL;
+    if( list->index )
+        return chunk->nextSame;
     
-    return copy;
+    raff_Chunk* iter = chunk->next;
+    while( iter ) {
+        if( iter->id == chunk->id )
+            return iter;
+        
+        iter = iter->next;
+    }
+    
+    return NULL;
+}
+
+typedef enum StepType {
+    STEP_ANY,
+    STEP_LIST,
+    STEP_RIFF,
+    STEP_DATA,
+    STEP_DESCEND
+} StepType;
+
+// A step of a compiled query, which matches chunks whose ID
+// equals id in all bits set in mask.
+typedef struct QueryStep {
+    StepType type;
+    raff_ID  id;
+    raff_ID  mask;
+} QueryStep;
+
+typedef struct raff_Query {
+    size_t    count;
+    QueryStep steps[];
+} raff_Query;
+
+static bool
+compileStep( QueryStep* step, char const* str, size_t len ) {
+    step->type = STEP_ANY;
+    step->id   = 0;
+    step->mask = 0;
+    
+    if( len == 2 && str[0] == '*' && str[1] == '*' ) {
+        step->type = STEP_DESCEND;
+        return true;
+    }
+    
+    char const* colon = memchr( str, ':', len );
+    if( colon && colon - str == 4 ) {
+        if( !strncmp( str, "LIST", 4 ) )
+            step->type = STEP_LIST;
+        else
+        if( !strncmp( str, "RIFF", 4 ) )
+            step->type = STEP_RIFF;
+        else
+        if( !strncmp( str, "DATA", 4 ) )
+            step->type = STEP_DATA;
+        else
+            return false;
+        
+        len -= colon + 1 - str;
+        str  = colon + 1;
+    }
+    
+    if( len == 1 && str[0] == '*' )
+        return true;
+    if( len == 0 || len > 4 )
+        return false;
+    
+    // Build the ID the same way as raff_newID() would, but
+    // leave out the bytes for any '?' characters.
+    char idstr[5] = { 0 };
+    step->mask = ~(raff_ID)0;
+    for( size_t i = 0 ; i < len ; i++ ) {
+        if( str[i] == '?' ) {
+            idstr[i] = ' ';
+            step->mask &= ~( (raff_ID)0xFF << 8*( 3 - i ) );
+        }
+        else {
+            idstr[i] = str[i];
+        }
+    }
+    step->id = raff_newID( idstr ) & step->mask;
+    return true;
+}
+
+raff_Query*
+raff_compileQuery( char const* path ) {
+    if( *path == '/' )
+        path++;
+    
+    size_t count = 1;
+    for( char const* c = path ; *c ; c++ ) {
+        if( *c == '/' )
+            count++;
+    }
+    
+    raff_Query* query = malloc( sizeof(raff_Query) + count*sizeof(QueryStep) );
+    query->count = count;
+    
+    char const* str = path;
+    for( size_t i = 0 ; i < count ; i++ ) {
+        char const* end = strchr( str, '/' );
+        if( !end )
+            end = str + strlen( str );
+        
+        if( !compileStep( &query->steps[i], str, end - str ) ) {
+            free( query );
+            errnum = raff_ERR_BAD_QUERY;
+            return NULL;
+        }
+        str = end + 1;
+    }
+    
+    // A query can't end in a '**' since that'd just match
+    // every chunk.
+    if( query->steps[count - 1].type == STEP_DESCEND ) {
+        free( query );
+        errnum = raff_ERR_BAD_QUERY;
+        return NULL;
+    }
+    
+    errnum = raff_ERR_NONE;
+    return query;
+}
+
+void
+raff_freeQuery( raff_Query* query ) {
+    free( query );
+}
+
+// A list whose chunks are being matched against a step of a query,
+// and the last of them that was; or NULL if it hasn't been started,
+// and so hasn't been parsed yet either.  Table is set if only the
+// entries of its child table that could match are looked at, in
+// which case next is the index of the next one.
+typedef struct QueryFrame {
+    raff_Chunk* chunk;
+    raff_List*  list;
+    size_t      step;
+    raff_Chunk* iter;
+    bool        table;
+    size_t      next;
+} QueryFrame;
+
+// The lists being matched are kept on a stack rather than recursed
+// into, so a '**' can't run out of stack however deep they nest.
+typedef struct QueryRun {
+    raff_Query*  query;
+    raff_QueryCb callback;
+    void*        user;
+    size_t       found;
+    bool         failed;
+    QueryFrame*  frames;
+    size_t       depth;
+    size_t       capacity;
+} QueryRun;
+
+static bool
+stepMatches( QueryStep const* step, raff_Chunk* chunk ) {
+    switch( step->type ) {
+        case STEP_LIST:
+            if( chunk->type != TYPE_LIST )
+                return false;
+            break;
+        case STEP_RIFF:
+            if( chunk->type != TYPE_RIFF )
+                return false;
+            break;
+        case STEP_DATA:
+            if( chunk->type != TYPE_OTHER )
+                return false;
+            break;
+        default:
+            break;
+    }
+    return ( chunk->id & step->mask ) == step->id;
+}
+
+// Pushes a list chunk to have step i of a query run on each of its
+// chunks.
+static void
+pushChildren( QueryRun* run, size_t i, raff_Chunk* chunk ) {
+    if( chunk->type == TYPE_OTHER )
+        return;
+    
+    if( run->depth == run->capacity ) {
+        run->capacity = run->capacity ? run->capacity*2 : 8;
+        run->frames   = realloc( run->frames, run->capacity*sizeof(QueryFrame) );
+    }
+    QueryFrame* frame = &run->frames[run->depth++];
+    frame->chunk = chunk;
+    frame->list  = NULL;
+    frame->step  = i;
+    frame->iter  = NULL;
+    frame->table = false;
+    frame->next  = 0;
+}
+
+// Gives the next chunk of a list being matched, parsing the list
+// first if it hasn't been yet; or NULL at the end of the list, or
+// if it fails to parse.
+static raff_Chunk*
+nextChildren( QueryRun* run, QueryFrame* frame ) {
+    QueryStep const* step  = &run->query->steps[frame->step];
+    bool             exact = step->type != STEP_DESCEND && step->mask == ~(raff_ID)0;
+    raff_List*       list  = frame->list;
+    if( !list ) {
+        list = frame->list = raff_chunkAsList( frame->chunk );
+        if( !list ) {
+            run->failed = true;
+            return NULL;
+        }
+        
+        // If the step is for an exact ID then the list's index
+        // can take us straight to the matches.  Otherwise entries
+        // of a child table that can't match aren't given handles.
+        if( exact )
+            return frame->iter = raff_findID( list, step->id );
+        frame->table = list->table && step->type != STEP_DESCEND;
+        if( !frame->table )
+            return frame->iter = firstChild( list, &list->file->arena );
+    }
+    
+    if( exact )
+        return frame->iter ? frame->iter = raff_findNextID( list, frame->iter ) : NULL;
+    if( !frame->table )
+        return frame->iter ? frame->iter = nextChild( list, frame->iter, &list->file->arena ) : NULL;
+    
+    ChildTable* table = list->table;
+    for( ; frame->next < list->count ; frame->next++ ) {
+        if( ( table->ids[frame->next] & step->mask ) == step->id )
+            return childAt( list, frame->next++, &list->file->arena );
+    }
+    return NULL;
+}
+
+// Matches chunk against step i of a query, and pushes it to have
+// the rest of the query run on its children if it matches.  A
+// '**' matches any number of lists, including none; so its next
+// step is run on the chunk first, then it's run on the children.
+// Returns false if the query should stop.
+static bool
+runStep( QueryRun* run, size_t i, raff_Chunk* chunk ) {
+    for( ; run->query->steps[i].type == STEP_DESCEND ; i++ )
+        pushChildren( run, i, chunk );
+    
+    if( !stepMatches( &run->query->steps[i], chunk ) )
+        return true;
+    
+    if( i + 1 == run->query->count ) {
+        run->found++;
+        return run->callback( chunk, run->user );
+    }
+    
+    pushChildren( run, i + 1, chunk );
+    return true;
+}
+
+// Runs a query from a chunk, until there's nothing left to match
+// or the query stops.
+static void
+runQuery( QueryRun* run, raff_Chunk* chunk ) {
+    if( !runStep( run, 0, chunk ) )
+        return;
+    
+    while( run->depth > 0 ) {
+        QueryFrame* frame = &run->frames[run->depth - 1];
+        raff_Chunk* child = nextChildren( run, frame );
+        if( !child ) {
+            if( run->failed )
+                return;
+            run->depth--;
+            continue;
+        }
+        if( !runStep( run, frame->step, child ) )
+            return;
+    }
+}
+
+size_t
+raff_queryAll( raff_Query* query, raff_Chunk* chunk,
+               raff_QueryCb callback, void* user ) {
+    QueryRun run;
+    run.query    = query;
+    run.callback = callback;
+    run.user     = user;
+    run.found    = 0;
+    run.failed   = false;
+    run.frames   = NULL;
+    run.depth    = 0;
+    run.capacity = 0;
+    
+    runQuery( &run, chunk );
+    free( run.frames );
+    
+    // Leave the error from a list that failed to parse.
+    if( !run.failed )
+        errnum = raff_ERR_NONE;
+    return run.found;
+}
+
+static bool
+firstCb( raff_Chunk* chunk, void* user ) {
+    *(raff_Chunk**)user = chunk;
+    return false;
+}
+
+raff_Chunk*
+raff_queryFirst( raff_Query* query, raff_Chunk* chunk ) {
+    raff_Chunk* first = NULL;
+    raff_queryAll( query, chunk, firstCb, &first );
+    return first;
+}
+
+raff_Chunk*
+raff_copyChunk( raff_Chunk* chunk ) {
+    return copyChunkIn( chunk, &chunk->file->arena );
 }
 
 
 raff_Chunk*
 raff_copyChunkTo( raff_File* file, raff_Chunk* chunk ) {
     
+    // Content that's in a payload is shared, rather than copied;
+    // unless it's mapped, since a mapping follows the file, so
+    // would change under the copy if the file were edited.
+    Payload* payload = findPayload( chunk->file, chunk->start, chunk->size );
+    if( payload && payload->mapped )
+        payload = NULL;
+    
     raff_Chunk* copy = alloc( file, sizeof(raff_Chunk) );
     copy->next   = NULL;
     copy->file   = file;
@@ -693,113 +3383,3116 @@ raff_copyChunkTo( raff_File* file, raff_Chunk* chunk ) {
     copy->type   = chunk->type;
     copy->id     = chunk->id;
     copy->size   = chunk->size;
-    copy->start  = alloc( file, copy->size );
+    copy->start  = payload ? chunk->start : alloc( file, copy->size );
+    copy->offset = 0;
     copy->asList = NULL;
     copy->asData = NULL;
+    copy->nextSame = NULL;
+    copy->parts    = NULL;
+    copy->partEnds = NULL;
+    copy->partCount = 0;
+    copy->slot     = 0;
     
-    for( size_t i = 0 ; i < copy->size ; i++ )
-        copy->start[i] = chunk->start[i];
+    if( payload ) {
+        holdPayload( file, payload );
+        return copy;
+    }
+    if( !chunkRead( chunk, 0, copy->start, copy->size ) ) {
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
     
     return copy;
 }
 
-typedef struct SerializationStream {
-    raff_Stream stream;
-    raff_Chunk* chunk;
-    size_t      next;
-} SerializationStream;
-
+// Moves to the given offset of an open file, returning 0 on
+// success.
 static int
-snextCb( raff_Stream* stream ) {
-    SerializationStream* ss = (SerializationStream*)stream;
-    
-    size_t i = ss->next++;
-    
-    // Main ID.
-    if( i < 4 ) {
-        raff_ID id;
-        if( ss->chunk->type == TYPE_OTHER )
-            id = ss->chunk->id;
-        else
-        if( ss->chunk->type == TYPE_LIST )
-            id = LIST_ID;
-        else
-            id = RIFF_ID;
-        
-        return (unsigned char)( id  >> 8*( 3 - i ) );
-    } 
-    
-    // Size.  If chunk is LIST or RIFF then add 4 for sub-ID.
-    if( i < 8 ) {
-        size_t size = ss->chunk->size;
-        if( ss->chunk->type != TYPE_OTHER )
-            size += 4;
-        
-        return (unsigned char)( size >> 8*(i - 4) );
-    }
-    
-    // If chunk is a LIST of RIFF then the next 4 bytes
-    // are for the sub-ID.
-    if( ss->chunk->type != TYPE_OTHER ) {
-        if( i < 12 ) {
-            raff_ID id = ss->chunk->id;
-            return (unsigned char)( id >> 8*( 11 - i ) );
-        }
-        i -= 12;
-    }
-    else {
-        i -= 8;
-    }
-    
-    if( i >= ss->chunk->size )
-        return -1;
-    
-    return (unsigned char)ss->chunk->start[i];
+seekTo( FILE* out, unsigned long long offset ) {
+#if defined(_WIN32)
+    return _fseeki64( out, offset, SEEK_SET );
+#else
+    return fseeko( out, offset, SEEK_SET );
+#endif
+}
+
+// Writes bytes at the given offset of an open file.
+static raff_Error
+writeAt( FILE* out, unsigned long long offset, char const* buf, size_t size ) {
+    if( seekTo( out, offset ) != 0 )
+        return raff_ERR_CANT_WRITE;
+    if( fwrite( buf, 1, size, out ) < size )
+        return raff_ERR_CANT_WRITE;
+    return raff_ERR_NONE;
 }
 
+// Lazily opened files read through a FILE* of their own, which
+// may have buffered content that's just been overwritten; so
+// that has to be dropped after editing.
 static void
-scloseCb( raff_Stream* stream ) {
-    free( stream );
+dropBuffered( raff_File* file ) {
+    raff_StreamEx* source = file->source;
+#ifdef RAFF_STATS
+    if( source )
+        source = ( (CountingStream*)source )->inner;
+#endif
+    if( source && source->seek == fseekCb )
+        fflush( ( (FileStream*)source )->file );
 }
 
-raff_Stream*
-raff_serializeChunk( raff_Chunk* chunk ) {
+// Gives a chunk whose content is in a payload other files share
+// its own copy, so changing it doesn't change theirs.  The lists
+// it's in have the chunk's content in theirs, so the outermost
+// of them in the payload is copied, and the rest of them moved
+// to within that; the chunks around it can keep pointing at the
+// old content, which is the same.
+static void
+unsharePayload( raff_Chunk* chunk, Payload* payload ) {
+    raff_Chunk* outer = chunk;
+    while( outer->list && outer->list->asChunk ) {
+        raff_Chunk* up = outer->list->asChunk;
+        if( findPayload( chunk->file, up->start, up->size ) != payload )
+            break;
+        outer = up;
+    }
     
-    SerializationStream* ss = malloc( sizeof(SerializationStream) );
-    ss->stream.next  = snextCb;
-    ss->stream.close = scloseCb;
-    ss->chunk = chunk;
-    ss->next  = 0;
+    char* from = outer->start;
+    char* to   = alloc( chunk->file, outer->size );
+    memcpy( to, from, outer->size );
     
-    return (raff_Stream*)ss;
+    for( raff_Chunk* iter = chunk ; ; iter = iter->list->asChunk ) {
+        iter->start = to + ( iter->start - from );
+        if( iter->asData )
+            iter->asData->start = iter->start;
+        if( iter->asList && iter->asList->table )
+            iter->asList->table->base = iter->start;
+        if( iter == outer )
+            break;
+    }
 }
 
 raff_Error
-raff_serializeChunkToFile( raff_Chunk* chunk, char const* path ) {
-    FILE* file = fopen( path, "w" );
-    if( !file ) {
+raff_overwriteInPlace( raff_Chunk* chunk, char const* content, size_t size ) {
+    raff_File* file = chunk->file;
+    if( chunk->type != TYPE_OTHER || size != chunk->size ||
+        !file->path || chunk->offset == 0 ) {
+        errnum = raff_ERR_CANT_EDIT;
+        return errnum;
+    }
+    
+    FILE* out = fopen( file->path, "r+b" );
+    if( !out ) {
         errnum = raff_ERR_CANT_OPEN;
         return errnum;
     }
     
-    raff_Stream* stream = raff_serializeChunk( chunk );
-    int next;
-    while( ( next = snext( stream ) ) >= 0 )
-        fputc( next, file );
+    errnum = writeAt( out, chunk->offset, content, size );
+    if( fclose( out ) != 0 && errnum == raff_ERR_NONE )
+        errnum = raff_ERR_CANT_WRITE;
+    if( errnum != raff_ERR_NONE )
+        return errnum;
     
-    stream->close( stream );
-    fclose( file );
+    dropBuffered( file );
+    
+    // Keep the loaded content up to date as well.  A mapping
+    // sees the change by itself, and isn't writable anyway; it's
+    // never shared, so no copies see it.
+    Payload* payload = findPayload( file, chunk->start, size );
+    if( payload && payload->mapped )
+        return errnum;
+    if( payload && ATOMIC_GET( payload->refs ) > 1 )
+        unsharePayload( chunk, payload );
+    if( chunk->start )
+        memcpy( chunk->start, content, size );
     
-    errnum = raff_ERR_NONE;
     return errnum;
 }
 
-size_t
-raff_dataSize( raff_Data* data ) {
-    return data->size;
-}
-
-char const*
-raff_dataContent( raff_Data* data ) {
-    return data->start;
+raff_Error
+raff_appendInPlace( raff_List* list, raff_Chunk* chunk ) {
+    raff_File*  file = list->file;
+    raff_Chunk* root = file->chunk;
+    
+    // Chunk should be of same file as list.
+    assert( chunk->file == list->file );
+    
+    // Chunk should not have a list.
+    assert( chunk->list == NULL );
+    
+    // The list has to still match what's in the file, and has
+    // to be at the end of the file, so there's room to grow.
+    raff_Chunk* listCk = list->asChunk;
+    if( !file->path || !root || !listCk || listCk->asList != list ||
+        listCk->offset == 0 ||
+        listCk->offset + listCk->size != root->offset + root->size ) {
+        errnum = raff_ERR_CANT_EDIT;
+        return errnum;
+    }
+    
+    // And there has to be a path from it up to the root.
+    for( raff_Chunk* iter = listCk ; iter != root ; ) {
+        raff_List* parent = iter->list;
+        if( !parent || !parent->asChunk || parent->asChunk->asList != parent ) {
+            errnum = raff_ERR_CANT_EDIT;
+            return errnum;
+        }
+        iter = parent->asChunk;
+    }
+    
+    char   head[12];
+    size_t headSize = encodeHeader( chunk, head );
+    
+    // None of the sizes can grow too big for their size field,
+    // unless it's the root of an RF64 file, whose size is kept
+    // in its ds64 chunk.
+    size_t grow = listCk->size % 2 + headSize + chunk->size + chunk->size % 2;
+    if( chunk->size > RAFF_SIZE_LIMIT ) {
+        errnum = raff_ERR_CANT_EDIT;
+        return errnum;
+    }
+    for( raff_Chunk* iter = listCk ; iter != root || !file->ds64 ; ) {
+        if( iter->size + grow + 4 > RAFF_SIZE_LIMIT ) {
+            errnum = raff_ERR_CANT_EDIT;
+            return errnum;
+        }
+        if( iter == root )
+            break;
+        iter = iter->list->asChunk;
+    }
+    
+    FILE* out = fopen( file->path, "r+b" );
+    if( !out ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return errnum;
+    }
+    
+    // Write the chunk at the end of the list, after padding
+    // if the list doesn't end on an even offset.
+    unsigned long long pos = listCk->offset + listCk->size;
+    size_t             pad = listCk->size % 2;
+    
+    errnum = writeAt( out, pos, "", pad );
+    if( errnum == raff_ERR_NONE )
+        errnum = writeAt( out, pos + pad, head, headSize );
+    
+    size_t block = 1 << 20;
+    char*  buf   = malloc( block );
+    for( size_t i = 0 ; i < chunk->size && errnum == raff_ERR_NONE ; i += block ) {
+        size_t n = chunk->size - i < block ? chunk->size - i : block;
+        if( !chunkRead( chunk, i, buf, n ) )
+            errnum = raff_ERR_CORRUPT;
+        else
+        if( fwrite( buf, 1, n, out ) < n )
+            errnum = raff_ERR_CANT_WRITE;
+    }
+    free( buf );
+    
+    if( errnum == raff_ERR_NONE && chunk->size % 2 == 1 &&
+        fwrite( "", 1, 1, out ) < 1 )
+        errnum = raff_ERR_CANT_WRITE;
+    
+    size_t added = pad + headSize + chunk->size + chunk->size % 2;
+    
+    // Then patch the sizes of the list and everything it's in,
+    // the size of an RF64 root is the one in its ds64 chunk.
+    for( raff_Chunk* iter = listCk ; errnum == raff_ERR_NONE ; ) {
+        char   sizeBuf[8];
+        size_t n = 0;
+        if( iter == root && file->ds64 ) {
+            addSize64( sizeBuf, &n, iter->size + added + 4 );
+            errnum = writeAt( out, 20, sizeBuf, 8 );
+            if( errnum == raff_ERR_NONE )
+                file->ds64->riffSize = iter->size + added + 4;
+        }
+        else {
+            addSize( sizeBuf, &n, iter->size + added + 4 );
+            errnum = writeAt( out, iter->offset - 8, sizeBuf, 4 );
+        }
+        
+        if( iter == root )
+            break;
+        iter = iter->list->asChunk;
+    }
+    
+    if( fclose( out ) != 0 && errnum == raff_ERR_NONE )
+        errnum = raff_ERR_CANT_WRITE;
+    if( errnum != raff_ERR_NONE )
+        return errnum;
+    
+    dropBuffered( file );
+    
+    // Now update the in memory tree to match.  The chunk is
+    // added to the list without going through raff_append(),
+    // since the list still matches its chunk.  The lists that
+    // grow are changed, so can't keep their child tables.
+    for( raff_Chunk* iter = listCk ; ; iter = iter->list->asChunk ) {
+        linkList( iter->asList );
+        if( iter == root )
+            break;
+    }
+    
+    chunk->list   = list;
+    chunk->offset = pos + pad + headSize;
+    chunk->next   = NULL;
+    if( list->last )
+        list->last->next = chunk;
+    list->last = chunk;
+    if( !list->first )
+        list->first = chunk;
+    list->count++;
+    indexAdd( list, chunk, false );
+    
+    // The lists that grew no longer fit in their old content,
+    // so they're switched over to referring to their chunks
+    // like an encoded list would.
+    for( raff_Chunk* iter = listCk ; ; iter = iter->list->asChunk ) {
+        raff_List* ls = iter->asList;
+        iter->size     += added;
+        iter->start     = NULL;
+        iter->parts     = alloc( file, ls->count*sizeof(raff_Chunk*) );
+        iter->partEnds  = alloc( file, ls->count*sizeof(size_t) );
+        iter->partCount = ls->count;
+        
+        size_t      end  = 0;
+        size_t      i    = 0;
+        raff_Chunk* part = ls->first;
+        while( part ) {
+            end += ( part->type == TYPE_OTHER ? 8 : 12 ) + part->size + part->size % 2;
+            iter->parts[i]    = part;
+            iter->partEnds[i] = end;
+            i++;
+            part = part->next;
+        }
+        
+        if( iter == root )
+            break;
+    }
+    file->size = root->size;
+    
+    return errnum;
+}
+
+// Encodes the header of a chunk as it'd appear in a RIFF
+// file into head, returning the header's length; which is
+// 12 bytes for LIST and RIFF chunks, and 8 for others.
+// Sizes too big for the size field are encoded as SIZE_MARKER,
+// the real size then has to go in the file's ds64 chunk.
+static size_t
+encodeHeader( raff_Chunk* chunk, char* head ) {
+    size_t n = 0;
+    if( chunk->type != TYPE_OTHER ) {
+        size_t size = chunk->size + 4;
+        addID( head, &n, chunk->type == TYPE_RIFF ? RIFF_ID : LIST_ID );
+        addSize( head, &n, size > RAFF_SIZE_LIMIT ? SIZE_MARKER : size );
+        addID( head, &n, chunk->id );
+    }
+    else {
+        size_t size = chunk->size;
+        addID( head, &n, chunk->id );
+        addSize( head, &n, size > RAFF_SIZE_LIMIT ? SIZE_MARKER : size );
+    }
+    return n;
+}
+
+// Collects what goes in the ds64 chunk of an RF64 file; the
+// size of the first 'data' chunk, and a table of any other
+// chunks too big for their size field.
+typedef struct Ds64Builder {
+    unsigned long long dataSize;
+    bool               haveData;
+    size_t             count;
+    size_t             capacity;
+    Ds64Entry*         table;
+} Ds64Builder;
+
+static void
+collectDs64( Ds64Builder* b, raff_Chunk* list ) {
+    raff_List* ls = raff_chunkAsList( list );
+    if( !ls )
+        return;
+    
+    Arena* arena = &list->file->arena;
+    for( raff_Chunk* iter = firstChild( ls, arena ) ; iter ;
+         iter = nextChild( ls, iter, arena ) ) {
+        size_t size = iter->type == TYPE_OTHER ? iter->size : iter->size + 4;
+        if( iter->type == TYPE_OTHER && iter->id == DATA_ID && !b->haveData ) {
+            b->dataSize = iter->size;
+            b->haveData = true;
+        }
+        else
+        if( size > RAFF_SIZE_LIMIT ) {
+            if( b->count == b->capacity ) {
+                b->capacity = b->capacity ? b->capacity*2 : 8;
+                b->table    = realloc( b->table, b->capacity*sizeof(Ds64Entry) );
+            }
+            
+            raff_ID id = iter->id;
+            if( iter->type == TYPE_LIST )
+                id = LIST_ID;
+            else
+            if( iter->type == TYPE_RIFF )
+                id = RIFF_ID;
+            
+            b->table[b->count].id   = id;
+            b->table[b->count].size = size;
+            b->count++;
+        }
+        
+        // Only lists that are too big themselves can have
+        // chunks in them that are too big.
+        if( iter->type != TYPE_OTHER && size > RAFF_SIZE_LIMIT )
+            collectDs64( b, iter );
+    }
+}
+
+// Encodes what a chunk starts with when serialized on its own.
+// For most this is just the header, but a RIFF chunk leaves out
+// any ds64 chunk it starts with; and if it's too big to be a
+// RIFF it's written as RF64 instead, with a new ds64 chunk after
+// the header.  Returns what to write in a malloc()ed buffer and
+// its size in *headSize, and the number of bytes to skip at the
+// start of the chunk's content in *skip.
+static char*
+encodeLeader( raff_Chunk* chunk, size_t* headSize, size_t* skip ) {
+    *skip = 0;
+    
+    if( chunk->type != TYPE_RIFF ) {
+        char* head = malloc( 12 );
+        *headSize  = encodeHeader( chunk, head );
+        return head;
+    }
+    
+    char first[8];
+    if( chunk->size >= 8 && chunkRead( chunk, 0, first, 8 ) &&
+        decodeID( (unsigned char*)first ) == DS64_ID ) {
+        size_t size = decodeSize( (unsigned char*)first + 4 );
+        if( 8 + size + size % 2 <= chunk->size )
+            *skip = 8 + size + size % 2;
+    }
+    
+    size_t content = chunk->size - *skip;
+    if( content + 4 <= RAFF_SIZE_LIMIT ) {
+        char*  head = malloc( 12 );
+        size_t n    = 0;
+        addID( head, &n, RIFF_ID );
+        addSize( head, &n, content + 4 );
+        addID( head, &n, chunk->id );
+        *headSize = n;
+        return head;
+    }
+    
+    Ds64Builder b = { 0, false, 0, 0, NULL };
+    collectDs64( &b, chunk );
+    
+    // If there's a format chunk then the number of samples is
+    // the data size over the block alignment.
+    unsigned long long sampleCount = 0;
+    raff_List*         ls          = raff_chunkAsList( chunk );
+    raff_Chunk*        fmt         = ls ? raff_findID( ls, FMT_ID ) : NULL;
+    unsigned char      align[2];
+    if( fmt && fmt->type == TYPE_OTHER && fmt->size >= 14 &&
+        chunkRead( fmt, 12, (char*)align, 2 ) && ( align[0] || align[1] ) )
+        sampleCount = b.dataSize / ( align[0] | align[1] << 8 );
+    
+    size_t ds64Size = 28 + 12*b.count;
+    char*  head     = malloc( 12 + 8 + ds64Size );
+    size_t n        = 0;
+    addID( head, &n, RF64_ID );
+    addSize( head, &n, SIZE_MARKER );
+    addID( head, &n, chunk->id );
+    addID( head, &n, DS64_ID );
+    addSize( head, &n, ds64Size );
+    addSize64( head, &n, 4 + 8 + ds64Size + (unsigned long long)content );
+    addSize64( head, &n, b.dataSize );
+    addSize64( head, &n, sampleCount );
+    addSize( head, &n, b.count );
+    for( size_t i = 0 ; i < b.count ; i++ ) {
+        addID( head, &n, b.table[i].id );
+        addSize64( head, &n, b.table[i].size );
+    }
+    free( b.table );
+    
+    *headSize = n;
+    return head;
+}
+
+typedef struct SerializationStream {
+    raff_StreamEx stream;
+    raff_Chunk*   chunk;
+    size_t        next;
+    size_t        headSize;
+    size_t        skip;
+    char*         head;
+} SerializationStream;
+
+static int
+snextCb( raff_Stream* stream ) {
+    SerializationStream* ss = (SerializationStream*)stream;
+    
+    size_t i = ss->next;
+    if( i < ss->headSize ) {
+        ss->next++;
+        return (unsigned char)ss->head[i];
+    }
+    
+    i = i - ss->headSize + ss->skip;
+    if( i >= ss->chunk->size )
+        return -1;
+    
+    // Encoded lists are read a byte at a time from their parts,
+    // but content from a lazily opened file is loaded first
+    // rather than read from the source a byte at a time.
+    char c;
+    if( ss->chunk->parts && !ss->chunk->start ) {
+        if( !chunkRead( ss->chunk, i, &c, 1 ) )
+            return -1;
+    }
+    else {
+        if( !chunkBytes( ss->chunk ) )
+            return -1;
+        c = ss->chunk->start[i];
+    }
+    
+    ss->next++;
+    return (unsigned char)c;
+}
+
+static size_t
+sreadCb( raff_Stream* stream, char* buf, size_t size ) {
+    SerializationStream* ss = (SerializationStream*)stream;
+    
+    size_t got = 0;
+    if( ss->next < ss->headSize ) {
+        size_t n = ss->headSize - ss->next;
+        if( n > size )
+            n = size;
+        
+        memcpy( buf, ss->head + ss->next, n );
+        ss->next += n;
+        got      += n;
+    }
+    
+    size_t i = ss->next - ss->headSize + ss->skip;
+    if( got < size && i < ss->chunk->size ) {
+        size_t n = ss->chunk->size - i;
+        if( n > size - got )
+            n = size - got;
+        
+        if( !chunkRead( ss->chunk, i, buf + got, n ) )
+            return got;
+        ss->next += n;
+        got      += n;
+    }
+    
+    return got;
+}
+
+static size_t
+sskipCb( raff_Stream* stream, size_t size ) {
+    SerializationStream* ss = (SerializationStream*)stream;
+    
+    size_t left = ss->headSize + ss->chunk->size - ss->skip - ss->next;
+    if( size > left )
+        size = left;
+    
+    ss->next += size;
+    return size;
+}
+
+static void
+scloseCb( raff_Stream* stream ) {
+    SerializationStream* ss = (SerializationStream*)stream;
+    COUNT( &ss->chunk->file->arena.stats, bytesSerialized, ss->next );
+    free( ss->head );
+    free( ss );
+}
+
+raff_Stream*
+raff_serializeChunk( raff_Chunk* chunk ) {
+    
+    SerializationStream* ss = malloc( sizeof(SerializationStream) );
+    ss->stream.stream.next  = snextCb;
+    ss->stream.stream.close = scloseCb;
+    ss->stream.read         = sreadCb;
+    ss->stream.skip         = sskipCb;
+    ss->stream.seek         = NULL;
+    ss->chunk    = chunk;
+    ss->next     = 0;
+    ss->head     = encodeLeader( chunk, &ss->headSize, &ss->skip );
+    
+    return (raff_Stream*)ss;
+}
+
+// Max number of pieces gathered before a sink is flushed,
+// and the size of its buffer for small pieces.
+#define SINK_PIECES 64
+#define SINK_STAGE  4096
+
+// A sink gathers the pieces of a serialized chunk and writes
+// them out together.  Large pieces are referenced in place
+// so they go straight from the chunk to the file, small ones
+// (headers, padding) are copied into the stage so their
+// buffers don't have to outlive the call to sinkPut().
+typedef struct Sink {
+#ifdef RAFF_POSIX
+    int          fd;
+    struct iovec pieces[SINK_PIECES];
+#else
+    FILE*        file;
+    struct {
+        void const* iov_base;
+        size_t      iov_len;
+    } pieces[SINK_PIECES];
+#endif
+    int          count;
+    size_t       staged;
+    bool         failed;
+    char         stage[SINK_STAGE];
+} Sink;
+
+static void
+sinkFlush( Sink* sink ) {
+    if( sink->failed ) {
+        sink->count  = 0;
+        sink->staged = 0;
+        return;
+    }
+    
+#ifdef RAFF_POSIX
+    struct iovec* iov = sink->pieces;
+    int           cnt = sink->count;
+    while( cnt > 0 ) {
+        ssize_t n = writev( sink->fd, iov, cnt );
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 ) {
+            sink->failed = true;
+            break;
+        }
+        
+        // Drop whatever was written, writev() is allowed
+        // to stop part way through a piece.
+        size_t done = n;
+        while( cnt > 0 && done >= iov->iov_len ) {
+            done -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if( cnt > 0 ) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+#else
+    for( int i = 0 ; i < sink->count ; i++ ) {
+        size_t len = sink->pieces[i].iov_len;
+        if( fwrite( sink->pieces[i].iov_base, 1, len, sink->file ) < len ) {
+            sink->failed = true;
+            break;
+        }
+    }
+#endif
+    
+    sink->count  = 0;
+    sink->staged = 0;
+}
+
+static void
+sinkPut( Sink* sink, char const* buf, size_t size ) {
+    if( size == 0 )
+        return;
+    
+    if( sink->count == SINK_PIECES )
+        sinkFlush( sink );
+    
+    if( size <= SINK_STAGE / 16 ) {
+        if( sink->staged + size > SINK_STAGE )
+            sinkFlush( sink );
+        
+        char* dst = sink->stage + sink->staged;
+        memcpy( dst, buf, size );
+        sink->staged += size;
+        
+        // Merge with the previous piece if it ends where
+        // this one starts.
+        if( sink->count > 0 ) {
+            char* prev = (char*)sink->pieces[sink->count - 1].iov_base;
+            if( prev + sink->pieces[sink->count - 1].iov_len == dst ) {
+                sink->pieces[sink->count - 1].iov_len += size;
+                return;
+            }
+        }
+        buf = dst;
+    }
+    
+    sink->pieces[sink->count].iov_base = (void*)buf;
+    sink->pieces[sink->count].iov_len  = size;
+    sink->count++;
+}
+
+static void sinkChunk( Sink* sink, raff_Chunk* chunk );
+
+// Puts a chunk's content, from the given offset, into the
+// sink.  The parts of encoded lists are put in one by one, so
+// they're written straight from their own buffers.
+static void
+sinkContent( Sink* sink, raff_Chunk* chunk, size_t skip ) {
+    if( chunk->start ) {
+        sinkPut( sink, chunk->start + skip, chunk->size - skip );
+    }
+    else
+    if( chunk->parts ) {
+        // Only whole parts are ever skipped.
+        size_t i = 0;
+        while( i < chunk->partCount && chunk->partEnds[i] <= skip )
+            i++;
+        
+        for( ; i < chunk->partCount ; i++ ) {
+            raff_Chunk* part = chunk->parts[i];
+            sinkChunk( sink, part );
+            if( part->size % 2 == 1 )
+                sinkPut( sink, "", 1 );
+        }
+    }
+    else {
+        // Content that hasn't been loaded is copied through
+        // a block at a time rather than loaded in full.
+        size_t block = 1 << 20;
+        char*  buf   = malloc( block );
+        for( size_t i = skip ; i < chunk->size && !sink->failed ; i += block ) {
+            size_t n = chunk->size - i < block ? chunk->size - i : block;
+            if( !chunkRead( chunk, i, buf, n ) ) {
+                sink->failed = true;
+                break;
+            }
+            sinkPut( sink, buf, n );
+            sinkFlush( sink );
+        }
+        free( buf );
+    }
+}
+
+// Puts a whole chunk, header and content, into the sink.
+static void
+sinkChunk( Sink* sink, raff_Chunk* chunk ) {
+    char head[12];
+    sinkPut( sink, head, encodeHeader( chunk, head ) );
+    sinkContent( sink, chunk, 0 );
+}
+
+static raff_Error
+serializeToFile( raff_Chunk* chunk, char const* path ) {
+    Sink* sink = malloc( sizeof(Sink) );
+    sink->count  = 0;
+    sink->staged = 0;
+    sink->failed = false;
+    
+#ifdef RAFF_POSIX
+    sink->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if( sink->fd < 0 ) {
+#else
+    sink->file = fopen( path, "wb" );
+    if( !sink->file ) {
+#endif
+        free( sink );
+        errnum = raff_ERR_CANT_OPEN;
+        return errnum;
+    }
+    
+    // The chunk being written is the top of the file, so may
+    // need a different header than when it's in a list.
+    size_t headSize, skip;
+    char*  head = encodeLeader( chunk, &headSize, &skip );
+    sinkPut( sink, head, headSize );
+    sinkContent( sink, chunk, skip );
+    sinkFlush( sink );
+    free( head );
+    if( !sink->failed )
+        COUNT( &chunk->file->arena.stats, bytesSerialized, headSize + chunk->size - skip );
+    
+#ifdef RAFF_POSIX
+    if( close( sink->fd ) != 0 )
+        sink->failed = true;
+#else
+    if( fclose( sink->file ) != 0 )
+        sink->failed = true;
+#endif
+    
+    errnum = sink->failed ? raff_ERR_CANT_WRITE : raff_ERR_NONE;
+    free( sink );
+    return errnum;
+}
+
+raff_Error
+raff_serializeChunkToFile( raff_Chunk* chunk, char const* path ) {
+    BEGIN_PHASE( raff_PHASE_SERIALIZE, chunk->file );
+    raff_Error err = serializeToFile( chunk, path );
+    END_PHASE( raff_PHASE_SERIALIZE, chunk->file );
+    return err;
+}
+
+// The content size of the ds64 chunk a writer reserves room
+// for, which has no table.
+#define WRITER_DS64_SIZE 28
+
+// Writes a file as it goes, keeping only the offsets of the
+// chunks still open so their sizes can be patched when they're
+// closed.
+struct raff_Writer {
+    FILE*               out;
+    raff_Error          err;
+    
+    // Bytes written so far.
+    unsigned long long  pos;
+    
+    // Header offsets of the open lists, the root first.
+    unsigned long long* lists;
+    size_t              depth;
+    size_t              capacity;
+    
+    // The open data chunk, if any.
+    bool                inData;
+    raff_ID             dataID;
+    unsigned long long  dataHead;
+    
+    // Size of the first 'data' chunk, and the block alignment
+    // from the 'fmt ' chunk; for the ds64 chunk if one is needed.
+    bool                haveData;
+    unsigned long long  dataSize;
+    unsigned            blockAlign;
+};
+
+// Writes to the end of the writer's file.
+static raff_Error
+writerPut( raff_Writer* writer, char const* buf, size_t size ) {
+    if( writer->err != raff_ERR_NONE )
+        return writer->err;
+    
+    if( fwrite( buf, 1, size, writer->out ) < size )
+        writer->err = raff_ERR_CANT_WRITE;
+    else
+        writer->pos += size;
+    COUNT_GLOBAL( bytesSerialized, size );
+    return writer->err;
+}
+
+// Writes over bytes already written, then goes back to the end.
+static raff_Error
+writerPatch( raff_Writer* writer, unsigned long long offset, char const* buf, size_t size ) {
+    if( writer->err != raff_ERR_NONE )
+        return writer->err;
+    
+    writer->err = writeAt( writer->out, offset, buf, size );
+    if( writer->err == raff_ERR_NONE && seekTo( writer->out, writer->pos ) != 0 )
+        writer->err = raff_ERR_CANT_WRITE;
+    return writer->err;
+}
+
+static void
+writerPatchSize( raff_Writer* writer, unsigned long long head, size_t size ) {
+    char   buf[4];
+    size_t n = 0;
+    addSize( buf, &n, size );
+    writerPatch( writer, head + 4, buf, n );
+}
+
+raff_Writer*
+raff_newWriter( char const* path, raff_ID id ) {
+    FILE* out = fopen( path, "wb" );
+    if( !out ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    raff_Writer* writer = malloc( sizeof(raff_Writer) );
+    writer->out        = out;
+    writer->err        = raff_ERR_NONE;
+    writer->pos        = 0;
+    writer->lists      = malloc( 8*sizeof(unsigned long long) );
+    writer->depth      = 1;
+    writer->capacity   = 8;
+    writer->inData     = false;
+    writer->dataID     = 0;
+    writer->dataHead   = 0;
+    writer->haveData   = false;
+    writer->dataSize   = 0;
+    writer->blockAlign = 0;
+    writer->lists[0]   = 0;
+    
+    // The root's size is patched when the writer's closed, and
+    // room is kept after it for a ds64 chunk, in case the file
+    // grows too big for a RIFF; until then it's just junk.
+    char   head[12 + 8 + WRITER_DS64_SIZE] = { 0 };
+    size_t n = 0;
+    addID( head, &n, RIFF_ID );
+    addSize( head, &n, 0 );
+    addID( head, &n, id );
+    addID( head, &n, JUNK_ID );
+    addSize( head, &n, WRITER_DS64_SIZE );
+    writerPut( writer, head, sizeof(head) );
+    
+    errnum = writer->err;
+    return writer;
+}
+
+raff_Error
+raff_writerBeginList( raff_Writer* writer, raff_ID id ) {
+    // Lists can't go in data chunks.
+    assert( !writer->inData );
+    
+    if( writer->depth == writer->capacity ) {
+        writer->capacity *= 2;
+        writer->lists     = realloc( writer->lists,
+                                     writer->capacity*sizeof(unsigned long long) );
+    }
+    writer->lists[writer->depth++] = writer->pos;
+    
+    char   head[12];
+    size_t n = 0;
+    addID( head, &n, LIST_ID );
+    addSize( head, &n, 0 );
+    addID( head, &n, id );
+    errnum = writerPut( writer, head, n );
+    return errnum;
+}
+
+raff_Error
+raff_writerEndList( raff_Writer* writer ) {
+    // There should be an open list other than the root, and
+    // its data chunks should have been ended.
+    assert( writer->depth > 1 );
+    assert( !writer->inData );
+    
+    // Only the root and first 'data' chunk can have sizes
+    // that don't fit, since there's no room for a ds64 table.
+    unsigned long long head = writer->lists[--writer->depth];
+    unsigned long long size = writer->pos - head - 8;
+    if( size > RAFF_SIZE_LIMIT && writer->err == raff_ERR_NONE )
+        writer->err = raff_ERR_CANT_WRITE;
+    
+    writerPatchSize( writer, head, size );
+    errnum = writer->err;
+    return errnum;
+}
+
+raff_Error
+raff_writerBeginData( raff_Writer* writer, raff_ID id ) {
+    // Data chunks can't be nested.
+    assert( !writer->inData );
+    
+    writer->inData   = true;
+    writer->dataID   = id;
+    writer->dataHead = writer->pos;
+    
+    char   head[8];
+    size_t n = 0;
+    addID( head, &n, id );
+    addSize( head, &n, 0 );
+    errnum = writerPut( writer, head, n );
+    return errnum;
+}
+
+raff_Error
+raff_writerWrite( raff_Writer* writer, char const* buf, size_t size ) {
+    // There should be an open data chunk to write to.
+    assert( writer->inData );
+    
+    // The block alignment of the format is picked up on the way
+    // past, for the sample count in the ds64 chunk.
+    unsigned long long at = writer->pos - writer->dataHead - 8;
+    if( writer->dataID == FMT_ID && at <= 13 && at + size > 12 ) {
+        for( size_t i = 0 ; i < size && at + i <= 13 ; i++ ) {
+            if( at + i == 12 )
+                writer->blockAlign = ( writer->blockAlign & 0xFF00 ) | (unsigned char)buf[i];
+            else
+            if( at + i == 13 )
+                writer->blockAlign = ( writer->blockAlign & 0xFF ) | (unsigned char)buf[i] << 8;
+        }
+    }
+    
+    errnum = writerPut( writer, buf, size );
+    return errnum;
+}
+
+raff_Error
+raff_writerEndData( raff_Writer* writer ) {
+    // There should be an open data chunk to end.
+    assert( writer->inData );
+    writer->inData = false;
+    
+    unsigned long long size = writer->pos - writer->dataHead - 8;
+    if( size % 2 == 1 )
+        writerPut( writer, "", 1 );
+    
+    // The first 'data' chunk's size goes in the ds64 chunk, so
+    // that can be too big for its size field.
+    bool first = writer->dataID == DATA_ID && !writer->haveData;
+    if( first ) {
+        writer->haveData = true;
+        writer->dataSize = size;
+    }
+    
+    if( size > RAFF_SIZE_LIMIT && !first && writer->err == raff_ERR_NONE )
+        writer->err = raff_ERR_CANT_WRITE;
+    
+    writerPatchSize( writer, writer->dataHead, size > RAFF_SIZE_LIMIT ? SIZE_MARKER : size );
+    errnum = writer->err;
+    return errnum;
+}
+
+raff_Error
+raff_writerChunk( raff_Writer* writer, raff_Chunk* chunk ) {
+    // Chunks can't go in data chunks.
+    assert( !writer->inData );
+    
+    // Data goes through the same path as any other, so sizes
+    // are checked in the same way; lists are copied whole.
+    if( chunk->type == TYPE_OTHER ) {
+        raff_writerBeginData( writer, chunk->id );
+    }
+    else {
+        if( chunk->size + 4 > RAFF_SIZE_LIMIT && writer->err == raff_ERR_NONE )
+            writer->err = raff_ERR_CANT_WRITE;
+        
+        char head[12];
+        writerPut( writer, head, encodeHeader( chunk, head ) );
+    }
+    
+    size_t block = 1 << 20;
+    char*  buf   = malloc( block );
+    for( size_t i = 0 ; i < chunk->size && writer->err == raff_ERR_NONE ; i += block ) {
+        size_t n = chunk->size - i < block ? chunk->size - i : block;
+        if( !chunkRead( chunk, i, buf, n ) )
+            writer->err = raff_ERR_CORRUPT;
+        else
+        if( chunk->type == TYPE_OTHER )
+            raff_writerWrite( writer, buf, n );
+        else
+            writerPut( writer, buf, n );
+    }
+    free( buf );
+    
+    if( chunk->type == TYPE_OTHER )
+        raff_writerEndData( writer );
+    else
+    if( chunk->size % 2 == 1 )
+        writerPut( writer, "", 1 );
+    
+    errnum = writer->err;
+    return errnum;
+}
+
+raff_Error
+raff_closeWriter( raff_Writer* writer ) {
+    if( writer->inData )
+        raff_writerEndData( writer );
+    while( writer->depth > 1 )
+        raff_writerEndList( writer );
+    
+    // If the root's too big then the file becomes RF64, with
+    // the junk chunk turned into its ds64 chunk.
+    unsigned long long size = writer->pos - 8;
+    if( size > RAFF_SIZE_LIMIT ) {
+        unsigned long long samples = 0;
+        if( writer->blockAlign )
+            samples = writer->dataSize / writer->blockAlign;
+        
+        char   head[8];
+        size_t n = 0;
+        addID( head, &n, RF64_ID );
+        addSize( head, &n, SIZE_MARKER );
+        writerPatch( writer, 0, head, n );
+        
+        char ds64[8 + WRITER_DS64_SIZE];
+        n = 0;
+        addID( ds64, &n, DS64_ID );
+        addSize( ds64, &n, WRITER_DS64_SIZE );
+        addSize64( ds64, &n, size );
+        addSize64( ds64, &n, writer->dataSize );
+        addSize64( ds64, &n, samples );
+        addSize( ds64, &n, 0 );
+        writerPatch( writer, 12, ds64, n );
+    }
+    else {
+        writerPatchSize( writer, 0, size );
+    }
+    
+    if( fclose( writer->out ) != 0 && writer->err == raff_ERR_NONE )
+        writer->err = raff_ERR_CANT_WRITE;
+    
+    errnum = writer->err;
+    free( writer->lists );
+    free( writer );
+    return errnum;
+}
+
+size_t
+raff_dataSize( raff_Data* data ) {
+    return data->size;
+}
+
+char const*
+raff_dataContent( raff_Data* data ) {
+    if( !data->start && data->asChunk ) {
+        errnum = raff_ERR_NONE;
+        return chunkBytes( data->asChunk );
+    }
+    return data->start;
+}
+
+size_t
+raff_dataRead( raff_Data* data, size_t offset, char* buf, size_t size ) {
+    if( offset >= data->size )
+        return 0;
+    if( size > data->size - offset )
+        size = data->size - offset;
+    
+    if( data->start ) {
+        memcpy( buf, data->start + offset, size );
+    }
+    else
+    if( !data->asChunk || !chunkRead( data->asChunk, offset, buf, size ) ) {
+        errnum = raff_ERR_CORRUPT;
+        return 0;
+    }
+    
+    errnum = raff_ERR_NONE;
+    return size;
+}
+
+// AVI indexes.  The chunks of each stream are found once, from
+// the OpenDML indexes if every stream has one, otherwise from
+// the idx1 chunk, otherwise by walking the movi list; then kept
+// in arrays so any of them can be looked up directly.
+#define AVI_MAX_STREAMS 100
+
+// Flags of idx1 entries.
+#define AVIIF_LIST     0x01
+#define AVIIF_KEYFRAME 0x10
+
+// Types of OpenDML index.
+#define AVI_INDEX_OF_INDEXES 0x00
+#define AVI_INDEX_OF_CHUNKS  0x01
+
+// Set in the sizes of an OpenDML standard index, and so in the
+// sizes of an AviStream, for chunks that aren't key frames.
+#define AVI_NOT_KEY 0x80000000u
+
+static raff_ID AVI_ID =
+    (long)'A' << 24 | (long)'V' << 16 | (long)'I' << 8 | (long)' ';
+
+static raff_ID HDRL_ID =
+    (long)'h' << 24 | (long)'d' << 16 | (long)'r' << 8 | (long)'l';
+
+static raff_ID STRL_ID =
+    (long)'s' << 24 | (long)'t' << 16 | (long)'r' << 8 | (long)'l';
+
+static raff_ID INDX_ID =
+    (long)'i' << 24 | (long)'n' << 16 | (long)'d' << 8 | (long)'x';
+
+static raff_ID MOVI_ID =
+    (long)'m' << 24 | (long)'o' << 16 | (long)'v' << 8 | (long)'i';
+
+static raff_ID IDX1_ID =
+    (long)'i' << 24 | (long)'d' << 16 | (long)'x' << 8 | (long)'1';
+
+// The chunks of one stream, in order.  Offsets are of the
+// content of each chunk from the start of the file.  The numbers
+// of the chunks that are key frames are kept, in order, as well.
+typedef struct AviStream {
+    size_t              count;
+    uint32_t*           ids;
+    uint32_t*           sizes;
+    unsigned long long* offsets;
+    size_t              keyCount;
+    size_t*             keys;
+} AviStream;
+
+struct raff_AviIndex {
+    raff_File* file;
+    unsigned   streamCount;
+    AviStream* streams;
+};
+
+// Streams are filled in temporary arrays while the index is
+// being read, since the number of chunks in each isn't known
+// until they've all been found.
+typedef struct AviBuild {
+    AviStream streams[AVI_MAX_STREAMS];
+    size_t    capacity[AVI_MAX_STREAMS];
+    unsigned  streamCount;
+} AviBuild;
+
+static void
+aviReset( AviBuild* build ) {
+    for( unsigned s = 0 ; s < build->streamCount ; s++ ) {
+        free( build->streams[s].ids );
+        free( build->streams[s].sizes );
+        free( build->streams[s].offsets );
+    }
+    memset( build, 0, sizeof(AviBuild) );
+}
+
+static void
+aviAdd( AviBuild* build, unsigned stream, raff_ID id, uint32_t size,
+        unsigned long long offset ) {
+    if( stream >= build->streamCount )
+        build->streamCount = stream + 1;
+    
+    AviStream* st = &build->streams[stream];
+    if( st->count == build->capacity[stream] ) {
+        size_t capacity = st->count ? st->count*2 : 64;
+        st->ids     = realloc( st->ids, capacity*sizeof(uint32_t) );
+        st->sizes   = realloc( st->sizes, capacity*sizeof(uint32_t) );
+        st->offsets = realloc( st->offsets, capacity*sizeof(unsigned long long) );
+        build->capacity[stream] = capacity;
+    }
+    st->ids[st->count]     = (uint32_t)id;
+    st->sizes[st->count]   = size;
+    st->offsets[st->count] = offset;
+    st->count++;
+}
+
+// Gives the stream number from the first two characters of a
+// chunk ID, or returns false if they aren't digits.
+static bool
+aviStreamOf( raff_ID id, unsigned* stream ) {
+    int hi = id >> 24 & 0xFF;
+    int lo = id >> 16 & 0xFF;
+    if( hi < '0' || hi > '9' || lo < '0' || lo > '9' )
+        return false;
+    
+    *stream = ( hi - '0' )*10 + ( lo - '0' );
+    return true;
+}
+
+// Returns size bytes of a file from the given offset if they're
+// in memory, or NULL if they aren't.
+static char const*
+fileBytes( raff_File* file, unsigned long long offset, size_t size ) {
+    if( file->map ) {
+        if( offset > file->mapSize || size > file->mapSize - offset )
+            return NULL;
+        return (char const*)file->map + offset;
+    }
+    
+    if( !file->data || offset < 12 || offset - 12 > file->size ||
+        size > file->size - ( offset - 12 ) )
+        return NULL;
+    return file->data + ( offset - 12 );
+}
+
+// Copies size bytes of a file from the given offset into buf,
+// from memory or from the file's source.
+static bool
+fileRead( raff_File* file, unsigned long long offset, char* buf, size_t size ) {
+    char const* bytes = fileBytes( file, offset, size );
+    if( bytes ) {
+        memcpy( buf, bytes, size );
+        return true;
+    }
+    
+    raff_StreamEx* source = file->source;
+    if( !source || source->seek( &source->stream, offset ) != 0 )
+        return false;
+    return sread( source, buf, size ) == size;
+}
+
+// Like fileRead(), but returns the bytes in place if they're in
+// memory; otherwise they're read into a buffer the caller has
+// to free, and *owned is set.
+static unsigned char const*
+fileLoad( raff_File* file, unsigned long long offset, size_t size, bool* owned ) {
+    *owned = false;
+    char const* bytes = fileBytes( file, offset, size );
+    if( bytes )
+        return (unsigned char const*)bytes;
+    
+    // Sizes come from the file, so there's no making room for
+    // more than it has.
+    unsigned long long end = file->map ? file->mapSize : file->size + 12ULL;
+    if( offset > end || size > end - offset )
+        return NULL;
+    
+    char* buf = malloc( size ? size : 1 );
+    if( !buf )
+        return NULL;
+    if( !fileRead( file, offset, buf, size ) ) {
+        free( buf );
+        return NULL;
+    }
+    *owned = true;
+    return (unsigned char const*)buf;
+}
+
+static unsigned
+decode16( unsigned char const* b ) {
+    return b[0] | b[1] << 8;
+}
+
+// Adds the entries of an OpenDML standard index, given its
+// content (after the chunk header), to a stream.
+static bool
+aviStdIndex( AviBuild* build, unsigned stream, unsigned char const* b, size_t size ) {
+    if( size < 24 || b[3] != AVI_INDEX_OF_CHUNKS )
+        return false;
+    
+    size_t             stride  = decode16( b )*4;
+    size_t             entries = decodeSize( b + 4 );
+    raff_ID            id      = decodeID( b + 8 );
+    unsigned long long base    = decodeSize64( b + 12 );
+    if( stride < 8 || entries > ( size - 24 ) / stride )
+        return false;
+    
+    for( size_t i = 0 ; i < entries ; i++ ) {
+        unsigned char const* entry = b + 24 + i*stride;
+        aviAdd( build, stream, id, (uint32_t)decodeSize( entry + 4 ),
+                base + decodeSize( entry ) );
+    }
+    return true;
+}
+
+// Reads a stream's chunks from its indx chunk; which is either a
+// super index of standard indexes elsewhere in the file, or a
+// standard index itself.
+static bool
+aviSuperIndex( AviBuild* build, unsigned stream, raff_Chunk* indx ) {
+    raff_File*           file = indx->file;
+    bool                 owned;
+    unsigned char const* b    = fileLoad( file, indx->offset, indx->size, &owned );
+    if( !b )
+        return false;
+    
+    bool ok = indx->size >= 24;
+    if( ok && b[3] == AVI_INDEX_OF_CHUNKS ) {
+        ok = aviStdIndex( build, stream, b, indx->size );
+    }
+    else
+    if( ok ) {
+        size_t stride  = decode16( b )*4;
+        size_t entries = decodeSize( b + 4 );
+        ok = b[3] == AVI_INDEX_OF_INDEXES && stride >= 16 &&
+             entries <= ( indx->size - 24 ) / stride;
+        
+        for( size_t i = 0 ; ok && i < entries ; i++ ) {
+            unsigned char const* entry  = b + 24 + i*stride;
+            unsigned long long   offset = decodeSize64( entry );
+            
+            // The entry gives the offset of the standard index's
+            // header, and its size including the header.
+            unsigned char head[8];
+            ok = fileRead( file, offset, (char*)head, 8 );
+            if( !ok )
+                break;
+            
+            size_t               size = decodeSize( head + 4 );
+            bool                 ownedStd;
+            unsigned char const* std  = fileLoad( file, offset + 8, size, &ownedStd );
+            ok = std && aviStdIndex( build, stream, std, size );
+            if( ownedStd )
+                free( (void*)std );
+        }
+    }
+    
+    if( owned )
+        free( (void*)b );
+    return ok;
+}
+
+// Reads the chunks of every stream from the idx1 chunk.  Offsets
+// in it are usually from the movi list's ID, but some writers
+// make them from the start of the file; which is worked out from
+// the first entry.  Offsets from the start of the file can't be
+// before the movi list, so if it's after and its chunk is there
+// they're taken to be those.
+static bool
+aviIdx1( AviBuild* build, raff_Chunk* idx1, raff_Chunk* movi ) {
+    raff_File*           file = idx1->file;
+    bool                 owned;
+    unsigned char const* b    = fileLoad( file, idx1->offset, idx1->size, &owned );
+    if( !b )
+        return false;
+    
+    size_t             entries = idx1->size / 16;
+    unsigned long long base    = movi->offset - 4;
+    for( size_t i = 0 ; i < entries ; i++ ) {
+        unsigned char const* entry = b + i*16;
+        if( decodeSize( entry + 4 ) & AVIIF_LIST )
+            continue;
+        
+        unsigned char      head[4];
+        unsigned long long offset = decodeSize( entry + 8 );
+        if( offset > base && fileRead( file, offset, (char*)head, 4 ) &&
+            !memcmp( head, entry, 4 ) ) {
+            base = 0;
+            break;
+        }
+        if( fileRead( file, base + offset, (char*)head, 4 ) && !memcmp( head, entry, 4 ) )
+            break;
+        
+        if( owned )
+            free( (void*)b );
+        return false;
+    }
+    
+    for( size_t i = 0 ; i < entries ; i++ ) {
+        unsigned char const* entry = b + i*16;
+        raff_ID              id    = decodeID( entry );
+        size_t               flags = decodeSize( entry + 4 );
+        unsigned             stream;
+        if( flags & AVIIF_LIST || !aviStreamOf( id, &stream ) )
+            continue;
+        
+        uint32_t size = (uint32_t)decodeSize( entry + 12 ) & ~AVI_NOT_KEY;
+        if( !( flags & AVIIF_KEYFRAME ) )
+            size |= AVI_NOT_KEY;
+        aviAdd( build, stream, id, size, base + decodeSize( entry + 8 ) + 8 );
+    }
+    
+    if( owned )
+        free( (void*)b );
+    return true;
+}
+
+// Finds the chunks of every stream by walking the movi list,
+// and any 'rec ' lists in it.  Without an index there's no way
+// to tell key frames, so every chunk is taken to be one.
+static bool
+aviScan( AviBuild* build, raff_List* list ) {
+    ChildTable* table = list->table;
+    raff_Chunk* chunk = table ? NULL : list->first;
+    for( size_t i = 0 ; table ? i < list->count : chunk != NULL ; i++ ) {
+        raff_Type          type   = table ? table->types[i] : chunk->type;
+        raff_ID            id     = table ? table->ids[i] : chunk->id;
+        size_t             size   = table ? table->sizes[i] : chunk->size;
+        unsigned long long offset = table ? table->offsets[i] : chunk->offset;
+        unsigned           stream;
+        if( type != TYPE_OTHER ) {
+            raff_Chunk* sub = table ? childAt( list, i, &list->file->arena ) : chunk;
+            raff_List*  rec = raff_chunkAsList( sub );
+            if( !rec || !aviScan( build, rec ) )
+                return false;
+        }
+        else
+        if( aviStreamOf( id, &stream ) && size < AVI_NOT_KEY ) {
+            aviAdd( build, stream, id, (uint32_t)size, offset );
+        }
+        
+        if( !table )
+            chunk = chunk->next;
+    }
+    return true;
+}
+
+// Copies the streams found into the index, from the file's pool.
+static void
+aviFinish( raff_AviIndex* index, AviBuild* build, unsigned streamCount ) {
+    raff_File* file = index->file;
+    if( streamCount < build->streamCount )
+        streamCount = build->streamCount;
+    
+    index->streamCount = streamCount;
+    index->streams     = alloc( file, ( streamCount ? streamCount : 1 )*sizeof(AviStream) );
+    for( unsigned s = 0 ; s < streamCount ; s++ ) {
+        AviStream* from = &build->streams[s];
+        AviStream* to   = &index->streams[s];
+        to->count   = s < build->streamCount ? from->count : 0;
+        to->ids     = alloc( file, to->count*sizeof(uint32_t) );
+        to->sizes   = alloc( file, to->count*sizeof(uint32_t) );
+        to->offsets = alloc( file, to->count*sizeof(unsigned long long) );
+        if( to->count > 0 ) {
+            memcpy( to->ids, from->ids, to->count*sizeof(uint32_t) );
+            memcpy( to->sizes, from->sizes, to->count*sizeof(uint32_t) );
+            memcpy( to->offsets, from->offsets, to->count*sizeof(unsigned long long) );
+        }
+        
+        to->keyCount = 0;
+        for( size_t n = 0 ; n < to->count ; n++ )
+            to->keyCount += !( to->sizes[n] & AVI_NOT_KEY );
+        to->keys = alloc( file, to->keyCount*sizeof(size_t) );
+        for( size_t n = 0, k = 0 ; n < to->count ; n++ ) {
+            if( !( to->sizes[n] & AVI_NOT_KEY ) )
+                to->keys[k++] = n;
+        }
+    }
+    aviReset( build );
+}
+
+raff_AviIndex*
+raff_aviIndex( raff_File* file ) {
+    raff_Chunk* root = file->chunk;
+    if( !root || root->id != AVI_ID ) {
+        errnum = raff_ERR_NOT_AVI;
+        return NULL;
+    }
+    
+    raff_List* avi = raff_chunkAsList( root );
+    if( !avi )
+        return NULL;
+    
+    raff_Chunk* moviChunk = raff_findID( avi, MOVI_ID );
+    raff_List*  movi      = moviChunk ? raff_chunkAsList( moviChunk ) : NULL;
+    if( !movi ) {
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    
+    // Streams are numbered in the order of their strl lists, and
+    // only OpenDML files have an indx chunk in each.
+    raff_Chunk* indx[AVI_MAX_STREAMS];
+    unsigned    streamCount = 0;
+    bool        opendml     = false;
+    raff_Chunk* hdrlChunk   = raff_findID( avi, HDRL_ID );
+    raff_List*  hdrl        = hdrlChunk ? raff_chunkAsList( hdrlChunk ) : NULL;
+    if( hdrl ) {
+        opendml = true;
+        for( raff_Chunk* iter = raff_findID( hdrl, STRL_ID ) ;
+             iter && streamCount < AVI_MAX_STREAMS ;
+             iter = raff_findNextID( hdrl, iter ) ) {
+            raff_List* strl = raff_chunkAsList( iter );
+            indx[streamCount] = strl ? raff_findID( strl, INDX_ID ) : NULL;
+            if( !indx[streamCount] || indx[streamCount]->type != TYPE_OTHER )
+                opendml = false;
+            streamCount++;
+        }
+        opendml = opendml && streamCount > 0;
+    }
+    
+    raff_AviIndex* index = alloc( file, sizeof(raff_AviIndex) );
+    index->file = file;
+    
+    AviBuild build;
+    memset( &build, 0, sizeof(build) );
+    if( opendml ) {
+        bool ok = true;
+        for( unsigned s = 0 ; ok && s < streamCount ; s++ )
+            ok = aviSuperIndex( &build, s, indx[s] );
+        if( ok ) {
+            aviFinish( index, &build, streamCount );
+            errnum = raff_ERR_NONE;
+            return index;
+        }
+        aviReset( &build );
+    }
+    
+    raff_Chunk* idx1 = raff_findID( avi, IDX1_ID );
+    if( idx1 && idx1->type == TYPE_OTHER && aviIdx1( &build, idx1, moviChunk ) ) {
+        aviFinish( index, &build, streamCount );
+        errnum = raff_ERR_NONE;
+        return index;
+    }
+    aviReset( &build );
+    
+    if( !aviScan( &build, movi ) ) {
+        aviReset( &build );
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    aviFinish( index, &build, streamCount );
+    errnum = raff_ERR_NONE;
+    return index;
+}
+
+unsigned
+raff_aviStreamCount( raff_AviIndex* index ) {
+    return index->streamCount;
+}
+
+size_t
+raff_aviChunkCount( raff_AviIndex* index, unsigned stream ) {
+    return stream < index->streamCount ? index->streams[stream].count : 0;
+}
+
+bool
+raff_aviChunk( raff_AviIndex* index, unsigned stream, size_t n, raff_AviChunk* chunk ) {
+    if( stream >= index->streamCount || n >= index->streams[stream].count )
+        return false;
+    
+    AviStream* st = &index->streams[stream];
+    chunk->id      = st->ids[n];
+    chunk->size    = st->sizes[n] & ~AVI_NOT_KEY;
+    chunk->offset  = st->offsets[n];
+    chunk->key     = !( st->sizes[n] & AVI_NOT_KEY );
+    chunk->content = fileBytes( index->file, chunk->offset, chunk->size );
+    return true;
+}
+
+size_t
+raff_aviKeyChunk( raff_AviIndex* index, unsigned stream, size_t n ) {
+    size_t count = raff_aviChunkCount( index, stream );
+    if( n >= count )
+        return count;
+    
+    // The key frames are in order, so the last at or before n
+    // is found by halving.
+    AviStream* st = &index->streams[stream];
+    size_t     lo = 0;
+    size_t     hi = st->keyCount;
+    while( lo < hi ) {
+        size_t mid = lo + ( hi - lo )/2;
+        if( st->keys[mid] <= n )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? st->keys[lo - 1] : count;
+}
+
+size_t
+raff_aviRead( raff_AviIndex* index, raff_AviChunk const* chunk,
+              size_t offset, char* buf, size_t size ) {
+    if( offset >= chunk->size )
+        return 0;
+    if( size > chunk->size - offset )
+        size = chunk->size - offset;
+    
+    if( !fileRead( index->file, chunk->offset + offset, buf, size ) ) {
+        errnum = raff_ERR_CORRUPT;
+        return 0;
+    }
+    
+    errnum = raff_ERR_NONE;
+    return size;
+}
+
+// WAVE files.  The format is read once from the fmt chunk, and
+// ranges of frames found in the data chunk from it.
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static raff_ID WAVE_ID =
+    (long)'W' << 24 | (long)'A' << 16 | (long)'V' << 8 | (long)'E';
+
+struct raff_Wave {
+    raff_WaveFormat    format;
+    raff_Data*         data;
+    unsigned long long frames;
+};
+
+raff_Wave*
+raff_fileAsWave( raff_File* file ) {
+    raff_Chunk* root = file->chunk;
+    if( !root || root->id != WAVE_ID ) {
+        errnum = raff_ERR_NOT_WAVE;
+        return NULL;
+    }
+    
+    raff_List* wave = raff_chunkAsList( root );
+    if( !wave )
+        return NULL;
+    
+    raff_Chunk* fmtChunk  = raff_findID( wave, FMT_ID );
+    raff_Chunk* dataChunk = raff_findID( wave, DATA_ID );
+    raff_Data*  fmt       = fmtChunk ? raff_chunkAsData( fmtChunk ) : NULL;
+    raff_Data*  data      = dataChunk ? raff_chunkAsData( dataChunk ) : NULL;
+    if( !fmt || !data || raff_dataSize( fmt ) < 16 ) {
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    
+    // Only the fields up to the end of WAVEFORMATEXTENSIBLE are
+    // needed, so only those are read.
+    unsigned char b[40];
+    size_t        size = raff_dataRead( fmt, 0, (char*)b, sizeof(b) );
+    if( size < 16 )
+        return NULL;
+    
+    raff_WaveFormat format;
+    format.format        = decode16( b );
+    format.channels      = decode16( b + 2 );
+    format.sampleRate    = decodeSize( b + 4 );
+    format.byteRate      = decodeSize( b + 8 );
+    format.blockAlign    = decode16( b + 12 );
+    format.bitsPerSample = decode16( b + 14 );
+    format.validBits     = format.bitsPerSample;
+    format.channelMask   = 0;
+    format.extensible    = false;
+    
+    // For WAVE_FORMAT_EXTENSIBLE the real format is the first two
+    // bytes of the sub-format GUID.
+    if( format.format == WAVE_FORMAT_EXTENSIBLE ) {
+        if( size < 40 || decode16( b + 16 ) < 22 ) {
+            errnum = raff_ERR_CORRUPT;
+            return NULL;
+        }
+        format.extensible  = true;
+        format.validBits   = decode16( b + 18 );
+        format.channelMask = decodeSize( b + 20 );
+        format.format      = decode16( b + 24 );
+    }
+    
+    if( format.blockAlign == 0 || format.channels == 0 ) {
+        errnum = raff_ERR_CORRUPT;
+        return NULL;
+    }
+    
+    raff_Wave* w = alloc( root->file, sizeof(raff_Wave) );
+    w->format = format;
+    w->data   = data;
+    w->frames = raff_dataSize( data ) / format.blockAlign;
+    
+    errnum = raff_ERR_NONE;
+    return w;
+}
+
+raff_WaveFormat const*
+raff_waveFormat( raff_Wave* wave ) {
+    return &wave->format;
+}
+
+unsigned long long
+raff_waveFrameCount( raff_Wave* wave ) {
+    return wave->frames;
+}
+
+bool
+raff_waveFrames( raff_Wave* wave, unsigned long long first,
+                 unsigned long long count, raff_WaveSlice* slice ) {
+    if( first > wave->frames )
+        return false;
+    if( count > wave->frames - first )
+        count = wave->frames - first;
+    
+    size_t align = wave->format.blockAlign;
+    slice->first   = first;
+    slice->count   = count;
+    slice->offset  = (size_t)first*align;
+    slice->size    = (size_t)count*align;
+    slice->content = wave->data->start ? wave->data->start + slice->offset : NULL;
+    return true;
+}
+
+bool
+raff_waveTime( raff_Wave* wave, double start, double seconds, raff_WaveSlice* slice ) {
+    if( !isfinite( start ) || !isfinite( seconds ) )
+        return false;
+    
+    double rate = wave->format.sampleRate;
+    if( start < 0 )
+        start = 0;
+    if( seconds < 0 )
+        seconds = 0;
+    
+    // Both ends are rounded to the nearest frame, and clamped to
+    // the frame count before converting so huge times don't
+    // overflow.
+    double frames = (double)wave->frames;
+    double first  = start*rate + 0.5;
+    double end    = ( start + seconds )*rate + 0.5;
+    if( first > frames )
+        first = frames + 1;
+    if( end > frames )
+        end = frames;
+    
+    unsigned long long from = (unsigned long long)first;
+    unsigned long long to   = (unsigned long long)end;
+    return raff_waveFrames( wave, from, to > from ? to - from : 0, slice );
+}
+
+size_t
+raff_waveRead( raff_Wave* wave, raff_WaveSlice const* slice,
+               size_t offset, char* buf, size_t size ) {
+    if( offset >= slice->size ) {
+        errnum = raff_ERR_NONE;
+        return 0;
+    }
+    if( size > slice->size - offset )
+        size = slice->size - offset;
+    
+    return raff_dataRead( wave->data, slice->offset + offset, buf, size );
+}
+
+// Sample conversion.  Samples are converted between the type
+// they're stored as and floats a block at a time, in the order
+// they're stored; then spread out to, or gathered from, an array
+// per channel.  Both steps have SSE2 and AVX2 versions, with the
+// AVX2 ones picked at run time if the CPU has it.
+//
+// Integers are scaled so their full range maps to [-1, 1), and
+// floats are clamped to that range, scaled, and rounded half away
+// from zero on the way back.  The vector versions do the same
+// float operations in the same order, so they give the same
+// results as the scalar ones.
+#define CONVERT_BLOCK 1024
+
+typedef void (*DecodeFn)( char const* in, float* out, size_t count );
+typedef void (*EncodeFn)( float const* in, char* out, size_t count );
+typedef void (*SplitFn)( float const* in, float* const* planes, size_t at,
+                         unsigned channels, size_t frames );
+typedef void (*JoinFn)( float const* const* planes, size_t at, float* out,
+                        unsigned channels, size_t frames );
+
+typedef struct SampleKernels {
+    raff_Simd level;
+    DecodeFn  decode[4];
+    EncodeFn  encode[4];
+    SplitFn   split;
+    JoinFn    join;
+} SampleKernels;
+
+static size_t const sampleWidths[4] = { 2, 3, 4, 4 };
+
+// Scale and largest value for encoding each type; 24 bit samples
+// are kept in the top of an int32 while decoding, so share the
+// int32 scale for that.
+#define SCALE16  32768.0f
+#define SCALE24  8388608.0f
+#define SCALE32  2147483648.0f
+#define MAX16    32767.0f
+#define MAX24    8388607.0f
+#define MAX32    2147483520.0f
+
+static raff_Simd simdLimit = raff_SIMD_AVX2;
+
+static int32_t
+encodeSample( float v, float scale, float max ) {
+    v *= scale;
+    if( !( v >= -scale ) )
+        v = -scale;
+    if( v > max )
+        v = max;
+    v += v < 0 ? -0.5f : 0.5f;
+    return (int32_t)v;
+}
+
+static void
+int16ToFloat( char const* in, float* out, size_t count ) {
+    unsigned char const* b = (unsigned char const*)in;
+    for( size_t i = 0 ; i < count ; i++ )
+        out[i] = (int16_t)( b[i*2] | b[i*2 + 1] << 8 ) * ( 1 / SCALE16 );
+}
+
+static void
+int24ToFloat( char const* in, float* out, size_t count ) {
+    unsigned char const* b = (unsigned char const*)in;
+    for( size_t i = 0 ; i < count ; i++ ) {
+        uint32_t v = (uint32_t)b[i*3] << 8 | (uint32_t)b[i*3 + 1] << 16 | (uint32_t)b[i*3 + 2] << 24;
+        out[i] = (int32_t)v * ( 1 / SCALE32 );
+    }
+}
+
+static void
+int32ToFloat( char const* in, float* out, size_t count ) {
+    unsigned char const* b = (unsigned char const*)in;
+    for( size_t i = 0 ; i < count ; i++ )
+        out[i] = (int32_t)decodeSize( b + i*4 ) * ( 1 / SCALE32 );
+}
+
+static void
+float32ToFloat( char const* in, float* out, size_t count ) {
+    unsigned char const* b = (unsigned char const*)in;
+    for( size_t i = 0 ; i < count ; i++ ) {
+        uint32_t v = (uint32_t)decodeSize( b + i*4 );
+        memcpy( &out[i], &v, 4 );
+    }
+}
+
+static void
+floatToInt16( float const* in, char* out, size_t count ) {
+    for( size_t i = 0 ; i < count ; i++ ) {
+        int32_t v = encodeSample( in[i], SCALE16, MAX16 );
+        out[i*2]     = v;
+        out[i*2 + 1] = v >> 8;
+    }
+}
+
+static void
+floatToInt24( float const* in, char* out, size_t count ) {
+    for( size_t i = 0 ; i < count ; i++ ) {
+        int32_t v = encodeSample( in[i], SCALE24, MAX24 );
+        out[i*3]     = v;
+        out[i*3 + 1] = v >> 8;
+        out[i*3 + 2] = v >> 16;
+    }
+}
+
+static void
+floatToInt32( float const* in, char* out, size_t count ) {
+    for( size_t i = 0 ; i < count ; i++ ) {
+        size_t at = i*4;
+        addSize( out, &at, (uint32_t)encodeSample( in[i], SCALE32, MAX32 ) );
+    }
+}
+
+static void
+floatToFloat32( float const* in, char* out, size_t count ) {
+    for( size_t i = 0 ; i < count ; i++ ) {
+        uint32_t v;
+        size_t   at = i*4;
+        memcpy( &v, &in[i], 4 );
+        addSize( out, &at, v );
+    }
+}
+
+static void
+splitFloats( float const* in, float* const* planes, size_t at,
+             unsigned channels, size_t frames ) {
+    for( unsigned c = 0 ; c < channels ; c++ ) {
+        float* plane = planes[c] + at;
+        for( size_t i = 0 ; i < frames ; i++ )
+            plane[i] = in[i*channels + c];
+    }
+}
+
+static void
+joinFloats( float const* const* planes, size_t at, float* out,
+            unsigned channels, size_t frames ) {
+    for( unsigned c = 0 ; c < channels ; c++ ) {
+        float const* plane = planes[c] + at;
+        for( size_t i = 0 ; i < frames ; i++ )
+            out[i*channels + c] = plane[i];
+    }
+}
+
+static SampleKernels const scalarKernels = {
+    raff_SIMD_NONE,
+    { int16ToFloat, int24ToFloat, int32ToFloat, float32ToFloat },
+    { floatToInt16, floatToInt24, floatToInt32, floatToFloat32 },
+    splitFloats,
+    joinFloats
+};
+
+#ifdef RAFF_SSE2
+// Clamps, scales, and rounds four floats like encodeSample().
+static __m128i
+encodeSse2( __m128 v, __m128 scale, __m128 max ) {
+    __m128 sign = _mm_castsi128_ps( _mm_set1_epi32( (int)0x80000000u ) );
+    v = _mm_mul_ps( v, scale );
+    v = _mm_max_ps( v, _mm_sub_ps( _mm_setzero_ps(), scale ) );
+    v = _mm_min_ps( v, max );
+    v = _mm_add_ps( v, _mm_or_ps( _mm_and_ps( v, sign ), _mm_set1_ps( 0.5f ) ) );
+    return _mm_cvttps_epi32( v );
+}
+
+static void
+int16ToFloatSse2( char const* in, float* out, size_t count ) {
+    __m128 scale = _mm_set1_ps( 1 / SCALE16 );
+    size_t i     = 0;
+    for( ; i + 8 <= count ; i += 8 ) {
+        __m128i v  = _mm_loadu_si128( (__m128i const*)( in + i*2 ) );
+        __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( v, v ), 16 );
+        __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( v, v ), 16 );
+        _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( lo ), scale ) );
+        _mm_storeu_ps( out + i + 4, _mm_mul_ps( _mm_cvtepi32_ps( hi ), scale ) );
+    }
+    int16ToFloat( in + i*2, out + i, count - i );
+}
+
+static void
+int32ToFloatSse2( char const* in, float* out, size_t count ) {
+    __m128 scale = _mm_set1_ps( 1 / SCALE32 );
+    size_t i     = 0;
+    for( ; i + 4 <= count ; i += 4 ) {
+        __m128i v = _mm_loadu_si128( (__m128i const*)( in + i*4 ) );
+        _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( v ), scale ) );
+    }
+    int32ToFloat( in + i*4, out + i, count - i );
+}
+
+static void
+float32ToFloatSse2( char const* in, float* out, size_t count ) {
+    memcpy( out, in, count*4 );
+}
+
+static void
+floatToInt16Sse2( float const* in, char* out, size_t count ) {
+    __m128 scale = _mm_set1_ps( SCALE16 );
+    __m128 max   = _mm_set1_ps( MAX16 );
+    size_t i     = 0;
+    for( ; i + 8 <= count ; i += 8 ) {
+        __m128i lo = encodeSse2( _mm_loadu_ps( in + i ), scale, max );
+        __m128i hi = encodeSse2( _mm_loadu_ps( in + i + 4 ), scale, max );
+        _mm_storeu_si128( (__m128i*)( out + i*2 ), _mm_packs_epi32( lo, hi ) );
+    }
+    floatToInt16( in + i, out + i*2, count - i );
+}
+
+static void
+floatToInt32Sse2( float const* in, char* out, size_t count ) {
+    __m128 scale = _mm_set1_ps( SCALE32 );
+    __m128 max   = _mm_set1_ps( MAX32 );
+    size_t i     = 0;
+    for( ; i + 4 <= count ; i += 4 )
+        _mm_storeu_si128( (__m128i*)( out + i*4 ), encodeSse2( _mm_loadu_ps( in + i ), scale, max ) );
+    floatToInt32( in + i, out + i*4, count - i );
+}
+
+static void
+floatToFloat32Sse2( float const* in, char* out, size_t count ) {
+    memcpy( out, in, count*4 );
+}
+
+static void
+splitFloatsSse2( float const* in, float* const* planes, size_t at,
+                 unsigned channels, size_t frames ) {
+    if( channels == 1 ) {
+        memcpy( planes[0] + at, in, frames*sizeof(float) );
+        return;
+    }
+    if( channels != 2 ) {
+        splitFloats( in, planes, at, channels, frames );
+        return;
+    }
+    
+    float* left  = planes[0] + at;
+    float* right = planes[1] + at;
+    size_t i     = 0;
+    for( ; i + 4 <= frames ; i += 4 ) {
+        __m128 a = _mm_loadu_ps( in + i*2 );
+        __m128 b = _mm_loadu_ps( in + i*2 + 4 );
+        _mm_storeu_ps( left + i, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+        _mm_storeu_ps( right + i, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+    }
+    splitFloats( in + i*2, planes, at + i, channels, frames - i );
+}
+
+static void
+joinFloatsSse2( float const* const* planes, size_t at, float* out,
+                unsigned channels, size_t frames ) {
+    if( channels == 1 ) {
+        memcpy( out, planes[0] + at, frames*sizeof(float) );
+        return;
+    }
+    if( channels != 2 ) {
+        joinFloats( planes, at, out, channels, frames );
+        return;
+    }
+    
+    float const* left  = planes[0] + at;
+    float const* right = planes[1] + at;
+    size_t       i     = 0;
+    for( ; i + 4 <= frames ; i += 4 ) {
+        __m128 l = _mm_loadu_ps( left + i );
+        __m128 r = _mm_loadu_ps( right + i );
+        _mm_storeu_ps( out + i*2, _mm_unpacklo_ps( l, r ) );
+        _mm_storeu_ps( out + i*2 + 4, _mm_unpackhi_ps( l, r ) );
+    }
+    joinFloats( planes, at + i, out + i*2, channels, frames - i );
+}
+
+// There's no byte shuffle before SSSE3, so 24 bit samples are
+// left to the scalar code.
+static SampleKernels const sse2Kernels = {
+    raff_SIMD_SSE2,
+    { int16ToFloatSse2, int24ToFloat, int32ToFloatSse2, float32ToFloatSse2 },
+    { floatToInt16Sse2, floatToInt24, floatToInt32Sse2, floatToFloat32Sse2 },
+    splitFloatsSse2,
+    joinFloatsSse2
+};
+#endif
+
+#ifdef RAFF_AVX2
+TARGET_AVX2 static __m256i
+encodeAvx2( __m256 v, __m256 scale, __m256 max ) {
+    __m256 sign = _mm256_castsi256_ps( _mm256_set1_epi32( (int)0x80000000u ) );
+    v = _mm256_mul_ps( v, scale );
+    v = _mm256_max_ps( v, _mm256_sub_ps( _mm256_setzero_ps(), scale ) );
+    v = _mm256_min_ps( v, max );
+    v = _mm256_add_ps( v, _mm256_or_ps( _mm256_and_ps( v, sign ), _mm256_set1_ps( 0.5f ) ) );
+    return _mm256_cvttps_epi32( v );
+}
+
+TARGET_AVX2 static void
+int16ToFloatAvx2( char const* in, float* out, size_t count ) {
+    __m256 scale = _mm256_set1_ps( 1 / SCALE16 );
+    size_t i     = 0;
+    for( ; i + 16 <= count ; i += 16 ) {
+        __m256i lo = _mm256_cvtepi16_epi32( _mm_loadu_si128( (__m128i const*)( in + i*2 ) ) );
+        __m256i hi = _mm256_cvtepi16_epi32( _mm_loadu_si128( (__m128i const*)( in + i*2 + 16 ) ) );
+        _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( lo ), scale ) );
+        _mm256_storeu_ps( out + i + 8, _mm256_mul_ps( _mm256_cvtepi32_ps( hi ), scale ) );
+    }
+    int16ToFloat( in + i*2, out + i, count - i );
+}
+
+// Eight samples are loaded as two overlapping 16 byte halves, of
+// which only 12 bytes each are used; so two more samples have to
+// follow for the loads to stay in bounds.
+TARGET_AVX2 static void
+int24ToFloatAvx2( char const* in, float* out, size_t count ) {
+    __m256  scale = _mm256_set1_ps( 1 / SCALE32 );
+    __m256i order = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11 );
+    size_t i = 0;
+    for( ; i + 10 <= count ; i += 8 ) {
+        __m128i lo = _mm_loadu_si128( (__m128i const*)( in + i*3 ) );
+        __m128i hi = _mm_loadu_si128( (__m128i const*)( in + i*3 + 12 ) );
+        __m256i v  = _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+        v = _mm256_shuffle_epi8( v, order );
+        _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( v ), scale ) );
+    }
+    int24ToFloat( in + i*3, out + i, count - i );
+}
+
+TARGET_AVX2 static void
+int32ToFloatAvx2( char const* in, float* out, size_t count ) {
+    __m256 scale = _mm256_set1_ps( 1 / SCALE32 );
+    size_t i     = 0;
+    for( ; i + 8 <= count ; i += 8 ) {
+        __m256i v = _mm256_loadu_si256( (__m256i const*)( in + i*4 ) );
+        _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( v ), scale ) );
+    }
+    int32ToFloat( in + i*4, out + i, count - i );
+}
+
+TARGET_AVX2 static void
+floatToInt16Avx2( float const* in, char* out, size_t count ) {
+    __m256 scale = _mm256_set1_ps( SCALE16 );
+    __m256 max   = _mm256_set1_ps( MAX16 );
+    size_t i     = 0;
+    for( ; i + 16 <= count ; i += 16 ) {
+        __m256i lo = encodeAvx2( _mm256_loadu_ps( in + i ), scale, max );
+        __m256i hi = encodeAvx2( _mm256_loadu_ps( in + i + 8 ), scale, max );
+        
+        // Packing works within each 128 bit lane, so the middle
+        // quarters come out swapped.
+        __m256i v = _mm256_permute4x64_epi64( _mm256_packs_epi32( lo, hi ), 0xD8 );
+        _mm256_storeu_si256( (__m256i*)( out + i*2 ), v );
+    }
+    floatToInt16( in + i, out + i*2, count - i );
+}
+
+// Like int24ToFloatAvx2(), eight samples are stored as two
+// overlapping 16 byte halves; the last four bytes of each half
+// are overwritten by what comes next, so two more samples have to
+// follow.
+TARGET_AVX2 static void
+floatToInt24Avx2( float const* in, char* out, size_t count ) {
+    __m256  scale = _mm256_set1_ps( SCALE24 );
+    __m256  max   = _mm256_set1_ps( MAX24 );
+    __m256i order = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+    size_t i = 0;
+    for( ; i + 10 <= count ; i += 8 ) {
+        __m256i v = _mm256_shuffle_epi8( encodeAvx2( _mm256_loadu_ps( in + i ), scale, max ), order );
+        _mm_storeu_si128( (__m128i*)( out + i*3 ), _mm256_castsi256_si128( v ) );
+        _mm_storeu_si128( (__m128i*)( out + i*3 + 12 ), _mm256_extracti128_si256( v, 1 ) );
+    }
+    floatToInt24( in + i, out + i*3, count - i );
+}
+
+TARGET_AVX2 static void
+floatToInt32Avx2( float const* in, char* out, size_t count ) {
+    __m256 scale = _mm256_set1_ps( SCALE32 );
+    __m256 max   = _mm256_set1_ps( MAX32 );
+    size_t i     = 0;
+    for( ; i + 8 <= count ; i += 8 )
+        _mm256_storeu_si256( (__m256i*)( out + i*4 ), encodeAvx2( _mm256_loadu_ps( in + i ), scale, max ) );
+    floatToInt32( in + i, out + i*4, count - i );
+}
+
+TARGET_AVX2 static void
+splitFloatsAvx2( float const* in, float* const* planes, size_t at,
+                 unsigned channels, size_t frames ) {
+    if( channels != 2 ) {
+        splitFloatsSse2( in, planes, at, channels, frames );
+        return;
+    }
+    
+    float* left  = planes[0] + at;
+    float* right = planes[1] + at;
+    size_t i     = 0;
+    for( ; i + 8 <= frames ; i += 8 ) {
+        __m256 a = _mm256_loadu_ps( in + i*2 );
+        __m256 b = _mm256_loadu_ps( in + i*2 + 8 );
+        
+        // Shuffling works within each 128 bit lane, so the middle
+        // quarters come out swapped.
+        __m256 l = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+        __m256 r = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+        l = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( l ), 0xD8 ) );
+        r = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( r ), 0xD8 ) );
+        _mm256_storeu_ps( left + i, l );
+        _mm256_storeu_ps( right + i, r );
+    }
+    splitFloatsSse2( in + i*2, planes, at + i, channels, frames - i );
+}
+
+TARGET_AVX2 static void
+joinFloatsAvx2( float const* const* planes, size_t at, float* out,
+                unsigned channels, size_t frames ) {
+    if( channels != 2 ) {
+        joinFloatsSse2( planes, at, out, channels, frames );
+        return;
+    }
+    
+    float const* left  = planes[0] + at;
+    float const* right = planes[1] + at;
+    size_t       i     = 0;
+    for( ; i + 8 <= frames ; i += 8 ) {
+        __m256 l  = _mm256_loadu_ps( left + i );
+        __m256 r  = _mm256_loadu_ps( right + i );
+        __m256 lo = _mm256_unpacklo_ps( l, r );
+        __m256 hi = _mm256_unpackhi_ps( l, r );
+        _mm256_storeu_ps( out + i*2, _mm256_permute2f128_ps( lo, hi, 0x20 ) );
+        _mm256_storeu_ps( out + i*2 + 8, _mm256_permute2f128_ps( lo, hi, 0x31 ) );
+    }
+    joinFloatsSse2( planes, at + i, out + i*2, channels, frames - i );
+}
+
+static SampleKernels const avx2Kernels = {
+    raff_SIMD_AVX2,
+    { int16ToFloatAvx2, int24ToFloatAvx2, int32ToFloatAvx2, float32ToFloatSse2 },
+    { floatToInt16Avx2, floatToInt24Avx2, floatToInt32Avx2, floatToFloat32Sse2 },
+    splitFloatsAvx2,
+    joinFloatsAvx2
+};
+#endif
+
+// Picks the best kernels the CPU has, up to the limit set by
+// raff_setSimd().
+static SampleKernels const*
+sampleKernels( void ) {
+#ifdef RAFF_AVX2
+    if( simdLimit >= raff_SIMD_AVX2 && __builtin_cpu_supports( "avx2" ) )
+        return &avx2Kernels;
+#endif
+#ifdef RAFF_SSE2
+    if( simdLimit >= raff_SIMD_SSE2 )
+        return &sse2Kernels;
+#endif
+    return &scalarKernels;
+}
+
+raff_Simd
+raff_setSimd( raff_Simd level ) {
+    simdLimit = level;
+    return sampleKernels()->level;
+}
+
+// Converts frames to planar floats, into the planes from frame at
+// on.  Mono frames are converted straight into their plane, the
+// rest through a block sized buffer.
+static void
+toPlanar( raff_SampleType type, unsigned channels, char const* in,
+          float* const* planes, size_t at, size_t frames ) {
+    SampleKernels const* k = sampleKernels();
+    if( channels == 1 ) {
+        k->decode[type]( in, planes[0] + at, frames );
+        return;
+    }
+    
+    float  block[CONVERT_BLOCK];
+    float* buf   = channels > CONVERT_BLOCK ? malloc( channels*sizeof(float) ) : block;
+    size_t step  = channels > CONVERT_BLOCK ? 1 : CONVERT_BLOCK / channels;
+    size_t width = sampleWidths[type]*channels;
+    for( size_t done = 0 ; done < frames ; done += step ) {
+        size_t n = frames - done < step ? frames - done : step;
+        k->decode[type]( in + done*width, buf, n*channels );
+        k->split( buf, planes, at + done, channels, n );
+    }
+    if( buf != block )
+        free( buf );
+}
+
+static void
+fromPlanar( raff_SampleType type, unsigned channels, float const* const* planes,
+            char* out, size_t frames ) {
+    SampleKernels const* k = sampleKernels();
+    if( channels == 1 ) {
+        k->encode[type]( planes[0], out, frames );
+        return;
+    }
+    
+    float  block[CONVERT_BLOCK];
+    float* buf   = channels > CONVERT_BLOCK ? malloc( channels*sizeof(float) ) : block;
+    size_t step  = channels > CONVERT_BLOCK ? 1 : CONVERT_BLOCK / channels;
+    size_t width = sampleWidths[type]*channels;
+    for( size_t done = 0 ; done < frames ; done += step ) {
+        size_t n = frames - done < step ? frames - done : step;
+        k->join( planes, done, buf, channels, n );
+        k->encode[type]( buf, out + done*width, n*channels );
+    }
+    if( buf != block )
+        free( buf );
+}
+
+size_t
+raff_sampleWidth( raff_SampleType type ) {
+    return sampleWidths[type];
+}
+
+void
+raff_samplesToPlanar( raff_SampleType type, unsigned channels, char const* in,
+                      float* const* planes, size_t frames ) {
+    toPlanar( type, channels, in, planes, 0, frames );
+}
+
+void
+raff_samplesFromPlanar( raff_SampleType type, unsigned channels,
+                        float const* const* planes, char* out, size_t frames ) {
+    fromPlanar( type, channels, planes, out, frames );
+}
+
+bool
+raff_waveSampleType( raff_Wave* wave, raff_SampleType* type ) {
+    raff_WaveFormat const* f = &wave->format;
+    if( f->format == 1 && f->bitsPerSample == 16 )
+        *type = raff_SAMPLE_INT16;
+    else
+    if( f->format == 1 && f->bitsPerSample == 24 )
+        *type = raff_SAMPLE_INT24;
+    else
+    if( f->format == 1 && f->bitsPerSample == 32 )
+        *type = raff_SAMPLE_INT32;
+    else
+    if( f->format == 3 && f->bitsPerSample == 32 )
+        *type = raff_SAMPLE_FLOAT32;
+    else
+        return false;
+    
+    // Samples have to be packed for the kernels.
+    return f->blockAlign == sampleWidths[*type]*f->channels;
+}
+
+raff_Error
+raff_waveToPlanar( raff_Wave* wave, raff_WaveSlice const* slice, float* const* planes ) {
+    raff_SampleType type;
+    if( !raff_waveSampleType( wave, &type ) ) {
+        errnum = raff_ERR_BAD_FORMAT;
+        return errnum;
+    }
+    
+    unsigned channels = wave->format.channels;
+    if( slice->content ) {
+        toPlanar( type, channels, slice->content, planes, 0, slice->count );
+        errnum = raff_ERR_NONE;
+        return errnum;
+    }
+    
+    // Otherwise the frames are read a block at a time.
+    size_t align = wave->format.blockAlign;
+    size_t step  = align > 16384 ? 1 : 16384 / align;
+    char*  buf   = malloc( step*align );
+    errnum = raff_ERR_NONE;
+    for( size_t done = 0 ; done < slice->count ; done += step ) {
+        size_t n = slice->count - done < step ? slice->count - done : step;
+        if( raff_waveRead( wave, slice, done*align, buf, n*align ) != n*align ) {
+            errnum = raff_ERR_CORRUPT;
+            break;
+        }
+        toPlanar( type, channels, buf, planes, done, n );
+    }
+    free( buf );
+    return errnum;
+}
+
+raff_Data*
+raff_newSampleData( raff_File* file, raff_ID id, raff_SampleType type,
+                    unsigned channels, float const* const* planes, size_t frames ) {
+    raff_Data* data = alloc( file, sizeof(raff_Data) );
+    data->file    = file;
+    data->id      = id;
+    data->size    = frames*channels*sampleWidths[type];
+    data->start   = alloc( file, data->size );
+    data->asChunk = NULL;
+    
+    fromPlanar( type, channels, planes, data->start, frames );
+    return data;
+}
+
+void
+raff_fileStats( raff_File* file, raff_Stats* stats ) {
+#ifdef RAFF_STATS
+    *stats = file->arena.stats;
+#else
+    (void)file;
+    memset( stats, 0, sizeof(raff_Stats) );
+#endif
+}
+
+void
+raff_globalStats( raff_Stats* stats ) {
+#ifdef RAFF_STATS
+    stats->bytesRead       = ATOMIC_GET( globalStats.bytesRead );
+    stats->streamCalls     = ATOMIC_GET( globalStats.streamCalls );
+    stats->allocs          = ATOMIC_GET( globalStats.allocs );
+    stats->allocBytes      = ATOMIC_GET( globalStats.allocBytes );
+    stats->chunksParsed    = ATOMIC_GET( globalStats.chunksParsed );
+    stats->listsParsed     = ATOMIC_GET( globalStats.listsParsed );
+    stats->bytesSerialized = ATOMIC_GET( globalStats.bytesSerialized );
+    stats->openTime        = ATOMIC_GET( globalStats.openTime );
+    stats->parseTime       = ATOMIC_GET( globalStats.parseTime );
+    stats->serializeTime   = ATOMIC_GET( globalStats.serializeTime );
+#else
+    memset( stats, 0, sizeof(raff_Stats) );
+#endif
+}
+
+void
+raff_setHooks( raff_Hook newHook, void* user ) {
+#ifdef RAFF_STATS
+    hook     = newHook;
+    hookUser = user;
+#else
+    (void)newHook;
+    (void)user;
+#endif
+}
+
+// A push parser works through the bytes it's fed a step at a time,
+// keeping only what it needs to pick up where it left off: the
+// header bytes gathered so far, the chunk whose content is coming
+// in, and the lists still open.
+typedef enum PushState {
+    PUSH_HEAD,
+    PUSH_CONTENT,
+    PUSH_PAD,
+    PUSH_DS64,
+    PUSH_DONE
+} PushState;
+
+typedef struct PushList {
+    raff_Visit         visit;
+    unsigned long long end;
+} PushList;
+
+struct raff_Parser {
+    raff_PushHandler   handler;
+    void*              user;
+    PushState          state;
+    raff_Error         err;
+    bool               stopped;
+    unsigned long long pos;
+    
+    unsigned char      head[12];
+    size_t             headSize;
+    
+    // The chunk whose content is coming in, or list being skipped;
+    // and how much of its content and padding is still to come.
+    raff_Visit         chunk;
+    size_t             done;
+    size_t             left;
+    size_t             pad;
+    bool               quiet;
+    
+    PushList*          lists;
+    size_t             depth;
+    size_t             capacity;
+    
+    // RF64 files can't be parsed until their ds64 chunk is in, so
+    // until then the bytes are kept here; then fed again.
+    Ds64*              ds64;
+    char*              pre;
+    size_t             preSize;
+};
+
+static void parserFeed( raff_Parser* parser, char const* buf, size_t size );
+
+raff_Parser*
+raff_newParser( raff_PushHandler handler, void* user ) {
+    raff_Parser* parser = malloc( sizeof(raff_Parser) );
+    parser->handler  = handler;
+    parser->user     = user;
+    parser->state    = PUSH_HEAD;
+    parser->err      = raff_ERR_NONE;
+    parser->stopped  = false;
+    parser->pos      = 0;
+    parser->headSize = 0;
+    parser->lists    = NULL;
+    parser->depth    = 0;
+    parser->capacity = 0;
+    parser->ds64     = NULL;
+    parser->pre      = NULL;
+    parser->preSize  = 0;
+    return parser;
+}
+
+// Calls the handler, returning what it wants done; and if that's
+// to stop, then stops.
+static raff_WalkAction
+pushEvent( raff_Parser* parser, raff_PushKind kind, raff_Visit const* chunk,
+           char const* piece, size_t size, size_t offset ) {
+    raff_PushEvent event;
+    event.kind        = kind;
+    event.chunk       = *chunk;
+    event.piece       = piece;
+    event.pieceSize   = size;
+    event.pieceOffset = offset;
+    
+    raff_WalkAction action = parser->handler( &event, parser->user );
+    if( action == raff_WALK_STOP ) {
+        parser->stopped = true;
+        parser->state   = PUSH_DONE;
+    }
+    return action;
+}
+
+static void
+pushFail( raff_Parser* parser, raff_Error err ) {
+    parser->err   = err;
+    parser->state = PUSH_DONE;
+}
+
+// Ends the lists whose content is all in, the innermost first,
+// until one has padding to come.
+static void
+pushEndLists( raff_Parser* parser ) {
+    while( parser->depth > 0 && parser->lists[parser->depth - 1].end == parser->pos ) {
+        PushList* list = &parser->lists[--parser->depth];
+        if( pushEvent( parser, raff_PUSH_END, &list->visit, NULL, 0, 0 ) == raff_WALK_STOP )
+            return;
+        if( parser->depth == 0 ) {
+            parser->state = PUSH_DONE;
+            return;
+        }
+        
+        parser->state = PUSH_HEAD;
+        if( list->visit.size % 2 ) {
+            parser->pad   = 1;
+            parser->state = PUSH_PAD;
+            return;
+        }
+    }
+}
+
+// Ends the chunk whose content was coming in, once it all has.
+static void
+pushEndChunk( raff_Parser* parser ) {
+    if( pushEvent( parser, raff_PUSH_END, &parser->chunk, NULL, 0, 0 ) == raff_WALK_STOP )
+        return;
+    if( parser->chunk.depth == 0 ) {
+        parser->state = PUSH_DONE;
+        return;
+    }
+    
+    parser->pad   = parser->chunk.size % 2;
+    parser->state = parser->pad ? PUSH_PAD : PUSH_HEAD;
+    if( !parser->pad )
+        pushEndLists( parser );
+}
+
+// Starts the RIFF chunk, from its 12 byte header.
+static void
+pushRoot( raff_Parser* parser ) {
+    raff_ID id   = decodeID( parser->head );
+    size_t  size = decodeSize( parser->head + 4 );
+    if( id != RIFF_ID && id != RF64_ID && id != BW64_ID ) {
+        pushFail( parser, raff_ERR_NOT_RIFF );
+        return;
+    }
+    
+    // The size of an RF64 file is in the ds64 chunk that has to
+    // come next; so that's gathered before going on.
+    if( id != RIFF_ID ) {
+        if( !parser->ds64 ) {
+            parser->pre     = malloc( 20 );
+            parser->preSize = 12;
+            memcpy( parser->pre, parser->head, 12 );
+            parser->state = PUSH_DS64;
+            return;
+        }
+        if( parser->ds64->riffSize > SIZE_MAX ) {
+            pushFail( parser, raff_ERR_CORRUPT );
+            return;
+        }
+        size = parser->ds64->riffSize;
+    }
+    
+    // The end of the root is worked out from the size, which for
+    // RF64 can be anything; so it has to be checked it can be.
+    if( size < 4 || size - 4 > ULLONG_MAX - parser->pos ) {
+        pushFail( parser, raff_ERR_CORRUPT );
+        return;
+    }
+    
+    raff_Visit visit;
+    visit.depth   = 0;
+    visit.list    = true;
+    visit.riff    = true;
+    visit.id      = decodeID( parser->head + 8 );
+    visit.size    = size - 4;
+    visit.offset  = parser->pos;
+    visit.content = NULL;
+    
+    parser->capacity = 8;
+    parser->lists    = malloc( parser->capacity*sizeof(PushList) );
+    parser->lists[0].visit = visit;
+    parser->lists[0].end   = parser->pos + visit.size;
+    parser->depth = 1;
+    
+    if( pushEvent( parser, raff_PUSH_BEGIN, &visit, NULL, 0, 0 ) == raff_WALK_SKIP ) {
+        parser->depth = 0;
+        parser->chunk = visit;
+        parser->done  = 0;
+        parser->left  = visit.size;
+        parser->quiet = true;
+        parser->state = PUSH_CONTENT;
+    }
+    if( parser->state == PUSH_HEAD )
+        pushEndLists( parser );
+}
+
+// Starts a chunk in the innermost open list, from its header.
+static void
+pushChunk( raff_Parser* parser ) {
+    PushList* parent = &parser->lists[parser->depth - 1];
+    raff_ID   id     = decodeID( parser->head );
+    size_t    size   = ds64Size( parser->ds64, id, decodeSize( parser->head + 4 ) );
+    
+    raff_Visit visit;
+    visit.depth   = parser->depth;
+    visit.list    = id == LIST_ID || id == RIFF_ID;
+    visit.riff    = id == RIFF_ID;
+    visit.id      = visit.list ? decodeID( parser->head + 8 ) : id;
+    visit.size    = visit.list ? size - 4 : size;
+    visit.offset  = parser->pos;
+    visit.content = NULL;
+    
+    // Like parseNextHead(), the chunk and its padding have to fit
+    // in the list.
+    unsigned long long room = parser->pos <= parent->end ? parent->end - parser->pos : 0;
+    if( parser->pos > parent->end || ( visit.list && size < 4 ) ||
+        visit.size > room || visit.size % 2 > room - visit.size ) {
+        pushFail( parser, raff_ERR_CORRUPT );
+        return;
+    }
+    
+    raff_WalkAction action = pushEvent( parser, raff_PUSH_BEGIN, &visit, NULL, 0, 0 );
+    if( action == raff_WALK_STOP )
+        return;
+    
+    if( visit.list && action != raff_WALK_SKIP ) {
+        if( parser->depth == parser->capacity ) {
+            parser->capacity *= 2;
+            parser->lists     = realloc( parser->lists, parser->capacity*sizeof(PushList) );
+        }
+        parser->lists[parser->depth].visit = visit;
+        parser->lists[parser->depth].end   = parser->pos + visit.size;
+        parser->depth++;
+        pushEndLists( parser );
+        return;
+    }
+    
+    parser->chunk = visit;
+    parser->done  = 0;
+    parser->left  = visit.size;
+    parser->quiet = visit.list || action == raff_WALK_SKIP;
+    parser->state = PUSH_CONTENT;
+    if( visit.size == 0 )
+        pushEndChunk( parser );
+}
+
+// Gathers the ds64 chunk of an RF64 file, then parses it and feeds
+// everything so far through again.  Returns how much was used.
+static size_t
+pushDs64( raff_Parser* parser, char const* buf, size_t size ) {
+    // Its header comes first, which gives the size of the rest.
+    size_t want = 20;
+    if( parser->preSize >= 20 ) {
+        unsigned char const* b    = (unsigned char const*)parser->pre + 12;
+        size_t               ds64 = decodeSize( b + 4 );
+        if( decodeID( b ) != DS64_ID || ds64 < 28 || ds64 > MAX_DS64_SIZE ) {
+            pushFail( parser, raff_ERR_CORRUPT );
+            return 0;
+        }
+        
+        want += ds64 + ds64 % 2;
+        if( parser->preSize == 20 )
+            parser->pre = realloc( parser->pre, want );
+    }
+    
+    size_t n = want - parser->preSize;
+    if( n > size )
+        n = size;
+    memcpy( parser->pre + parser->preSize, buf, n );
+    parser->preSize += n;
+    if( parser->preSize < want || want == 20 )
+        return n;
+    
+    parser->ds64 = parseDs64( (unsigned char*)parser->pre + 20, decodeSize( (unsigned char*)parser->pre + 16 ) );
+    if( !parser->ds64 || parser->ds64->riffSize < 4 ) {
+        pushFail( parser, raff_ERR_CORRUPT );
+        return n;
+    }
+    
+    char*  pre     = parser->pre;
+    size_t preSize = parser->preSize;
+    parser->pre      = NULL;
+    parser->preSize  = 0;
+    parser->pos      = 0;
+    parser->headSize = 0;
+    parser->state    = PUSH_HEAD;
+    parserFeed( parser, pre, preSize );
+    free( pre );
+    return n;
+}
+
+// Size of the header being gathered, as far as can be told from
+// what's in; lists, and the RIFF chunk, have their type after the
+// size.
+static size_t
+headWant( raff_Parser* parser ) {
+    if( parser->depth == 0 )
+        return 12;
+    if( parser->headSize < 4 )
+        return 8;
+    
+    raff_ID id = decodeID( parser->head );
+    return id == LIST_ID || id == RIFF_ID ? 12 : 8;
+}
+
+static void
+parserFeed( raff_Parser* parser, char const* buf, size_t size ) {
+    while( size > 0 && parser->state != PUSH_DONE ) {
+        size_t n;
+        switch( parser->state ) {
+            case PUSH_HEAD:
+                n = headWant( parser ) - parser->headSize;
+                if( n > size )
+                    n = size;
+                memcpy( parser->head + parser->headSize, buf, n );
+                parser->headSize += n;
+                parser->pos      += n;
+                if( parser->headSize < headWant( parser ) )
+                    break;
+                
+                parser->headSize = 0;
+                if( parser->depth == 0 )
+                    pushRoot( parser );
+                else
+                    pushChunk( parser );
+                break;
+            case PUSH_CONTENT:
+                n = parser->left < size ? parser->left : size;
+                if( !parser->quiet && pushEvent( parser, raff_PUSH_CONTENT, &parser->chunk,
+                                                 buf, n, parser->done ) == raff_WALK_SKIP )
+                    parser->quiet = true;
+                parser->done += n;
+                parser->left -= n;
+                parser->pos  += n;
+                if( parser->left == 0 && parser->state == PUSH_CONTENT )
+                    pushEndChunk( parser );
+                break;
+            case PUSH_PAD:
+                n = parser->pad < size ? parser->pad : size;
+                parser->pad -= n;
+                parser->pos += n;
+                if( parser->pad == 0 ) {
+                    parser->state = PUSH_HEAD;
+                    pushEndLists( parser );
+                }
+                break;
+            case PUSH_DS64:
+                n = pushDs64( parser, buf, size );
+                break;
+            default:
+                n = size;
+                break;
+        }
+        buf  += n;
+        size -= n;
+    }
+}
+
+raff_Error
+raff_parserFeed( raff_Parser* parser, char const* buf, size_t size ) {
+    parserFeed( parser, buf, size );
+    errnum = parser->err;
+    return errnum;
+}
+
+raff_Error
+raff_closeParser( raff_Parser* parser ) {
+    errnum = parser->err;
+    if( errnum == raff_ERR_NONE && !parser->stopped && parser->state != PUSH_DONE )
+        errnum = raff_ERR_CORRUPT;
+    
+    free( parser->lists );
+    free( parser->ds64 );
+    free( parser->pre );
+    free( parser );
+    return errnum;
+}
+
+// An index holds the child tables of every list in a file, so the
+// file can be opened lazily with its lists already parsed.  After
+// a header it has a record for each list, in the order they're
+// found walking the tree depth first: a 64 bit count, then the
+// IDs, types, sizes, and offsets of the list's chunks; each field
+// in an array of its own, as in memory, so they're read straight
+// into the tables.  Numbers are in the byte order of the machine
+// that wrote the index, which is checked along with the version.
+#define INDEX_VERSION    2
+#define INDEX_ORDER      0x01020304
+#define INDEX_HEAD_SIZE  48
+
+// Finds the size and modification time of a file, to tell if it's
+// changed since it was indexed; the time in seconds and the
+// nanoseconds past that, since files can be changed many times a
+// second.  Without stat() only the size is known, and the time
+// is 0.
+static bool
+sourceStamp( char const* path, uint64_t* size, int64_t* mtime, int64_t* nsec ) {
+#ifdef RAFF_POSIX
+    struct stat st;
+    if( stat( path, &st ) != 0 )
+        return false;
+    
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
+#if defined(__APPLE__)
+    *nsec  = st.st_mtimespec.tv_nsec;
+#else
+    *nsec  = st.st_mtim.tv_nsec;
+#endif
+    return true;
+#else
+    FILE* f = fopen( path, "rb" );
+    if( !f )
+        return false;
+    
+    bool ok = _fseeki64( f, 0, SEEK_END ) == 0;
+    *size  = ok ? _ftelli64( f ) : 0;
+    *mtime = 0;
+    *nsec  = 0;
+    fclose( f );
+    return ok;
+#endif
+}
+
+static void
+encodeIndexHead( char* head, uint32_t rootID, uint64_t rootSize,
+                 uint64_t sourceSize, int64_t sourceTime, int64_t sourceNsec ) {
+    uint32_t version = INDEX_VERSION;
+    uint32_t order   = INDEX_ORDER;
+    memcpy( head, "RAFX", 4 );
+    memcpy( head + 4, &version, 4 );
+    memcpy( head + 8, &order, 4 );
+    memcpy( head + 12, &rootID, 4 );
+    memcpy( head + 16, &rootSize, 8 );
+    memcpy( head + 24, &sourceSize, 8 );
+    memcpy( head + 32, &sourceTime, 8 );
+    memcpy( head + 40, &sourceNsec, 8 );
+}
+
+// Writes a list's record.
+static bool
+saveRecord( FILE* out, raff_List* list ) {
+    // Lists that have been linked, by being appended to in place,
+    // have their table put together from their chunks.
+    uint64_t    count = list->count;
+    ChildTable* table = list->table;
+    ChildTable  tmp;
+    if( !table ) {
+        tmp.ids     = malloc( count*sizeof(uint32_t) + 1 );
+        tmp.types   = malloc( count + 1 );
+        tmp.sizes   = malloc( count*sizeof(size_t) + 1 );
+        tmp.offsets = malloc( count*sizeof(unsigned long long) + 1 );
+        
+        size_t i = 0;
+        for( raff_Chunk* iter = list->first ; iter ; iter = iter->next, i++ ) {
+            tmp.ids[i]     = (uint32_t)iter->id;
+            tmp.types[i]   = iter->type;
+            tmp.sizes[i]   = iter->size;
+            tmp.offsets[i] = iter->offset;
+        }
+        table = &tmp;
+    }
+    
+    bool ok = fwrite( &count, 8, 1, out ) == 1 &&
+              fwrite( table->ids, sizeof(uint32_t), count, out ) == count &&
+              fwrite( table->types, 1, count, out ) == count &&
+              fwrite( table->offsets, 8, count, out ) == count;
+#if SIZE_MAX == UINT64_MAX
+    ok = ok && fwrite( table->sizes, 8, count, out ) == count;
+#else
+    for( size_t i = 0 ; ok && i < count ; i++ ) {
+        uint64_t size = table->sizes[i];
+        ok = fwrite( &size, 8, 1, out ) == 1;
+    }
+#endif
+    
+    if( table == &tmp ) {
+        free( tmp.ids );
+        free( tmp.types );
+        free( tmp.sizes );
+        free( tmp.offsets );
+    }
+    
+    return ok;
+}
+
+// A list whose records are being written or read, and where the
+// next of the lists in it is; the entry of its child table, or
+// chunk if it's linked.  They're kept on a stack rather than
+// recursed into, so however deep lists nest they can't run out
+// of stack.
+typedef struct IndexFrame {
+    raff_List*  list;
+    size_t      next;
+    raff_Chunk* iter;
+} IndexFrame;
+
+static IndexFrame*
+pushIndexFrame( IndexFrame* frames, size_t* depth, size_t* capacity, raff_List* list ) {
+    if( *depth == *capacity ) {
+        *capacity = *capacity ? *capacity*2 : 8;
+        frames    = realloc( frames, *capacity*sizeof(IndexFrame) );
+    }
+    IndexFrame* frame = &frames[(*depth)++];
+    frame->list = list;
+    frame->next = 0;
+    frame->iter = list->first;
+    return frames;
+}
+
+// Gives the next list in a list whose records are being written or
+// read, or NULL once there are no more.
+static raff_Chunk*
+nextIndexList( IndexFrame* frame ) {
+    raff_List* list = frame->list;
+    if( list->table ) {
+        for( ; frame->next < list->count ; frame->next++ ) {
+            if( list->table->types[frame->next] != TYPE_OTHER )
+                return childAt( list, frame->next++, &list->file->arena );
+        }
+        return NULL;
+    }
+    
+    while( frame->iter && frame->iter->type == TYPE_OTHER )
+        frame->iter = frame->iter->next;
+    raff_Chunk* chunk = frame->iter;
+    if( chunk )
+        frame->iter = chunk->next;
+    return chunk;
+}
+
+// Writes a list's record, then those of the lists in it.
+static raff_Error
+saveList( FILE* out, raff_Chunk* chunk ) {
+    raff_List* list = raff_chunkAsList( chunk );
+    if( !list )
+        return errnum;
+    if( !saveRecord( out, list ) )
+        return raff_ERR_CANT_WRITE;
+    
+    IndexFrame* frames   = NULL;
+    size_t      depth    = 0;
+    size_t      capacity = 0;
+    frames = pushIndexFrame( frames, &depth, &capacity, list );
+    
+    raff_Error err = raff_ERR_NONE;
+    while( depth > 0 ) {
+        chunk = nextIndexList( &frames[depth - 1] );
+        if( !chunk ) {
+            depth--;
+            continue;
+        }
+        
+        list = raff_chunkAsList( chunk );
+        if( !list ) {
+            err = errnum;
+            break;
+        }
+        if( !saveRecord( out, list ) ) {
+            err = raff_ERR_CANT_WRITE;
+            break;
+        }
+        frames = pushIndexFrame( frames, &depth, &capacity, list );
+    }
+    
+    free( frames );
+    return err;
+}
+
+raff_Error
+raff_saveIndex( raff_File* file, char const* indexPath ) {
+    uint64_t sourceSize;
+    int64_t  sourceTime;
+    int64_t  sourceNsec;
+    if( !file->path || !file->chunk ||
+        !sourceStamp( file->path, &sourceSize, &sourceTime, &sourceNsec ) ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return errnum;
+    }
+    
+    // Written beside the index and moved over it once complete,
+    // so anyone opening the index at the same time sees the old
+    // one or the new, never half of one.
+    size_t len     = strlen( indexPath );
+    char*  tmpPath = malloc( len + 5 );
+    memcpy( tmpPath, indexPath, len );
+    memcpy( tmpPath + len, ".tmp", 5 );
+    
+    FILE* out = fopen( tmpPath, "wb" );
+    if( !out ) {
+        free( tmpPath );
+        errnum = raff_ERR_CANT_WRITE;
+        return errnum;
+    }
+    
+    char head[INDEX_HEAD_SIZE];
+    encodeIndexHead( head, (uint32_t)file->chunk->id, file->chunk->size,
+                     sourceSize, sourceTime, sourceNsec );
+    raff_Error err = raff_ERR_CANT_WRITE;
+    if( fwrite( head, 1, INDEX_HEAD_SIZE, out ) == INDEX_HEAD_SIZE )
+        err = saveList( out, file->chunk );
+    if( fclose( out ) != 0 && err == raff_ERR_NONE )
+        err = raff_ERR_CANT_WRITE;
+    if( err == raff_ERR_NONE && rename( tmpPath, indexPath ) != 0 )
+        err = raff_ERR_CANT_WRITE;
+    if( err != raff_ERR_NONE )
+        remove( tmpPath );
+    
+    free( tmpPath );
+    errnum = err;
+    return errnum;
+}
+
+// Reads a list's record into a child table.  Every chunk has to
+// fit in the list, so a broken index can't send reads outside it.
+// Returns NULL if the record's broken.
+static raff_List*
+loadRecord( FILE* in, raff_Chunk* chunk ) {
+    raff_File* file  = chunk->file;
+    Arena*     arena = &file->arena;
+    uint64_t   count;
+    if( fread( &count, 8, 1, in ) != 1 || count > chunk->size / 8 )
+        return NULL;
+    
+    ChildTable* table = arenaAlloc( arena, sizeof(ChildTable) );
+    table->ids        = arenaAlloc( arena, count*sizeof(uint32_t) );
+    table->types      = arenaAlloc( arena, count );
+    table->sizes      = arenaAlloc( arena, count*sizeof(size_t) );
+    table->offsets    = arenaAlloc( arena, count*sizeof(unsigned long long) );
+    table->handles    = NULL;
+    table->base       = NULL;
+    table->baseOffset = chunk->offset;
+    table->cursor     = 0;
+    
+    bool ok = fread( table->ids, sizeof(uint32_t), count, in ) == count &&
+              fread( table->types, 1, count, in ) == count &&
+              fread( table->offsets, 8, count, in ) == count;
+#if SIZE_MAX == UINT64_MAX
+    ok = ok && fread( table->sizes, 8, count, in ) == count;
+#else
+    for( size_t i = 0 ; ok && i < count ; i++ ) {
+        uint64_t size;
+        ok = fread( &size, 8, 1, in ) == 1 && size <= SIZE_MAX;
+        table->sizes[i] = ok ? size : 0;
+    }
+#endif
+    
+    unsigned long long end = chunk->offset + chunk->size;
+    for( size_t i = 0 ; ok && i < count ; i++ ) {
+        unsigned long long head = table->types[i] == TYPE_OTHER ? 8 : 12;
+        ok = table->types[i] <= TYPE_OTHER &&
+             table->offsets[i] >= chunk->offset + head &&
+             table->offsets[i] <= end &&
+             table->sizes[i] <= end - table->offsets[i];
+    }
+    if( !ok )
+        return NULL;
+    
+    raff_List* list = arenaAlloc( arena, sizeof(raff_List) );
+    list->file    = file;
+    list->id      = chunk->id;
+    list->asChunk = chunk;
+    list->cursor  = NULL;
+    list->first   = NULL;
+    list->last    = NULL;
+    list->count   = count;
+    list->table   = table;
+    list->index   = NULL;
+    chunk->asList = list;
+    
+    return list;
+}
+
+// Reads a list's record, then those of the lists in it.
+static bool
+loadList( FILE* in, raff_Chunk* chunk ) {
+    raff_List* list = loadRecord( in, chunk );
+    if( !list )
+        return false;
+    
+    IndexFrame* frames   = NULL;
+    size_t      depth    = 0;
+    size_t      capacity = 0;
+    frames = pushIndexFrame( frames, &depth, &capacity, list );
+    
+    bool ok = true;
+    while( depth > 0 ) {
+        chunk = nextIndexList( &frames[depth - 1] );
+        if( !chunk ) {
+            depth--;
+            continue;
+        }
+        
+        list = loadRecord( in, chunk );
+        if( !list ) {
+            ok = false;
+            break;
+        }
+        frames = pushIndexFrame( frames, &depth, &capacity, list );
+    }
+    
+    free( frames );
+    return ok;
+}
+
+static raff_File*
+openIndexed( char const* path, char const* indexPath ) {
+    uint64_t sourceSize;
+    int64_t  sourceTime;
+    int64_t  sourceNsec;
+    if( !sourceStamp( path, &sourceSize, &sourceTime, &sourceNsec ) ) {
+        errnum = raff_ERR_CANT_OPEN;
+        return NULL;
+    }
+    
+    FILE* in = fopen( indexPath, "rb" );
+    if( !in ) {
+        errnum = raff_ERR_BAD_INDEX;
+        return NULL;
+    }
+    
+    char head[INDEX_HEAD_SIZE];
+    char want[INDEX_HEAD_SIZE];
+    if( fread( head, 1, INDEX_HEAD_SIZE, in ) != INDEX_HEAD_SIZE ) {
+        fclose( in );
+        errnum = raff_ERR_BAD_INDEX;
+        return NULL;
+    }
+    
+    // The root's ID and size are only known once the file's open,
+    // so the rest of the header is checked first.
+    uint32_t rootID;
+    uint64_t rootSize;
+    memcpy( &rootID, head + 12, 4 );
+    memcpy( &rootSize, head + 16, 8 );
+    encodeIndexHead( want, rootID, rootSize, sourceSize, sourceTime, sourceNsec );
+    if( memcmp( head, want, INDEX_HEAD_SIZE ) ) {
+        fclose( in );
+        errnum = raff_ERR_BAD_INDEX;
+        return NULL;
+    }
+    
+    raff_File* file = openFileLazy( path );
+    if( !file ) {
+        fclose( in );
+        return NULL;
+    }
+    
+    bool ok = file->chunk->id == rootID && file->chunk->size == rootSize &&
+              loadList( in, file->chunk ) && fgetc( in ) == EOF;
+    fclose( in );
+    if( !ok ) {
+        raff_closeFile( file );
+        errnum = raff_ERR_BAD_INDEX;
+        return NULL;
+    }
+    
+    errnum = raff_ERR_NONE;
+    return file;
+}
+
+raff_File*
+raff_openIndexed( char const* path, char const* indexPath ) {
+    BEGIN_PHASE( raff_PHASE_OPEN, NULL );
+    raff_File* file = openIndexed( path, indexPath );
+    END_PHASE( raff_PHASE_OPEN, file );
+    return file;
 }
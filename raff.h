@@ -3,10 +3,15 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-typedef struct raff_Chunk raff_Chunk;
-typedef struct raff_List  raff_List;
-typedef struct raff_Data  raff_Data;
-typedef struct raff_File  raff_File;
+typedef struct raff_Chunk    raff_Chunk;
+typedef struct raff_List     raff_List;
+typedef struct raff_Data     raff_Data;
+typedef struct raff_File     raff_File;
+typedef struct raff_Query    raff_Query;
+typedef struct raff_Writer   raff_Writer;
+typedef struct raff_AviIndex raff_AviIndex;
+typedef struct raff_Wave     raff_Wave;
+typedef struct raff_Parser   raff_Parser;
 typedef long long raff_ID;
 
 typedef enum raff_Error {
@@ -15,20 +20,75 @@ typedef enum raff_Error {
     raff_ERR_IS_LIST,
     raff_ERR_NOT_RIFF,
     raff_ERR_CORRUPT,
-    raff_ERR_CANT_OPEN
+    raff_ERR_CANT_OPEN,
+    raff_ERR_CANT_WRITE,
+    raff_ERR_BAD_QUERY,
+    raff_ERR_CANT_EDIT,
+    raff_ERR_NOT_AVI,
+    raff_ERR_NOT_WAVE,
+    raff_ERR_BAD_FORMAT,
+    raff_ERR_BAD_INDEX
 } raff_Error;
 
+// Types of audio samples that can be converted to and from
+// floats; 24 bit samples are packed in three bytes.
+typedef enum raff_SampleType {
+    raff_SAMPLE_INT16,
+    raff_SAMPLE_INT24,
+    raff_SAMPLE_INT32,
+    raff_SAMPLE_FLOAT32
+} raff_SampleType;
+
+// Instruction sets sample conversion can use.
+typedef enum raff_Simd {
+    raff_SIMD_NONE,
+    raff_SIMD_SSE2,
+    raff_SIMD_AVX2
+} raff_Simd;
+
+typedef enum raff_Access {
+    raff_ACCESS_SEQUENTIAL,
+    raff_ACCESS_RANDOM
+} raff_Access;
+
+// A source of bytes.  The next() method should return the next
+// byte of the stream, or -1 at the end; and close() is called
+// once the library's done with the stream, if it isn't NULL.
 typedef struct raff_Stream {
     int  (*next)( struct raff_Stream* stream );
     void (*close)( struct raff_Stream* stream );
 } raff_Stream;
 
+// A stream with more methods, for the functions that take one.
+// The methods are optional and should be NULL if not provided,
+// like the stream's close(); and they're passed the stream member
+// as next() is.  When read() is available it's used to pull
+// bytes in blocks instead of one at a time; it should return the
+// number of bytes put in buf, and 0 only at the end of the
+// stream.  When skip() is available it's used to step over
+// bytes that aren't needed without reading them; it should
+// return the number of bytes skipped.  The seek() method is
+// only needed for lazily opened streams, it should move to
+// the given offset from the start of the stream and return
+// 0 on success.
+typedef struct raff_StreamEx {
+    raff_Stream stream;
+    size_t      (*read)( raff_Stream* stream, char* buf, size_t size );
+    size_t      (*skip)( raff_Stream* stream, size_t size );
+    int         (*seek)( raff_Stream* stream, unsigned long long offset );
+} raff_StreamEx;
+
 // Create an RIFF file representation from an arbitrary stream,
 // returns NULL if the given stream doesn't have a valid RIFF
 // header; and sets the error value to raff_ERR_NOT_RAFF.
 raff_File*
 raff_openStream( raff_Stream* stream );
 
+// Like raff_openStream(), but for a stream with more methods,
+// which are used where they're given.
+raff_File*
+raff_openStreamEx( raff_StreamEx* stream );
+
 // Open and parge a RIFF file, returns NULL if the given file
 // doesn't have a RIFF header or can't be opened and sets the
 // error value appropriately to raff_ERR_NOT_RAFF or
@@ -36,13 +96,108 @@ raff_openStream( raff_Stream* stream );
 raff_File*
 raff_openFile( char const* path );
 
+// Open a RIFF file by mapping it into memory instead of
+// reading it, so the file's data and chunk contents point
+// directly into the read-only mapping and pages are only
+// loaded as they're touched.  The access hint tells the OS
+// whether the contents will be read through sequentially
+// or just sampled here and there.  Fails in the same way
+// as raff_openFile().  On platforms without memory mapping
+// this is the same as raff_openFile().
+raff_File*
+raff_mapFile( char const* path, raff_Access access );
+
+// Open a RIFF file from a seekable stream without reading its
+// contents.  Only the headers of chunks are read, as lists are
+// parsed, and chunk contents are read when requested with
+// raff_dataContent() or raff_dataRead().  The stream must
+// provide seek() and is owned by the file after this, it'll
+// be closed by raff_closeFile().  Returns NULL and sets the
+// error value to raff_ERR_CANT_OPEN if the stream can't seek,
+// or as for raff_openStream() if it isn't valid RIFF.
+raff_File*
+raff_openStreamLazy( raff_StreamEx* stream );
+
+// Open a RIFF file lazily, as with raff_openStreamLazy().
+raff_File*
+raff_openFileLazy( char const* path );
+
+// Writes an index of a file's lists to indexPath; the IDs, types,
+// sizes, and offsets of every chunk in them, and the size and
+// modification time of the file.  Every list in the file is
+// parsed to do so.  The file must have been opened from a path,
+// and the index is of the file as it is on disk; so lists
+// changed by anything but raff_appendInPlace() are indexed as
+// they were parsed.  Returns raff_ERR_CANT_OPEN if the file
+// wasn't opened from a path, raff_ERR_CANT_WRITE if the index
+// can't be written, or the error from parsing a list that can't
+// be parsed; the code is also put in the error value.
+raff_Error
+raff_saveIndex( raff_File* file, char const* indexPath );
+
+// Opens a RIFF file lazily, as with raff_openFileLazy(), with its
+// lists already parsed from an index written by raff_saveIndex();
+// so nothing but the file's header is read until chunk contents
+// are.  Returns NULL and sets the error value to raff_ERR_BAD_INDEX
+// if the index can't be read, is broken, or was made from a file
+// of a different size or modification time (to the second); in
+// which case the file can be opened some other way and indexed
+// again.  Otherwise fails as raff_openFileLazy() does.
+raff_File*
+raff_openIndexed( char const* path, char const* indexPath );
+
+// Called by the batch open functions with each file opened, and
+// its index in the batch.  The file is NULL if it couldn't be
+// opened or its root list couldn't be parsed, with err saying
+// why; otherwise it belongs to the callback to close when it's
+// done with.  This is called from the worker threads, so may be
+// called for several files at the same time.
+typedef void (*raff_BatchCb)( size_t index, raff_File* file,
+                              raff_Error err, void* user );
+
+// Opens a batch of files in parallel, on the given number of
+// worker threads (or one per core if 0), with their root lists
+// parsed; and passes each to the callback as it's done.  The
+// calling thread works on the batch too, and this returns once
+// every file has been handed to the callback.  Files are split
+// evenly between workers, and workers that run out steal from
+// those that haven't.  Without thread support the files are
+// just opened in turn.
+void
+raff_openFiles( char const* const* paths, size_t count, unsigned workers,
+                raff_BatchCb cb, void* user );
+
+// Same as raff_openFiles(), but opens each with raff_openStreamEx();
+// streams that fail to open are left for the caller to close.
+void
+raff_openStreams( raff_StreamEx** streams, size_t count, unsigned workers,
+                  raff_BatchCb cb, void* user );
+
 // Close a RIFF file, releasing its resources.  All allocation
 // functions are tied to a specific file, so releasing the file
 // also releases these allocations.
 void
 raff_closeFile( raff_File* file );
 
-// Return the last error code.
+// Set the size of the slabs that file pools are allocated
+// from, for files opened or created after this.  Bigger slabs
+// mean fewer calls to malloc() for big files, but more memory
+// wasted for small ones.  The default is 64KiB.  This is
+// shared by all threads, so should be set before any other
+// threads start using the library.
+void
+raff_setSlabSize( size_t size );
+
+// Slabs released by raff_closeFile() are kept for reuse by the
+// next files opened on the same thread, this frees the calling
+// thread's instead.  On POSIX systems they're freed when the
+// thread exits anyway; elsewhere threads should call this before
+// exiting.
+void
+raff_releaseSlabs( void );
+
+// Return the last error code.  Error codes are kept per
+// thread, so this is the last error of the calling thread.
 raff_Error
 raff_errorNum( void );
 
@@ -66,7 +221,57 @@ raff_chunkAsList( raff_Chunk* chunk );
 raff_Data*
 raff_chunkAsData( raff_Chunk* chunk );
 
-// Encode a list as a chunk.
+// Parses a chunk and everything in it, so every list and data
+// in the tree is ready and raff_chunkAsList() and
+// raff_chunkAsData() on any of them are just lookups.  Once the
+// top levels have been split into enough subtrees they're parsed
+// in parallel on the given number of worker threads (or one per
+// core if 0); but lazily opened files, and builds without thread
+// support, are parsed on the calling thread alone.  Returns
+// raff_ERR_CORRUPT if part of the tree can't be parsed, though
+// the lists that could be are still kept.
+raff_Error
+raff_parseTree( raff_Chunk* chunk, unsigned workers );
+
+// A chunk found by raff_walk().  For lists the ID is the list's
+// type, and riff is set if it's a RIFF chunk rather than a LIST;
+// size and content are of what follows the type.  The offset is
+// of the content in the file, for chunks read from one.  Content
+// is NULL for chunks of lazily opened files that haven't been
+// loaded.
+typedef struct raff_Visit {
+    unsigned           depth;
+    bool               list;
+    bool               riff;
+    raff_ID            id;
+    size_t             size;
+    unsigned long long offset;
+    char const*        content;
+} raff_Visit;
+
+// What a walk does after visiting a chunk; go on to the chunks
+// in it (if it's a list) and those after it, skip over the ones
+// in it, or stop.
+typedef enum raff_WalkAction {
+    raff_WALK_CONTINUE,
+    raff_WALK_SKIP,
+    raff_WALK_STOP
+} raff_WalkAction;
+
+typedef raff_WalkAction (*raff_Visitor)( raff_Visit const* visit, void* user );
+
+// Visits a chunk, at depth 0, and everything in it in the order
+// they'd be written; without parsing lists or allocating.  Chunk
+// headers are read in place, or from the source of a lazily opened
+// file, and nothing's kept but the offsets of the lists being
+// walked.  Returns raff_ERR_CORRUPT if part of the tree can't be
+// read, after visiting what comes before; stopping isn't an error.
+raff_Error
+raff_walk( raff_Chunk* chunk, raff_Visitor visit, void* user );
+
+// Encode a list as a chunk.  The content of the list's chunks
+// isn't copied, the new chunk just refers to them, and they're
+// written straight from their own buffers when serialized.
 raff_Chunk*
 raff_listAsChunk( raff_List* list, bool riff );
 
@@ -83,6 +288,14 @@ raff_start( raff_List* list );
 raff_Chunk*
 raff_next( raff_List* list );
 
+// Like raff_next(), but gives the ID and size of the next chunk
+// instead of the chunk.  Lists parsed from a file keep their
+// chunks in a compact table, and only make raff_Chunk handles
+// for them as they're asked for; so walking a big list this way
+// is cheaper.  Returns false at the end of the list.
+bool
+raff_nextInfo( raff_List* list, raff_ID* id, size_t* size );
+
 // Adds a chunk to the beginning of a list.
 void
 raff_prepend( raff_List* list, raff_Chunk* chunk );
@@ -100,6 +313,26 @@ raff_newFile( void );
 raff_Data*
 raff_newData( raff_File* file, raff_ID id, char const* data, size_t size );
 
+// Creates a new data that uses the given content as it is,
+// rather than copying it; so it has to stay put, and keep the
+// content it should be written with, until the file's closed.
+// Copies of the data in other files are copied as usual.
+raff_Data*
+raff_borrowData( raff_File* file, raff_ID id, char const* data, size_t size );
+
+// Called to give back a buffer adopted by raff_adoptData().
+typedef void (*raff_Release)( char* data, size_t size, void* user );
+
+// Like raff_borrowData(), but the file takes the content over;
+// calling release with it, and the given user pointer, when
+// the file is closed.  If release is NULL the content is
+// freed with free().  Chunks copied to other files by
+// raff_copyChunkTo() share the content too, in which case
+// it's only released once the last of the files is closed.
+raff_Data*
+raff_adoptData( raff_File* file, raff_ID id, char* data, size_t size,
+                raff_Release release, void* user );
+
 // Creates a new empty list.
 raff_List*
 raff_newList( raff_File* file, raff_ID id );
@@ -114,38 +347,451 @@ raff_getID( raff_Chunk* chunk );
 
 // Returns the first instance of a chunk with the specified
 // ID within the given list, or NULL if no such chunk exists.
+// The first search of a list with more than a few chunks
+// indexes it by ID, so later searches take constant time.
 raff_Chunk*
 raff_findID( raff_List* list, raff_ID id );
 
+// Returns the next chunk after the given one, in the same
+// list, with the same ID; or NULL if there are no more.  So
+// all chunks with an ID can be visited in order with:
+//
+//     raff_Chunk* iter = raff_findID( list, id );
+//     while( iter ) {
+//         ...
+//         iter = raff_findNextID( list, iter );
+//     }
+raff_Chunk*
+raff_findNextID( raff_List* list, raff_Chunk* chunk );
+
+// Called by raff_queryAll() for each matching chunk, should
+// return false to stop the query or true to keep going.
+typedef bool (*raff_QueryCb)( raff_Chunk* chunk, void* user );
+
+// Compiles a query for finding chunks by their path through
+// nested lists.  The path is a list of steps separated by '/',
+// the first of which matches the chunk the query is run on.
+// Each step is an ID, or '*' to match any ID, and '?' can be
+// used in IDs to match any character.  An ID can be prefixed
+// by 'LIST:', 'RIFF:', or 'DATA:' to match only that type of
+// chunk.  A step of '**' matches any number of nested lists
+// (including none).  For example:
+//
+//     RIFF:AVI /LIST:hdrl/LIST:strl/strh
+//
+// Returns NULL and sets the error value to raff_ERR_BAD_QUERY
+// if the path isn't valid.  Queries don't belong to a file, so
+// can be used on any number of them; and should be released
+// with raff_freeQuery().
+raff_Query*
+raff_compileQuery( char const* path );
+
+// Releases a compiled query.
+void
+raff_freeQuery( raff_Query* query );
+
+// Runs a query on a chunk, calling the callback for each match
+// in file order.  Only lists on the way to a match are parsed.
+// Returns the number of matches.  If a list can't be parsed
+// then the query stops and the error value is set.
+size_t
+raff_queryAll( raff_Query* query, raff_Chunk* chunk,
+               raff_QueryCb callback, void* user );
+
+// Runs a query on a chunk and returns the first match, or
+// NULL if nothing matched.
+raff_Chunk*
+raff_queryFirst( raff_Query* query, raff_Chunk* chunk );
+
 // Copy a chunk, since chunks are immutable this is only
 // really useful when the chunk already belongs to a list
 // but must be added to another in the same file.
 raff_Chunk*
 raff_copyChunk( raff_Chunk* chunk );
 
-// Copy a chunk to a different file.
+// Copy a chunk to a different file.  Content loaded by
+// raff_openFile() isn't copied, but shared between the files;
+// which takes no time however big the chunk is, and the file
+// copied from can be closed while the one copied to still uses
+// it.  Other chunks, such as those of mapped or lazily opened
+// files, are copied.
 raff_Chunk*
 raff_copyChunkTo( raff_File* file, raff_Chunk* chunk );
 
+// Overwrite the content of a data chunk in the file it was
+// parsed from, without rewriting the rest of the file.  The
+// file must have been opened from a path, and the new content
+// must be the same size as the old.  Returns raff_ERR_CANT_EDIT
+// if the chunk can't be edited this way, or raff_ERR_CANT_OPEN
+// or raff_ERR_CANT_WRITE if the file can't be written; the
+// code is also put in the error value.  If the chunk's
+// content is shared with chunks copied to other files, it's
+// copied first so theirs doesn't change.
+raff_Error
+raff_overwriteInPlace( raff_Chunk* chunk, char const* content, size_t size );
+
+// Add a chunk to the end of a list, writing it straight to the
+// end of the file the list was parsed from and patching the
+// sizes of the list and the lists it's in; so the rest of the
+// file doesn't have to be rewritten.  This only works for the
+// root list, or a list at the end of it (such as the last
+// list of the last list of the root), and only if the list
+// and the lists it's in haven't been changed since parsing.
+// Anything past the end of the RIFF chunk in the file will be
+// overwritten.  As with raff_append() the chunk should belong
+// to the same file and not be in another list.  Returns the
+// same codes as raff_overwriteInPlace().
+raff_Error
+raff_appendInPlace( raff_List* list, raff_Chunk* chunk );
+
 
 // Serializes the specified chunk as a raff_Stream*
 // which should be closed, but not freed, after use.
+// It's the stream member of a raff_StreamEx with read()
+// and skip(), so can be cast to one.
+// RIFF chunks too big for a 32 bit size are written
+// as RF64, with a ds64 chunk holding the real sizes.
 raff_Stream*
 raff_serializeChunk( raff_Chunk* chunk );
 
 // Serialize the specified chunk to the given file.  Returns
-// 0 = raff_ERR_NONE on success or raff_ERR_CANT_OPEN if the
-// file can't be opened.  The returned code will also be put
+// 0 = raff_ERR_NONE on success, raff_ERR_CANT_OPEN if the
+// file can't be opened, or raff_ERR_CANT_WRITE if writing
+// to it fails.  The returned code will also be put
 // in errnum to be retrieved by raff_errorNum().
 raff_Error
 raff_serializeChunkToFile( raff_Chunk* chunk, char const* path );
 
+// Starts writing a RIFF file with the given ID, for files too
+// big to build in memory first.  Chunks are written as they're
+// given, and the sizes of lists and data chunks are patched in
+// once they're ended; so memory use doesn't grow with the file.
+// Room is kept for a ds64 chunk (a JUNK chunk until then) so the
+// file can become RF64 if it grows past 4GiB, in which case only
+// the first 'data' chunk may be that big.  Returns NULL and
+// sets errnum to raff_ERR_CANT_OPEN if the file can't be opened.
+raff_Writer*
+raff_newWriter( char const* path, raff_ID id );
+
+// Starts a list in the writer, which goes in the innermost
+// list still open.
+raff_Error
+raff_writerBeginList( raff_Writer* writer, raff_ID id );
+
+// Ends the innermost list of the writer, patching its size.
+raff_Error
+raff_writerEndList( raff_Writer* writer );
+
+// Starts a data chunk in the writer, whose content is given
+// by raff_writerWrite() in as many pieces as needed.
+raff_Error
+raff_writerBeginData( raff_Writer* writer, raff_ID id );
+
+// Writes a piece of the open data chunk's content.
+raff_Error
+raff_writerWrite( raff_Writer* writer, char const* buf, size_t size );
+
+// Ends the open data chunk, padding it and patching its size.
+raff_Error
+raff_writerEndData( raff_Writer* writer );
+
+// Writes an existing chunk, and everything in it, to the writer.
+raff_Error
+raff_writerChunk( raff_Writer* writer, raff_Chunk* chunk );
+
+// Ends anything still open, finishes the file and frees the
+// writer.  Errors from writing are sticky, so this returns the
+// first one, or raff_ERR_CANT_WRITE if the file can't be closed.
+raff_Error
+raff_closeWriter( raff_Writer* writer );
+
 // Returns the size of a raff_Data.
 size_t
 raff_dataSize( raff_Data* data );
 
-// Returns the content of a raff_Data.
+// Returns the content of a raff_Data.  For lazily opened files
+// this loads the whole content first, returns NULL and sets
+// the error value to raff_ERR_CORRUPT if it can't be read.
 char const*
 raff_dataContent( raff_Data* data );
 
+// Copies up to size bytes of a raff_Data's content, starting
+// at offset, into buf.  Returns the number of bytes copied,
+// which is less than size if the content ends first.  For
+// lazily opened files only the requested range is read;
+// returns 0 and sets the error value to raff_ERR_CORRUPT if
+// it can't be.
+size_t
+raff_dataRead( raff_Data* data, size_t offset, char* buf, size_t size );
+
+// A chunk of one of an AVI's streams, as found by an AVI index.
+// The offset is of the chunk's content from the start of the
+// file.  If the content is in memory, as it is for files that
+// weren't opened lazily, then content points to it in place;
+// otherwise it's NULL and the content can be read with
+// raff_aviRead().
+typedef struct raff_AviChunk {
+    raff_ID            id;
+    size_t             size;
+    unsigned long long offset;
+    bool               key;
+    char const*        content;
+} raff_AviChunk;
+
+// Finds the chunks of each stream of an AVI file, so the Nth of
+// any stream can be looked up directly instead of walking the
+// movi list.  The OpenDML indexes are used if every stream has
+// one, otherwise the idx1 chunk, and if neither can be read the
+// movi list is walked; without an index every chunk is taken to
+// be a key frame.  The index belongs to the file and is freed
+// with it.  Returns NULL and sets the error value to
+// raff_ERR_NOT_AVI if the file isn't an AVI, or to
+// raff_ERR_CORRUPT if it has no movi list.
+raff_AviIndex*
+raff_aviIndex( raff_File* file );
+
+// Returns the number of streams of an AVI.
+unsigned
+raff_aviStreamCount( raff_AviIndex* index );
+
+// Returns the number of chunks of a stream.
+size_t
+raff_aviChunkCount( raff_AviIndex* index, unsigned stream );
+
+// Gives the Nth chunk of a stream, returns false if there's no
+// such chunk.
+bool
+raff_aviChunk( raff_AviIndex* index, unsigned stream, size_t n, raff_AviChunk* chunk );
+
+// Returns the number of the last key frame of a stream at or
+// before the Nth chunk, for seeking; or the stream's chunk count
+// if there isn't one.
+size_t
+raff_aviKeyChunk( raff_AviIndex* index, unsigned stream, size_t n );
+
+// Copies up to size bytes of an AVI chunk's content, starting at
+// offset, into buf; like raff_dataRead().  Returns the number of
+// bytes copied, or 0 with the error value set to
+// raff_ERR_CORRUPT if they can't be read.
+size_t
+raff_aviRead( raff_AviIndex* index, raff_AviChunk const* chunk,
+              size_t offset, char* buf, size_t size );
+
+// The format of a WAVE file, from its fmt chunk.  For
+// WAVE_FORMAT_EXTENSIBLE files format is the tag from the
+// sub-format GUID (1 for PCM, 3 for float, and so on), and
+// validBits and channelMask are filled in; for others validBits
+// is bitsPerSample and channelMask is 0.
+typedef struct raff_WaveFormat {
+    unsigned      format;
+    unsigned      channels;
+    unsigned long sampleRate;
+    unsigned long byteRate;
+    unsigned      blockAlign;
+    unsigned      bitsPerSample;
+    unsigned      validBits;
+    unsigned long channelMask;
+    bool          extensible;
+} raff_WaveFormat;
+
+// A range of frames of a WAVE file's data chunk.  The offset
+// and size are in bytes, from the start of the data chunk's
+// content.  If the content is in memory, as it is for files that
+// weren't opened lazily, then content points to the first frame
+// in place; otherwise it's NULL and the frames can be read with
+// raff_waveRead().
+typedef struct raff_WaveSlice {
+    unsigned long long first;
+    unsigned long long count;
+    size_t             offset;
+    size_t             size;
+    char const*        content;
+} raff_WaveSlice;
+
+// Reads the format of a WAVE file and finds its data chunk, so
+// ranges of frames can be found without decoding the fmt chunk
+// by hand.  Nothing of the data chunk is read, so for a lazily
+// opened or mapped file only the frames asked for are ever
+// touched.  The result belongs to the file and is freed with it.
+// Returns NULL and sets the error value to raff_ERR_NOT_WAVE if
+// the file isn't a WAVE file, or to raff_ERR_CORRUPT if it has
+// no fmt or data chunk or the format doesn't make sense.
+raff_Wave*
+raff_fileAsWave( raff_File* file );
+
+// Returns the format of a WAVE file.
+raff_WaveFormat const*
+raff_waveFormat( raff_Wave* wave );
+
+// Returns the number of whole frames in a WAVE file's data.
+unsigned long long
+raff_waveFrameCount( raff_Wave* wave );
+
+// Gives count frames from the given first frame, or as many as
+// there are before the end.  Returns false if first is past the
+// end.
+bool
+raff_waveFrames( raff_Wave* wave, unsigned long long first,
+                 unsigned long long count, raff_WaveSlice* slice );
+
+// Like raff_waveFrames(), but for a time range in seconds; both
+// ends are rounded to the nearest frame.  Returns false if either
+// time is infinite or NaN.
+bool
+raff_waveTime( raff_Wave* wave, double start, double seconds, raff_WaveSlice* slice );
+
+// Copies up to size bytes of a slice, starting at offset bytes
+// into it, into buf; like raff_dataRead().  For lazily opened
+// files only these bytes are read.
+size_t
+raff_waveRead( raff_Wave* wave, raff_WaveSlice const* slice,
+               size_t offset, char* buf, size_t size );
+
+// Returns the number of bytes a sample of the given type takes.
+size_t
+raff_sampleWidth( raff_SampleType type );
+
+// Converts frames of interleaved samples of the given type to
+// floats, with each channel put in its own array.  Integers are
+// scaled from their full range to [-1, 1).  SSE2 or AVX2 is used
+// where the CPU has it.
+void
+raff_samplesToPlanar( raff_SampleType type, unsigned channels, char const* in,
+                      float* const* planes, size_t frames );
+
+// The reverse of raff_samplesToPlanar(), interleaving channels and
+// converting the floats to samples of the given type.  Floats are
+// clamped to [-1, 1) first, and rounded to the nearest integer.
+void
+raff_samplesFromPlanar( raff_SampleType type, unsigned channels,
+                        float const* const* planes, char* out, size_t frames );
+
+// Limits the instruction sets the sample conversions use, for
+// testing and comparing them; by default the best the CPU has is
+// used.  Returns the one that will be used.  This is shared by all
+// threads, so should be set before any other threads start using
+// the library.
+raff_Simd
+raff_setSimd( raff_Simd level );
+
+// Gives the type of a WAVE file's samples, from its format.
+// Returns false if they aren't a type that can be converted, or
+// aren't packed one after another.
+bool
+raff_waveSampleType( raff_Wave* wave, raff_SampleType* type );
+
+// Converts a slice of a WAVE file to floats, with each channel
+// put in its own array of at least slice->count floats.  For
+// lazily opened files the slice is read a block at a time.
+// Returns raff_ERR_BAD_FORMAT if the samples can't be converted,
+// or raff_ERR_CORRUPT if they can't be read.
+raff_Error
+raff_waveToPlanar( raff_Wave* wave, raff_WaveSlice const* slice, float* const* planes );
+
+// Like raff_newData(), but the content is made by converting an
+// array of floats per channel to interleaved samples of the given
+// type, like raff_samplesFromPlanar().
+raff_Data*
+raff_newSampleData( raff_File* file, raff_ID id, raff_SampleType type,
+                    unsigned channels, float const* const* planes, size_t frames );
+
+
+// Counts of the work done for a file, or for all files.  These
+// are only kept when the library is built with RAFF_STATS defined,
+// otherwise they're all zero; so they cost nothing unless asked
+// for.  Bytes read and stream calls are those of the stream (or
+// file) a file was opened from, mapped files are paged in by the
+// system so don't count any.  Times are in nanoseconds.
+typedef struct raff_Stats {
+    unsigned long long bytesRead;
+    unsigned long long streamCalls;
+    unsigned long long allocs;
+    unsigned long long allocBytes;
+    unsigned long long chunksParsed;
+    unsigned long long listsParsed;
+    unsigned long long bytesSerialized;
+    unsigned long long openTime;
+    unsigned long long parseTime;
+    unsigned long long serializeTime;
+} raff_Stats;
+
+typedef enum raff_Phase {
+    raff_PHASE_OPEN,
+    raff_PHASE_PARSE,
+    raff_PHASE_SERIALIZE
+} raff_Phase;
+
+// Called at the start and end of each phase timed in the stats;
+// the opens, the lists that get parsed by raff_chunkAsList() and
+// whole trees by raff_parseTree(), and raff_serializeChunkToFile().
+// The file is NULL at the start of an open, and at the end of one
+// that failed.
+typedef void (*raff_Hook)( raff_Phase phase, bool end, raff_File* file, void* user );
+
+// Gives the counts for one file, since it was opened or made.
+void
+raff_fileStats( raff_File* file, raff_Stats* stats );
+
+// Gives the counts for every file since the program started,
+// including those already closed; and the bytes written by
+// writers, which don't belong to a file.
+void
+raff_globalStats( raff_Stats* stats );
+
+// Sets the hook called around each phase, or NULL for none; and
+// a pointer passed to it.  Hooks are only called when built with
+// RAFF_STATS, and may be called from any thread that opens or
+// parses files.  Like raff_setSimd() this is shared by all
+// threads, so should be set before they start.
+void
+raff_setHooks( raff_Hook hook, void* user );
+
+
+// Kinds of events a push parser gives.
+typedef enum raff_PushKind {
+    raff_PUSH_BEGIN,
+    raff_PUSH_CONTENT,
+    raff_PUSH_END
+} raff_PushKind;
+
+// An event of a push parser.  The chunk is described as for a walk,
+// though with no content; each chunk begins once its header is in,
+// and ends once all of its content is.  In between, the content of
+// data chunks is given a piece at a time as it arrives, with the
+// piece's size and offset in the chunk's content.
+typedef struct raff_PushEvent {
+    raff_PushKind kind;
+    raff_Visit    chunk;
+    char const*   piece;
+    size_t        pieceSize;
+    size_t        pieceOffset;
+} raff_PushEvent;
+
+typedef raff_WalkAction (*raff_PushHandler)( raff_PushEvent const* event, void* user );
+
+// Makes a parser that bytes are pushed into as they arrive, from
+// a socket or pipe say; rather than one that pulls them from a
+// stream, and blocks until they come.  The handler is called for
+// each event as soon as there are bytes enough for it.  Returning
+// raff_WALK_SKIP from the beginning of a chunk skips everything in
+// it, and from its content skips the rest of it; the chunk still
+// ends.  Returning raff_WALK_STOP ignores everything after.
+raff_Parser*
+raff_newParser( raff_PushHandler handler, void* user );
+
+// Parses the next size bytes, however many there are, calling the
+// handler for whatever they complete.  Nothing's kept but the end
+// of each open list and up to a chunk header's worth of bytes (or
+// the ds64 chunk of an RF64 file, until it's all in).  Returns
+// raff_ERR_NOT_RIFF or raff_ERR_CORRUPT if the bytes aren't a RIFF
+// file, after which the parser ignores any more.  Bytes after the
+// end of the RIFF chunk are ignored.
+raff_Error
+raff_parserFeed( raff_Parser* parser, char const* buf, size_t size );
+
+// Frees a parser, returning raff_ERR_CORRUPT if the RIFF chunk
+// hasn't ended (and wasn't stopped), or any error from a feed.
+raff_Error
+raff_closeParser( raff_Parser* parser );
+
 #endif
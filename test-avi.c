@@ -0,0 +1,321 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests AVI indexes.  Small AVI files are put together byte by
+// byte, so where each chunk ends up is known; with a video and
+// an audio stream, some of the chunks grouped in 'rec ' lists,
+// and an index of each kind, or none.  Each is opened with each
+// of the open modes and every chunk looked up through the index.
+// An OpenDML index pointing at one that claims to be bigger than
+// the file shouldn't be used.
+
+static char const* path = "test-avi.avi";
+
+#define NUM_FRAMES 30
+
+enum {
+    INDEX_NONE,
+    INDEX_IDX1,
+    INDEX_IDX1_ABSOLUTE,
+    INDEX_IDX1_BROKEN,
+    INDEX_OPENDML,
+    INDEX_OPENDML_HUGE,
+    INDEX_KINDS
+};
+
+typedef struct Expect {
+    char          id[5];
+    char          content[16];
+    size_t        size;
+    size_t        head;
+    bool          key;
+} Expect;
+
+static Expect        expect[2][NUM_FRAMES];
+static unsigned char out[1 << 16];
+static size_t        outSize;
+
+static void
+put( void const* bytes, size_t size ) {
+    memcpy( out + outSize, bytes, size );
+    outSize += size;
+}
+
+static void
+put32At( size_t at, uint32_t v ) {
+    unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    memcpy( out + at, b, 4 );
+}
+
+static void
+put32( uint32_t v ) {
+    put32At( outSize, v );
+    outSize += 4;
+}
+
+static void
+put16( unsigned v ) {
+    unsigned char b[2] = { v, v >> 8 };
+    put( b, 2 );
+}
+
+static void
+put64( uint64_t v ) {
+    put32( (uint32_t)v );
+    put32( (uint32_t)( v >> 32 ) );
+}
+
+static uint32_t
+sizeAt( size_t head ) {
+    unsigned char const* b = out + head + 4;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+// Starts a chunk, returning where its size goes.
+static size_t
+begin( char const* id ) {
+    put( id, 4 );
+    put32( 0 );
+    return outSize - 4;
+}
+
+static size_t
+beginList( char const* kind, char const* id ) {
+    size_t at = begin( kind );
+    put( id, 4 );
+    return at;
+}
+
+static void
+end( size_t at ) {
+    put32At( at, outSize - at - 4 );
+    if( outSize % 2 )
+        out[outSize++] = 0;
+}
+
+static void
+zeros( char const* id, size_t size ) {
+    size_t at = begin( id );
+    memset( out + outSize, 0, size );
+    outSize += size;
+    end( at );
+}
+
+// Writes an OpenDML standard index of half a stream's chunks,
+// with offsets from the movi list's ID.
+static size_t
+stdIndex( unsigned stream, size_t from, size_t count, size_t base ) {
+    size_t head = outSize;
+    char   id[5];
+    sprintf( id, "ix%02u", stream );
+    size_t at = begin( id );
+    put16( 2 );
+    out[outSize++] = 0;
+    out[outSize++] = 1;
+    put32( count );
+    put( expect[stream][0].id, 4 );
+    put64( base );
+    put32( 0 );
+    for( size_t n = from ; n < from + count ; n++ ) {
+        Expect* e = &expect[stream][n];
+        put32( e->head + 8 - base );
+        put32( e->size | ( e->key ? 0 : 0x80000000u ) );
+    }
+    end( at );
+    return head;
+}
+
+static void
+generate( int kind ) {
+    outSize = 0;
+    size_t riff = beginList( "RIFF", "AVI " );
+    
+    size_t hdrl = beginList( "LIST", "hdrl" );
+    zeros( "avih", 56 );
+    size_t indx[2];
+    for( unsigned s = 0 ; s < 2 ; s++ ) {
+        size_t strl = beginList( "LIST", "strl" );
+        zeros( "strh", 56 );
+        zeros( "strf", 40 );
+        if( kind >= INDEX_OPENDML ) {
+            // A super index with two entries, filled in later.
+            indx[s] = outSize;
+            zeros( "indx", 24 + 2*16 );
+        }
+        end( strl );
+    }
+    end( hdrl );
+    
+    size_t movi     = beginList( "LIST", "movi" );
+    size_t moviBase = movi + 4;
+    size_t recs[NUM_FRAMES];
+    size_t rec      = 0;
+    for( int n = 0 ; n < NUM_FRAMES ; n++ ) {
+        if( n % 5 == 0 ) {
+            recs[n] = outSize;
+            rec     = beginList( "LIST", "rec " );
+        }
+        for( unsigned s = 0 ; s < 2 ; s++ ) {
+            Expect* e = &expect[s][n];
+            strcpy( e->id, s == 0 ? "00dc" : "01wb" );
+            sprintf( e->content, "%s %d", s == 0 ? "video" : "audio", n );
+            e->size = strlen( e->content );
+            e->key  = s == 1 || n % 10 == 0;
+            e->head = outSize;
+            
+            size_t at = begin( e->id );
+            put( e->content, e->size );
+            end( at );
+        }
+        if( n % 5 == 4 )
+            end( rec );
+    }
+    zeros( "JUNK", 10 );
+    
+    // Somewhere for a super index entry to point that looks like
+    // the header of a standard index far bigger than the file.
+    size_t huge = outSize;
+    if( kind == INDEX_OPENDML_HUGE ) {
+        size_t at = begin( "JUNK" );
+        put( "ix00", 4 );
+        put32( 0xFFFFFF00u );
+        end( at );
+    }
+    
+    if( kind >= INDEX_OPENDML ) {
+        for( unsigned s = 0 ; s < 2 ; s++ ) {
+            size_t half = NUM_FRAMES / 2;
+            size_t a    = stdIndex( s, 0, half, moviBase );
+            size_t b    = stdIndex( s, half, NUM_FRAMES - half, moviBase );
+            
+            size_t at = indx[s] + 8;
+            unsigned char head[8] = { 4, 0, 0, 0, 2, 0, 0, 0 };
+            memcpy( out + at, head, 8 );
+            memcpy( out + at + 8, expect[s][0].id, 4 );
+            for( int i = 0 ; i < 2 ; i++ ) {
+                size_t entry = at + 24 + i*16;
+                size_t std   = i == 0 ? a : b;
+                if( kind == INDEX_OPENDML_HUGE && s == 0 && i == 1 )
+                    std = huge + 8;
+                put32At( entry, std );
+                put32At( entry + 4, 0 );
+                put32At( entry + 8, sizeAt( std ) + 8 );
+                put32At( entry + 12, NUM_FRAMES / 2 );
+            }
+        }
+    }
+    end( movi );
+    
+    if( kind == INDEX_IDX1 || kind == INDEX_IDX1_ABSOLUTE || kind == INDEX_IDX1_BROKEN ) {
+        size_t base = kind == INDEX_IDX1_ABSOLUTE ? 0 : movi + 4;
+        size_t idx1 = begin( "idx1" );
+        for( int n = 0 ; n < NUM_FRAMES ; n++ ) {
+            if( n % 5 == 0 ) {
+                put( "rec ", 4 );
+                put32( 0x01 );
+                put32( recs[n] - base );
+                put32( 4 );
+            }
+            for( unsigned s = 0 ; s < 2 ; s++ ) {
+                Expect* e = &expect[s][n];
+                put( e->id, 4 );
+                put32( e->key ? 0x10 : 0 );
+                put32( e->head - base + ( kind == INDEX_IDX1_BROKEN ? 2 : 0 ) );
+                put32( e->size );
+            }
+        }
+        end( idx1 );
+    }
+    end( riff );
+    
+    FILE* f = fopen( path, "wb" );
+    assert( fwrite( out, 1, outSize, f ) == outSize );
+    fclose( f );
+}
+
+static void
+check( raff_File* file, int kind, bool lazy ) {
+    raff_AviIndex* index = raff_aviIndex( file );
+    assert( index );
+    assert( raff_aviStreamCount( index ) == 2 );
+    
+    // Without an index, or with a broken one, every chunk is
+    // taken to be a key frame.
+    bool keys = kind == INDEX_NONE || kind == INDEX_IDX1_BROKEN ||
+                kind == INDEX_OPENDML_HUGE;
+    for( unsigned s = 0 ; s < 2 ; s++ ) {
+        assert( raff_aviChunkCount( index, s ) == NUM_FRAMES );
+        for( size_t n = 0 ; n < NUM_FRAMES ; n++ ) {
+            Expect*       e = &expect[s][n];
+            raff_AviChunk chunk;
+            assert( raff_aviChunk( index, s, n, &chunk ) );
+            assert( chunk.id == raff_newID( e->id ) );
+            assert( chunk.size == e->size );
+            assert( chunk.offset == e->head + 8 );
+            assert( chunk.key == ( keys || e->key ) );
+            if( lazy )
+                assert( !chunk.content );
+            else
+                assert( chunk.content && !memcmp( chunk.content, e->content, e->size ) );
+            
+            char buf[16];
+            assert( raff_aviRead( index, &chunk, 0, buf, sizeof(buf) ) == e->size );
+            assert( !memcmp( buf, e->content, e->size ) );
+            assert( raff_aviRead( index, &chunk, 2, buf, 3 ) == 3 );
+            assert( !memcmp( buf, e->content + 2, 3 ) );
+        }
+    }
+    
+    raff_AviChunk chunk;
+    assert( !raff_aviChunk( index, 0, NUM_FRAMES, &chunk ) );
+    assert( !raff_aviChunk( index, 2, 0, &chunk ) );
+    assert( raff_aviChunkCount( index, 2 ) == 0 );
+    
+    assert( raff_aviKeyChunk( index, 0, 13 ) == ( keys ? 13 : 10 ) );
+    assert( raff_aviKeyChunk( index, 0, 10 ) == 10 );
+    assert( raff_aviKeyChunk( index, 1, 13 ) == 13 );
+    assert( raff_aviKeyChunk( index, 0, NUM_FRAMES ) == NUM_FRAMES );
+    for( size_t n = 0 ; n < NUM_FRAMES ; n++ )
+        assert( raff_aviKeyChunk( index, 0, n ) == ( keys ? n : n - n % 10 ) );
+}
+
+int
+main( void ) {
+    for( int kind = 0 ; kind < INDEX_KINDS ; kind++ ) {
+        generate( kind );
+        for( int mode = 0 ; mode < 3 ; mode++ ) {
+            raff_File* file;
+            if( mode == 0 )
+                file = raff_openFile( path );
+            else
+            if( mode == 1 )
+                file = raff_mapFile( path, raff_ACCESS_RANDOM );
+            else
+                file = raff_openFileLazy( path );
+            assert( file );
+            
+            check( file, kind, mode == 2 );
+            raff_closeFile( file );
+        }
+    }
+    
+    // Only AVIs have an index.
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), "data", 4 ) ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( path );
+    assert( file );
+    assert( !raff_aviIndex( file ) );
+    assert( raff_errorNum() == raff_ERR_NOT_AVI );
+    raff_closeFile( file );
+    
+    remove( path );
+    printf( "Passed: AVI Test\n" );
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests borrowing and adopting content for new datas.  A file is
+// built from borrowed and adopted buffers, and written; which
+// should be the same as one built from copies.  Borrowed content
+// is used as it is when written, adopted content is released once
+// and only once every file sharing it is closed.
+
+static char const* path = "test-borrow.riff";
+
+static size_t released;
+
+static void
+release( char* data, size_t size, void* user ) {
+    assert( user == &released );
+    assert( size == 12 && !memcmp( data, "some content", 12 ) );
+    free( data );
+    released++;
+}
+
+static size_t
+serialize( raff_List* list, char* buf, size_t size ) {
+    assert( raff_serializeChunkToFile( raff_listAsChunk( list, true ), path ) == raff_ERR_NONE );
+    FILE*  f = fopen( path, "rb" );
+    size_t n = fread( buf, 1, size, f );
+    fclose( f );
+    return n;
+}
+
+static char*
+newContent( char const* content ) {
+    char* buf = malloc( strlen( content ) );
+    memcpy( buf, content, strlen( content ) );
+    return buf;
+}
+
+int
+main( void ) {
+    char       want[256];
+    raff_File* file = raff_newFile();
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( "head" ), "header", 6 ) ) );
+    raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), "some content", 12 ) ) );
+    raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( "tail" ), "tail", 4 ) ) );
+    size_t size = serialize( root, want, sizeof(want) );
+    raff_closeFile( file );
+    
+    // Borrowed content isn't copied, so what's in it when the
+    // file's written is what's written.
+    char borrowed[] = "HEADER";
+    char got[256];
+    file = raff_newFile();
+    root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_Data* head = raff_borrowData( file, raff_newID( "head" ), borrowed, 6 );
+    raff_Data* data = raff_adoptData( file, raff_newID( "data" ), newContent( "some content" ), 12,
+                                      release, &released );
+    assert( raff_dataSize( head ) == 6 && raff_dataSize( data ) == 12 );
+    raff_append( root, raff_dataAsChunk( head ) );
+    raff_append( root, raff_dataAsChunk( data ) );
+    raff_append( root, raff_dataAsChunk( raff_borrowData( file, raff_newID( "tail" ), "tail", 4 ) ) );
+    memcpy( borrowed, "header", 6 );
+    assert( serialize( root, got, sizeof(got) ) == size );
+    assert( !memcmp( got, want, size ) );
+    
+    // Copies of borrowed content are copied, those of adopted
+    // content share it.
+    raff_File*  into     = raff_newFile();
+    raff_Chunk* headCopy = raff_copyChunkTo( into, raff_dataAsChunk( head ) );
+    raff_Chunk* dataCopy = raff_copyChunkTo( into, raff_dataAsChunk( data ) );
+    memcpy( borrowed, "XXXXXX", 6 );
+    raff_closeFile( file );
+    assert( released == 0 );
+    
+    char buf[16];
+    assert( raff_dataRead( raff_chunkAsData( headCopy ), 0, buf, 6 ) == 6 );
+    assert( !memcmp( buf, "header", 6 ) );
+    assert( raff_dataRead( raff_chunkAsData( dataCopy ), 0, buf, 12 ) == 12 );
+    assert( !memcmp( buf, "some content", 12 ) );
+    raff_closeFile( into );
+    assert( released == 1 );
+    
+    // Without a release callback adopted content is freed.
+    file = raff_newFile();
+    raff_adoptData( file, raff_newID( "data" ), newContent( "freed" ), 5, NULL, NULL );
+    raff_closeFile( file );
+    
+    remove( path );
+    printf( "Passed: Borrow Test\n" );
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests sample conversion.  Random frames of each sample type and
+// a few channel counts are converted each way with every level of
+// SIMD the CPU has, which should all give exactly what the scalar
+// code does; and a few known values are checked.  Then a WAVE file
+// written from planar floats is read back the same way.
+
+static char const* path = "test-convert.wav";
+
+#define MAX_FRAMES   3001
+#define MAX_CHANNELS 6
+
+static float planes[MAX_CHANNELS][MAX_FRAMES];
+static float back[3][MAX_CHANNELS][MAX_FRAMES];
+static char  bytes[3][MAX_FRAMES*MAX_CHANNELS*4];
+
+static float* const*
+planesOf( float (*p)[MAX_FRAMES], float** ptrs ) {
+    for( int c = 0 ; c < MAX_CHANNELS ; c++ )
+        ptrs[c] = p[c];
+    return ptrs;
+}
+
+static void
+checkLevels( raff_SampleType type, unsigned channels, size_t frames ) {
+    size_t size = frames*channels*raff_sampleWidth( type );
+    float* ptrs[MAX_CHANNELS];
+    
+    // Out of range values should be clamped.
+    for( unsigned c = 0 ; c < channels ; c++ ) {
+        for( size_t i = 0 ; i < frames ; i++ )
+            planes[c][i] = (float)rand() / RAND_MAX * 3.0f - 1.5f;
+    }
+    
+    for( int level = raff_SIMD_NONE ; level <= raff_SIMD_AVX2 ; level++ ) {
+        int used = raff_setSimd( (raff_Simd)level );
+        raff_samplesFromPlanar( type, channels, (float const* const*)planesOf( planes, ptrs ),
+                                bytes[used], frames );
+        raff_samplesToPlanar( type, channels, bytes[used], planesOf( back[used], ptrs ), frames );
+        
+        assert( !memcmp( bytes[used], bytes[0], size ) );
+        for( unsigned c = 0 ; c < channels ; c++ )
+            assert( !memcmp( back[used][c], back[0][c], frames*sizeof(float) ) );
+    }
+    raff_setSimd( raff_SIMD_AVX2 );
+    
+    // Back again the floats should be within a step of where they
+    // started, once clamped.
+    float step = type == raff_SAMPLE_INT16 ? 1.0f / 32768 :
+                 type == raff_SAMPLE_INT24 ? 1.0f / 8388608 :
+                 type == raff_SAMPLE_INT32 ? 1.0f / 16777216 : 0;
+    for( unsigned c = 0 ; c < channels ; c++ ) {
+        for( size_t i = 0 ; i < frames ; i++ ) {
+            float want = planes[c][i];
+            if( type != raff_SAMPLE_FLOAT32 )
+                want = want < -1 ? -1 : want > 1 ? 1 : want;
+            assert( fabsf( back[0][c][i] - want ) <= step );
+        }
+    }
+}
+
+static void
+checkKnown( void ) {
+    unsigned char in16[] = { 0x00, 0x80, 0xFF, 0x7F, 0x00, 0x40, 0xFF, 0xFF };
+    float         out[4];
+    float*        plane = out;
+    raff_samplesToPlanar( raff_SAMPLE_INT16, 1, (char*)in16, &plane, 4 );
+    assert( out[0] == -1.0f && out[1] == 32767.0f / 32768 );
+    assert( out[2] == 0.5f && out[3] == -1.0f / 32768 );
+    
+    unsigned char in24[] = { 0x00, 0x00, 0x80, 0xFF, 0xFF, 0x7F };
+    raff_samplesToPlanar( raff_SAMPLE_INT24, 1, (char*)in24, &plane, 2 );
+    assert( out[0] == -1.0f && out[1] == 8388607.0f / 8388608 );
+    
+    // Halves round away from zero.
+    float const  values[] = { 1.0f, -1.0f, 0.5f, -0.5f / 32768 };
+    float const* in       = values;
+    char         enc[8];
+    raff_samplesFromPlanar( raff_SAMPLE_INT16, 1, &in, enc, 4 );
+    unsigned char expect[] = { 0xFF, 0x7F, 0x00, 0x80, 0x00, 0x40, 0xFF, 0xFF };
+    assert( !memcmp( enc, expect, 8 ) );
+}
+
+static void
+checkWave( void ) {
+    float* ptrs[MAX_CHANNELS];
+    for( size_t i = 0 ; i < MAX_FRAMES ; i++ ) {
+        planes[0][i] = sinf( i * 0.01f );
+        planes[1][i] = cosf( i * 0.01f ) * 0.5f;
+    }
+    
+    // Stereo 24 bit.
+    char fmt[16] = { 1, 0, 2, 0, 0x44, 0xAC, 0, 0, 0x98, 0x09, 4, 0, 6, 0, 24, 0 };
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "fmt " ), fmt, 16 ) ) );
+    raff_Data* data = raff_newSampleData( file, raff_newID( "data" ), raff_SAMPLE_INT24, 2,
+                                          (float const* const*)planesOf( planes, ptrs ), MAX_FRAMES );
+    assert( raff_dataSize( data ) == MAX_FRAMES*6 );
+    raff_append( wave, raff_dataAsChunk( data ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    for( int lazy = 0 ; lazy < 2 ; lazy++ ) {
+        file = lazy ? raff_openFileLazy( path ) : raff_openFile( path );
+        raff_Wave* w = raff_fileAsWave( file );
+        assert( w );
+        
+        raff_SampleType type;
+        assert( raff_waveSampleType( w, &type ) && type == raff_SAMPLE_INT24 );
+        
+        raff_WaveSlice slice;
+        assert( raff_waveFrames( w, 10, MAX_FRAMES, &slice ) );
+        assert( raff_waveToPlanar( w, &slice, planesOf( back[0], ptrs ) ) == raff_ERR_NONE );
+        for( size_t i = 0 ; i < slice.count ; i++ ) {
+            assert( fabsf( back[0][0][i] - planes[0][i + 10] ) <= 1.0f / 8388608 );
+            assert( fabsf( back[0][1][i] - planes[1][i + 10] ) <= 1.0f / 8388608 );
+        }
+        raff_closeFile( file );
+    }
+    
+    // 8 bit samples can't be converted.
+    fmt[12] = 2;
+    fmt[14] = 8;
+    file = raff_newFile();
+    wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "fmt " ), fmt, 16 ) ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), "data", 4 ) ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( path );
+    raff_Wave*      w = raff_fileAsWave( file );
+    raff_SampleType type;
+    raff_WaveSlice  slice;
+    assert( !raff_waveSampleType( w, &type ) );
+    assert( raff_waveFrames( w, 0, 2, &slice ) );
+    assert( raff_waveToPlanar( w, &slice, planesOf( back[0], ptrs ) ) == raff_ERR_BAD_FORMAT );
+    raff_closeFile( file );
+    remove( path );
+}
+
+int
+main( void ) {
+    size_t const   frameCounts[]   = { 0, 1, 7, 37, 1000, MAX_FRAMES };
+    unsigned const channelCounts[] = { 1, 2, 3, 6 };
+    for( int type = raff_SAMPLE_INT16 ; type <= raff_SAMPLE_FLOAT32 ; type++ ) {
+        for( size_t c = 0 ; c < sizeof(channelCounts)/sizeof(channelCounts[0]) ; c++ ) {
+            for( size_t f = 0 ; f < sizeof(frameCounts)/sizeof(frameCounts[0]) ; f++ )
+                checkLevels( (raff_SampleType)type, channelCounts[c], frameCounts[f] );
+        }
+    }
+    
+    checkKnown();
+    checkWave();
+    
+    printf( "Passed: Convert Test\n" );
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests copying chunks between files.  A file is written, then
+// opened each way and its chunks copied to a new file; which is
+// written once the file copied from is closed, and should be the
+// same.  Copies of copies should outlive both files before them,
+// and overwriting a shared chunk in place shouldn't change the
+// copies of it.
+
+static char const* path    = "test-copy.riff";
+static char const* outPath = "test-copy-out.riff";
+
+static char   written[256];
+static size_t writtenSize;
+
+static size_t
+readAll( char const* from, char* buf, size_t size ) {
+    FILE*  f = fopen( from, "rb" );
+    size_t n = fread( buf, 1, size, f );
+    fclose( f );
+    return n;
+}
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, strlen( content ) ) );
+}
+
+static void
+generate( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* item = raff_newList( file, raff_newID( "item" ) );
+    raff_append( item, newData( file, "data", "some content" ) );
+    raff_append( item, newData( file, "more", "and more" ) );
+    
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, newData( file, "head", "header" ) );
+    raff_append( root, raff_listAsChunk( item, false ) );
+    raff_append( root, newData( file, "tail", "tail" ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( root, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    writtenSize = readAll( path, written, sizeof(written) );
+}
+
+// Checks a chunk serializes to what was written in the first
+// place.
+static void
+checkSame( raff_Chunk* chunk ) {
+    char buf[256];
+    assert( raff_serializeChunkToFile( chunk, outPath ) == raff_ERR_NONE );
+    assert( readAll( outPath, buf, sizeof(buf) ) == writtenSize );
+    assert( !memcmp( buf, written, writtenSize ) );
+}
+
+static raff_File*
+openAs( int mode ) {
+    raff_File* file = mode == 0 ? raff_openFile( path ) :
+                      mode == 1 ? raff_mapFile( path, raff_ACCESS_RANDOM ) :
+                                  raff_openFileLazy( path );
+    assert( file );
+    return file;
+}
+
+// Copies the root and each chunk of a file to a new one, and
+// rebuilds the file there from the copies.
+static void
+checkCopies( int mode ) {
+    raff_File*  from = openAs( mode );
+    raff_File*  into = raff_newFile();
+    raff_Chunk* root = raff_copyChunkTo( into, raff_fileAsChunk( from ) );
+    assert( root );
+    
+    raff_List*  list  = raff_chunkAsList( raff_fileAsChunk( from ) );
+    raff_List*  built = raff_newList( into, raff_newID( "TEST" ) );
+    raff_Chunk* iter;
+    raff_start( list );
+    while( ( iter = raff_next( list ) ) ) {
+        raff_Chunk* copy = raff_copyChunkTo( into, iter );
+        assert( copy );
+        raff_append( built, copy );
+    }
+    raff_closeFile( from );
+    
+    checkSame( root );
+    checkSame( raff_listAsChunk( built, true ) );
+    
+    // A copy of a copy, parsed in the file between.
+    raff_File*  last = raff_newFile();
+    raff_Chunk* item = raff_findID( raff_chunkAsList( root ), raff_newID( "item" ) );
+    raff_Chunk* data = raff_findID( raff_chunkAsList( item ), raff_newID( "data" ) );
+    raff_Chunk* copy = raff_copyChunkTo( last, data );
+    raff_closeFile( into );
+    
+    char buf[16];
+    assert( raff_dataRead( raff_chunkAsData( copy ), 0, buf, sizeof(buf) ) == 12 );
+    assert( !memcmp( buf, "some content", 12 ) );
+    raff_closeFile( last );
+}
+
+// Overwrites a chunk that's been copied, which shouldn't change
+// the copy; though the file overwritten should see it, in the
+// chunk and the lists it's in.
+static void
+checkOverwrite( int mode ) {
+    generate();
+    raff_File*  from = openAs( mode );
+    raff_Chunk* item = raff_findID( raff_chunkAsList( raff_fileAsChunk( from ) ), raff_newID( "item" ) );
+    raff_Chunk* data = raff_findID( raff_chunkAsList( item ), raff_newID( "data" ) );
+    
+    raff_File*  into = raff_newFile();
+    raff_Chunk* copy = raff_copyChunkTo( into, raff_fileAsChunk( from ) );
+    assert( raff_overwriteInPlace( data, "SOME CONTENT", 12 ) == raff_ERR_NONE );
+    
+    char buf[16];
+    assert( raff_dataRead( raff_chunkAsData( data ), 0, buf, 12 ) == 12 );
+    assert( !memcmp( buf, "SOME CONTENT", 12 ) );
+    
+    char onDisk[256], out[256];
+    assert( readAll( path, onDisk, sizeof(onDisk) ) == writtenSize );
+    assert( raff_serializeChunkToFile( raff_fileAsChunk( from ), outPath ) == raff_ERR_NONE );
+    assert( readAll( outPath, out, sizeof(out) ) == writtenSize );
+    assert( !memcmp( out, onDisk, writtenSize ) );
+    assert( memcmp( out, written, writtenSize ) );
+    raff_closeFile( from );
+    
+    // The copy still has what was there before.
+    checkSame( copy );
+    raff_closeFile( into );
+}
+
+// Copies a new data added to an opened file, whose content is in
+// the file's pool rather than what was read in; so the copy has to
+// have content of its own, which it keeps once the file it came
+// from is closed.
+static void
+checkPooled( void ) {
+    raff_File*  from = raff_openFile( path );
+    raff_File*  into = raff_newFile();
+    raff_Chunk* copy = raff_copyChunkTo( into, newData( from, "data", "some content" ) );
+    raff_closeFile( from );
+    
+    // Which the next file to be made may well reuse.
+    raff_File* next = raff_newFile();
+    for( int i = 0 ; i < 64 ; i++ )
+        newData( next, "data", "XXXXXXXXXXXX" );
+    
+    char buf[16];
+    assert( raff_dataRead( raff_chunkAsData( copy ), 0, buf, sizeof(buf) ) == 12 );
+    assert( !memcmp( buf, "some content", 12 ) );
+    raff_closeFile( next );
+    raff_closeFile( into );
+}
+
+int
+main( void ) {
+    generate();
+    for( int mode = 0 ; mode < 3 ; mode++ )
+        checkCopies( mode );
+    for( int mode = 0 ; mode < 3 ; mode++ )
+        checkOverwrite( mode );
+    checkPooled();
+    
+    remove( path );
+    remove( outPath );
+    printf( "Passed: Copy Test\n" );
+    return 0;
+}
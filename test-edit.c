@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests editing files in place.  A small WAV like file is
+// generated, then opened with each of the open modes to have
+// a data chunk overwritten and chunks appended to both the
+// root list and a list at the end of it; after which the file
+// is parsed again to check everything landed where it should.
+
+static char const* path = "test-edit.wav";
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content, size_t size ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, size ) );
+}
+
+static void
+generate( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, newData( file, "fmt ", "0123456789abcdef", 16 ) );
+    raff_append( wave, newData( file, "data", "samples", 7 ) );
+    
+    raff_List* info = raff_newList( file, raff_newID( "INFO" ) );
+    raff_append( info, newData( file, "INAM", "name", 5 ) );
+    raff_append( wave, raff_listAsChunk( info, false ) );
+    
+    raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path );
+    raff_closeFile( file );
+}
+
+static size_t
+fileSize( void ) {
+    FILE* f = fopen( path, "rb" );
+    fseek( f, 0, SEEK_END );
+    size_t size = ftell( f );
+    fclose( f );
+    return size;
+}
+
+static void
+checkContent( raff_Chunk* chunk, char const* content, size_t size ) {
+    raff_Data* data = raff_chunkAsData( chunk );
+    assert( data );
+    assert( raff_dataSize( data ) == size );
+    assert( !memcmp( raff_dataContent( data ), content, size ) );
+}
+
+static void
+edit( raff_File* file ) {
+    raff_List* wave = raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( wave );
+    
+    // Same size overwrite.
+    raff_Chunk* fmt = raff_findID( wave, raff_newID( "fmt " ) );
+    assert( raff_overwriteInPlace( fmt, "fedcba9876543210", 16 ) == raff_ERR_NONE );
+    checkContent( fmt, "fedcba9876543210", 16 );
+    
+    // Different size isn't allowed.
+    assert( raff_overwriteInPlace( fmt, "short", 5 ) == raff_ERR_CANT_EDIT );
+    
+    // Append to the last list, which is at the end of the file.
+    raff_Chunk* infoCk = raff_findID( wave, raff_newID( "INFO" ) );
+    raff_List*  info   = raff_chunkAsList( infoCk );
+    assert( info );
+    raff_Chunk* iart = newData( file, "IART", "artist", 6 );
+    assert( raff_appendInPlace( info, iart ) == raff_ERR_NONE );
+    
+    // Lists that aren't at the end can't be appended to.
+    raff_Chunk* data = raff_findID( wave, raff_newID( "data" ) );
+    assert( raff_chunkAsList( data ) == NULL );
+    
+    // Append to the root list.
+    raff_Chunk* cue = newData( file, "cue ", "cue", 3 );
+    assert( raff_appendInPlace( wave, cue ) == raff_ERR_NONE );
+    
+    // Then the appended chunk can be overwritten too.
+    assert( raff_overwriteInPlace( cue, "CUE", 3 ) == raff_ERR_NONE );
+    
+    // The in memory tree should match the file.
+    assert( raff_findID( info, raff_newID( "IART" ) ) == iart );
+    assert( raff_findID( wave, raff_newID( "cue " ) ) == cue );
+    raff_serializeChunkToFile( raff_fileAsChunk( file ), "test-edit-copy.wav" );
+}
+
+static void
+check( void ) {
+    raff_File* file = raff_openFile( path );
+    assert( file );
+    
+    raff_Chunk* root = raff_fileAsChunk( file );
+    raff_List*  wave = raff_chunkAsList( root );
+    assert( wave );
+    
+    checkContent( raff_findID( wave, raff_newID( "fmt " ) ), "fedcba9876543210", 16 );
+    checkContent( raff_findID( wave, raff_newID( "data" ) ), "samples", 7 );
+    checkContent( raff_findID( wave, raff_newID( "cue " ) ), "CUE", 3 );
+    
+    raff_List* info = raff_chunkAsList( raff_findID( wave, raff_newID( "INFO" ) ) );
+    assert( info );
+    checkContent( raff_findID( info, raff_newID( "INAM" ) ), "name", 5 );
+    checkContent( raff_findID( info, raff_newID( "IART" ) ), "artist", 6 );
+    raff_closeFile( file );
+    
+    // The RIFF size should cover the whole file.
+    FILE*         f = fopen( path, "rb" );
+    unsigned char head[8];
+    assert( fread( head, 1, 8, f ) == 8 );
+    fclose( f );
+    uint32_t riffSize = head[4] | head[5] << 8 | head[6] << 16 | (uint32_t)head[7] << 24;
+    assert( riffSize + 8 == fileSize() );
+    
+    // And the in memory tree after editing should serialize
+    // to the same bytes.
+    FILE* a = fopen( path, "rb" );
+    FILE* b = fopen( "test-edit-copy.wav", "rb" );
+    int   ca, cb;
+    do {
+        ca = fgetc( a );
+        cb = fgetc( b );
+        assert( ca == cb );
+    } while( ca >= 0 );
+    fclose( a );
+    fclose( b );
+    remove( "test-edit-copy.wav" );
+}
+
+int
+main( void ) {
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        generate();
+        
+        raff_File* file;
+        if( mode == 0 )
+            file = raff_openFile( path );
+        else
+        if( mode == 1 )
+            file = raff_mapFile( path, raff_ACCESS_RANDOM );
+        else
+            file = raff_openFileLazy( path );
+        assert( file );
+        
+        edit( file );
+        raff_closeFile( file );
+        check();
+    }
+    
+    // Files that weren't opened from a path can't be edited.
+    raff_File*  file = raff_newFile();
+    raff_Chunk* ck   = newData( file, "abcd", "x", 1 );
+    assert( raff_overwriteInPlace( ck, "y", 1 ) == raff_ERR_CANT_EDIT );
+    raff_closeFile( file );
+    
+    remove( path );
+    printf( "Passed: Edit Test\n" );
+    return 0;
+}
@@ -0,0 +1,224 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raff.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// Tests saving and opening from indexes.  A file of nested lists
+// is written and indexed, then opened from the index; which should
+// give the same tree as parsing it, with the same content.  An
+// index saved from that file should be the same as the first.
+// Indexes that are missing, broken, or older than their file
+// shouldn't be used.  Lists nested far deeper than any real file
+// has should be indexed too.
+
+static char const* path      = "test-index.riff";
+static char const* indexPath = "test-index.rafx";
+static char const* copyPath  = "test-index-copy.rafx";
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, strlen( content ) ) );
+}
+
+static void
+generate( char const* tail ) {
+    raff_File* file = raff_newFile();
+    raff_List* deep = raff_newList( file, raff_newID( "deep" ) );
+    raff_append( deep, newData( file, "leaf", "odd" ) );
+    
+    raff_List* item = raff_newList( file, raff_newID( "item" ) );
+    raff_append( item, newData( file, "data", "some content" ) );
+    raff_append( item, newData( file, "none", "" ) );
+    raff_append( item, raff_listAsChunk( deep, false ) );
+    
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, newData( file, "head", "header" ) );
+    raff_append( root, raff_listAsChunk( item, false ) );
+    raff_append( root, raff_listAsChunk( raff_newList( file, raff_newID( "empt" ) ), false ) );
+    raff_append( root, newData( file, "tail", tail ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( root, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+}
+
+// Checks two lists have the same chunks, with the same content.
+static void
+checkSame( raff_List* a, raff_List* b ) {
+    raff_Chunk* x;
+    raff_Chunk* y;
+    raff_start( a );
+    raff_start( b );
+    while( ( x = raff_next( a ) ) ) {
+        y = raff_next( b );
+        assert( y );
+        assert( raff_getID( x ) == raff_getID( y ) );
+        
+        raff_List* xl = raff_chunkAsList( x );
+        raff_List* yl = raff_chunkAsList( y );
+        assert( !xl == !yl );
+        if( xl ) {
+            checkSame( xl, yl );
+            continue;
+        }
+        
+        raff_Data* xd   = raff_chunkAsData( x );
+        raff_Data* yd   = raff_chunkAsData( y );
+        size_t     size = raff_dataSize( xd );
+        char       xb[32], yb[32];
+        assert( raff_dataSize( yd ) == size );
+        assert( raff_dataRead( xd, 0, xb, size ) == size );
+        assert( raff_dataRead( yd, 0, yb, size ) == size );
+        assert( !memcmp( xb, yb, size ) );
+    }
+    assert( !raff_next( b ) );
+}
+
+static size_t
+readAll( char const* from, char* buf, size_t size ) {
+    FILE* f = fopen( from, "rb" );
+    if( !f )
+        return 0;
+    size_t n = fread( buf, 1, size, f );
+    fclose( f );
+    return n;
+}
+
+static void
+writeAll( char const* to, char const* buf, size_t size ) {
+    FILE* f = fopen( to, "wb" );
+    assert( fwrite( buf, 1, size, f ) == size );
+    fclose( f );
+}
+
+#define DEEP_COUNT 100000
+
+static void
+putHead( FILE* f, char const* id, size_t size, char const* sub ) {
+    unsigned char b[4] = { size, size >> 8, size >> 16, size >> 24 };
+    fwrite( id, 1, 4, f );
+    fwrite( b, 1, 4, f );
+    fwrite( sub, 1, 4, f );
+}
+
+static raff_WalkAction
+countLists( raff_Visit const* v, void* user ) {
+    (void)v;
+    (*(size_t*)user)++;
+    return raff_WALK_CONTINUE;
+}
+
+// Indexes a file that's nothing but lists, each in the one before.
+static void
+checkDeep( void ) {
+    FILE* f = fopen( path, "wb" );
+    putHead( f, "RIFF", 4 + 12*( DEEP_COUNT - 1 ), "DEEP" );
+    for( size_t i = 1 ; i < DEEP_COUNT ; i++ )
+        putHead( f, "LIST", 4 + 12*( DEEP_COUNT - 1 - i ), "nest" );
+    fclose( f );
+    
+    raff_File* file = raff_openFile( path );
+    assert( raff_saveIndex( file, indexPath ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openIndexed( path, indexPath );
+    assert( file );
+    size_t count = 0;
+    assert( raff_walk( raff_fileAsChunk( file ), countLists, &count ) == raff_ERR_NONE );
+    assert( count == DEEP_COUNT );
+    raff_closeFile( file );
+}
+
+static void
+checkBad( void ) {
+    assert( !raff_openIndexed( path, indexPath ) );
+    assert( raff_errorNum() == raff_ERR_BAD_INDEX );
+}
+
+int
+main( void ) {
+    generate( "tail" );
+    raff_File* file = raff_openFile( path );
+    assert( raff_saveIndex( file, indexPath ) == raff_ERR_NONE );
+    
+    raff_File* indexed = raff_openIndexed( path, indexPath );
+    assert( indexed );
+    checkSame( raff_chunkAsList( raff_fileAsChunk( file ) ),
+               raff_chunkAsList( raff_fileAsChunk( indexed ) ) );
+    
+    // Indexing an indexed file gives the same index.
+    char index[1024], copy[1024];
+    assert( raff_saveIndex( indexed, copyPath ) == raff_ERR_NONE );
+    size_t size = readAll( indexPath, index, sizeof(index) );
+    assert( size > 0 && size < sizeof(index) );
+    assert( readAll( copyPath, copy, sizeof(copy) ) == size );
+    assert( !memcmp( index, copy, size ) );
+    raff_closeFile( indexed );
+    raff_closeFile( file );
+    
+    // Files that weren't opened from a path can't be indexed.
+    file = raff_newFile();
+    assert( raff_saveIndex( file, indexPath ) == raff_ERR_CANT_OPEN );
+    raff_closeFile( file );
+    
+    // Indexes that have been cut short, or whose chunks don't fit
+    // in their lists, are broken.
+    writeAll( indexPath, index, size - 1 );
+    checkBad();
+    
+    char* bad = malloc( size + 1 );
+    memcpy( bad, index, size );
+    bad[size] = 0;
+    writeAll( indexPath, bad, size + 1 );
+    checkBad();
+    
+    memcpy( bad, index, size );
+    bad[48 + 8 + 4*4 + 4 + 3*8]++;
+    writeAll( indexPath, bad, size );
+    checkBad();
+    free( bad );
+    
+    writeAll( indexPath, index, size );
+    file = raff_openIndexed( path, indexPath );
+    assert( file );
+    raff_closeFile( file );
+    
+#if !defined(_WIN32)
+    // Even if it's changed within the same second.
+    struct timespec times[2] = { { 1000000000, 100 }, { 1000000000, 100 } };
+    assert( utimensat( AT_FDCWD, path, times, 0 ) == 0 );
+    file = raff_openFile( path );
+    assert( raff_saveIndex( file, indexPath ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    file = raff_openIndexed( path, indexPath );
+    assert( file );
+    raff_closeFile( file );
+    
+    times[1].tv_nsec = 200;
+    assert( utimensat( AT_FDCWD, path, times, 0 ) == 0 );
+    checkBad();
+#endif
+    
+    // Once the file's changed the index is out of date.
+    generate( "longer tail" );
+    checkBad();
+    
+    remove( indexPath );
+    checkBad();
+    
+    checkDeep();
+    remove( indexPath );
+    
+    remove( path );
+    remove( copyPath );
+    printf( "Passed: Index Test\n" );
+    return 0;
+}
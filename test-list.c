@@ -0,0 +1,452 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests searching and iterating lists.  A list with many
+// chunks sharing a few IDs is built, written out, and parsed
+// back; and chunks with each ID are looked up before and
+// after adding more chunks to the list.  Then queries and
+// full tree parses are run over an AVI like tree, and over lists
+// nested far deeper than any real file has.
+
+#define NUM_CHUNKS 100
+
+static char const* ids[] = { "aaaa", "bbbb", "cccc" };
+
+// Checks that each chunk with the given ID is found, in order,
+// and that the content of each is its position in the list.
+static void
+checkID( raff_List* list, char const* idstr, int first, int count ) {
+    raff_ID     id   = raff_newID( idstr );
+    raff_Chunk* iter = raff_findID( list, id );
+    
+    int found = 0;
+    int last  = -1;
+    while( iter ) {
+        assert( raff_getID( iter ) == id );
+        
+        raff_Data* data = raff_chunkAsData( iter );
+        int        pos  = (unsigned char)raff_dataContent( data )[0];
+        assert( pos > last );
+        if( found == 0 )
+            assert( pos == first );
+        
+        last = pos;
+        found++;
+        iter = raff_findNextID( list, iter );
+    }
+    assert( found == count );
+}
+
+static void
+checkList( raff_List* list ) {
+    checkID( list, "aaaa", 0, 34 );
+    checkID( list, "bbbb", 1, 33 );
+    checkID( list, "cccc", 2, 33 );
+    checkID( list, "none", 0, 0 );
+}
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content ) {
+    raff_Data* data = raff_newData( file, raff_newID( id ), content, 1 );
+    return raff_dataAsChunk( data );
+}
+
+static bool
+countCb( raff_Chunk* chunk, void* user ) {
+    (*(int*)user)++;
+    return true;
+}
+
+// Runs a query on the chunk and checks the number of matches,
+// and the content of the first.
+static void
+checkQuery( raff_Chunk* chunk, char const* path, int count, char first ) {
+    raff_Query* query = raff_compileQuery( path );
+    assert( query );
+    
+    int    calls = 0;
+    size_t found = raff_queryAll( query, chunk, countCb, &calls );
+    assert( found == (size_t)count && calls == count );
+    
+    raff_Chunk* match = raff_queryFirst( query, chunk );
+    if( count == 0 ) {
+        assert( !match );
+    }
+    else {
+        assert( match );
+        assert( raff_dataContent( raff_chunkAsData( match ) )[0] == first );
+    }
+    raff_freeQuery( query );
+}
+
+// Tests queries over an AVI like tree of lists.
+static void
+testQueries( void ) {
+    raff_File* file = raff_newFile();
+    
+    raff_List* strl1 = raff_newList( file, raff_newID( "strl" ) );
+    raff_append( strl1, newData( file, "strh", "1" ) );
+    raff_append( strl1, newData( file, "strf", "2" ) );
+    
+    raff_List* strl2 = raff_newList( file, raff_newID( "strl" ) );
+    raff_append( strl2, newData( file, "strh", "3" ) );
+    raff_append( strl2, newData( file, "strf", "4" ) );
+    
+    raff_List* hdrl = raff_newList( file, raff_newID( "hdrl" ) );
+    raff_append( hdrl, newData( file, "avih", "5" ) );
+    raff_append( hdrl, raff_listAsChunk( strl1, false ) );
+    raff_append( hdrl, raff_listAsChunk( strl2, false ) );
+    
+    raff_List* movi = raff_newList( file, raff_newID( "movi" ) );
+    raff_append( movi, newData( file, "00dc", "6" ) );
+    raff_append( movi, newData( file, "01wb", "7" ) );
+    raff_append( movi, newData( file, "00dc", "8" ) );
+    
+    raff_List* avi = raff_newList( file, raff_newID( "AVI " ) );
+    raff_append( avi, raff_listAsChunk( hdrl, false ) );
+    raff_append( avi, raff_listAsChunk( movi, false ) );
+    raff_Chunk* root = raff_listAsChunk( avi, true );
+    
+    assert( raff_serializeChunkToFile( root, "test-list.riff" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFileLazy( "test-list.riff" );
+    assert( file );
+    root = raff_fileAsChunk( file );
+    
+    checkQuery( root, "RIFF:AVI /LIST:hdrl/LIST:strl/strh", 2, '1' );
+    checkQuery( root, "/AVI /hdrl/*/strf", 2, '2' );
+    checkQuery( root, "AVI /hdrl/avih", 1, '5' );
+    checkQuery( root, "AVI /movi/00dc", 2, '6' );
+    checkQuery( root, "AVI /movi/0???", 3, '6' );
+    checkQuery( root, "AVI /**/DATA:str?", 4, '1' );
+    checkQuery( root, "AVI /**/LIST:strh", 0, 0 );
+    checkQuery( root, "LIST:AVI /hdrl", 0, 0 );
+    
+    assert( !raff_compileQuery( "AVI /**" ) );
+    assert( !raff_compileQuery( "AVI /toolong" ) );
+    assert( !raff_compileQuery( "JUNK:AVI " ) );
+    assert( raff_errorNum() == raff_ERR_BAD_QUERY );
+    
+    raff_closeFile( file );
+    remove( "test-list.riff" );
+}
+
+#define NUM_UNIQUE 1001
+
+// Tests the child tables of parsed lists; a list of chunks with
+// distinct IDs is parsed back and each is looked up, which has
+// to give the same handle as walking the list; and the list
+// still works once it's been changed.
+static void
+testTable( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* list = raff_newList( file, raff_newID( "TABL" ) );
+    for( int i = 0 ; i < NUM_UNIQUE ; i++ ) {
+        char id[5];
+        sprintf( id, "%04d", i );
+        raff_Data* data = raff_newData( file, raff_newID( id ), id, 4 );
+        raff_append( list, raff_dataAsChunk( data ) );
+    }
+    assert( raff_serializeChunkToFile( raff_listAsChunk( list, true ), "test-list.riff" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( "test-list.riff" );
+    list = raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( list );
+    
+    // Look some up before walking, and the rest after.
+    raff_Chunk* found[NUM_UNIQUE];
+    for( int i = 0 ; i < NUM_UNIQUE ; i += 7 ) {
+        char id[5];
+        sprintf( id, "%04d", i );
+        found[i] = raff_findID( list, raff_newID( id ) );
+        assert( found[i] && !memcmp( raff_dataContent( raff_chunkAsData( found[i] ) ), id, 4 ) );
+        assert( !raff_findNextID( list, found[i] ) );
+    }
+    
+    int         count = 0;
+    raff_Chunk* iter;
+    raff_start( list );
+    while( ( iter = raff_next( list ) ) ) {
+        char id[12];
+        sprintf( id, "%04d", count );
+        if( count % 7 == 0 )
+            assert( found[count] == iter );
+        assert( raff_findID( list, raff_newID( id ) ) == iter );
+        count++;
+    }
+    assert( count == NUM_UNIQUE );
+    assert( !raff_findID( list, raff_newID( "none" ) ) );
+    
+    raff_ID id;
+    size_t  size;
+    count = 0;
+    raff_start( list );
+    while( raff_nextInfo( list, &id, &size ) ) {
+        char expect[12];
+        sprintf( expect, "%04d", count++ );
+        assert( id == raff_newID( expect ) && size == 4 );
+    }
+    assert( count == NUM_UNIQUE );
+    
+    // A change turns it into an ordinary list.
+    raff_Chunk* extra = raff_dataAsChunk( raff_newData( file, raff_newID( "0000" ), "more", 4 ) );
+    raff_append( list, extra );
+    assert( raff_findNextID( list, raff_findID( list, raff_newID( "0000" ) ) ) == extra );
+    assert( raff_findID( list, raff_newID( "0994" ) ) == found[994] );
+    
+    raff_closeFile( file );
+    remove( "test-list.riff" );
+}
+
+#define NUM_RECS 300
+
+// Checks a tree written by testTree(), parsed or not.
+static void
+checkTree( raff_Chunk* root ) {
+    raff_List* avi = raff_chunkAsList( root );
+    assert( avi );
+    
+    raff_List* hdrl = raff_chunkAsList( raff_findID( avi, raff_newID( "hdrl" ) ) );
+    assert( hdrl );
+    int strls = 0;
+    for( raff_Chunk* iter = raff_findID( hdrl, raff_newID( "strl" ) ) ; iter ;
+         iter = raff_findNextID( hdrl, iter ) ) {
+        raff_List* strl = raff_chunkAsList( iter );
+        raff_Data* strh = raff_chunkAsData( raff_findID( strl, raff_newID( "strh" ) ) );
+        assert( raff_dataContent( strh )[0] == '0' + strls );
+        strls++;
+    }
+    assert( strls == 2 );
+    
+    raff_List* movi = raff_chunkAsList( raff_findID( avi, raff_newID( "movi" ) ) );
+    assert( movi );
+    int recs = 0;
+    raff_start( movi );
+    for( raff_Chunk* rec ; ( rec = raff_next( movi ) ) ; recs++ ) {
+        raff_List* ls = raff_chunkAsList( rec );
+        assert( ls && raff_getID( rec ) == raff_newID( "rec " ) );
+        
+        raff_Data* video = raff_chunkAsData( raff_findID( ls, raff_newID( "00dc" ) ) );
+        raff_Data* audio = raff_chunkAsData( raff_findID( ls, raff_newID( "01wb" ) ) );
+        assert( video && audio );
+        assert( raff_dataSize( video ) == (size_t)( 1 + recs % 37 ) );
+        assert( raff_dataContent( video )[recs % 37] == (char)recs );
+        assert( raff_dataSize( audio ) == 4 );
+    }
+    assert( recs == NUM_RECS );
+}
+
+// Tests parsing a whole tree at once, with different numbers
+// of workers and each of the open modes.
+static void
+testTree( void ) {
+    raff_File* file = raff_newFile();
+    
+    raff_List* hdrl = raff_newList( file, raff_newID( "hdrl" ) );
+    for( int i = 0 ; i < 2 ; i++ ) {
+        char       n    = '0' + i;
+        raff_List* strl = raff_newList( file, raff_newID( "strl" ) );
+        raff_append( strl, raff_dataAsChunk( raff_newData( file, raff_newID( "strh" ), &n, 1 ) ) );
+        raff_append( hdrl, raff_listAsChunk( strl, false ) );
+    }
+    
+    raff_List* movi = raff_newList( file, raff_newID( "movi" ) );
+    for( int i = 0 ; i < NUM_RECS ; i++ ) {
+        char frame[37];
+        memset( frame, i, sizeof(frame) );
+        
+        raff_List* rec = raff_newList( file, raff_newID( "rec " ) );
+        raff_append( rec, raff_dataAsChunk( raff_newData( file, raff_newID( "00dc" ), frame, 1 + i % 37 ) ) );
+        raff_append( rec, raff_dataAsChunk( raff_newData( file, raff_newID( "01wb" ), "abcd", 4 ) ) );
+        raff_append( movi, raff_listAsChunk( rec, false ) );
+    }
+    
+    raff_List* avi = raff_newList( file, raff_newID( "AVI " ) );
+    raff_append( avi, raff_listAsChunk( hdrl, false ) );
+    raff_append( avi, raff_listAsChunk( movi, false ) );
+    
+    // A tree built in memory can be parsed too.
+    raff_Chunk* root = raff_listAsChunk( avi, true );
+    assert( raff_parseTree( root, 4 ) == raff_ERR_NONE );
+    assert( raff_serializeChunkToFile( root, "test-list.riff" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    unsigned workers[] = { 0, 1, 2, 7 };
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        for( int w = 0 ; w < 4 ; w++ ) {
+            if( mode == 0 )
+                file = raff_openFile( "test-list.riff" );
+            else
+            if( mode == 1 )
+                file = raff_mapFile( "test-list.riff", raff_ACCESS_RANDOM );
+            else
+                file = raff_openFileLazy( "test-list.riff" );
+            assert( file );
+            
+            assert( raff_parseTree( raff_fileAsChunk( file ), workers[w] ) == raff_ERR_NONE );
+            checkTree( raff_fileAsChunk( file ) );
+            raff_closeFile( file );
+        }
+    }
+    
+    // Break a chunk in the middle of the movi list, by giving
+    // it a size too big for its list.
+    FILE* f = fopen( "test-list.riff", "r+b" );
+    fseek( f, 0, SEEK_END );
+    long  size = ftell( f );
+    char* buf  = malloc( size );
+    fseek( f, 0, SEEK_SET );
+    assert( fread( buf, 1, size, f ) == (size_t)size );
+    
+    int found = 0;
+    for( long i = 0 ; i < size - 8 ; i++ ) {
+        if( !memcmp( buf + i, "01wb", 4 ) && ++found == NUM_RECS / 2 ) {
+            fseek( f, i + 4, SEEK_SET );
+            fwrite( "\xFF\x00\x00\x00", 1, 4, f );
+            break;
+        }
+    }
+    free( buf );
+    fclose( f );
+    
+    file = raff_openFile( "test-list.riff" );
+    assert( file );
+    assert( raff_parseTree( raff_fileAsChunk( file ), 4 ) == raff_ERR_CORRUPT );
+    raff_closeFile( file );
+    
+    remove( "test-list.riff" );
+}
+
+// IDs with bytes of 0x80 or more should be found the same way
+// whether the list was built or parsed, lazily or not, and come
+// out in the file as they went in.
+static void
+testHighIDs( void ) {
+    char const* ids[] = { "abcd", "\xe9t\xe9x", "\xff\xff\xff\xff" };
+    raff_File*  file  = raff_newFile();
+    raff_List*  list  = raff_newList( file, raff_newID( "\x80igh" ) );
+    for( int i = 0 ; i < 3 ; i++ )
+        raff_append( list, raff_dataAsChunk( raff_newData( file, raff_newID( ids[i] ), ids[i], 4 ) ) );
+    for( int i = 0 ; i < 3 ; i++ ) {
+        assert( raff_newID( ids[i] ) >= 0 );
+        assert( raff_getID( raff_findID( list, raff_newID( ids[i] ) ) ) == raff_newID( ids[i] ) );
+    }
+    assert( raff_serializeChunkToFile( raff_listAsChunk( list, true ), "test-list.riff" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    char  bytes[64];
+    FILE* f = fopen( "test-list.riff", "rb" );
+    assert( fread( bytes, 1, sizeof(bytes), f ) == 12 + 3*12 );
+    fclose( f );
+    assert( !memcmp( bytes + 8, "\x80igh", 4 ) );
+    for( int i = 0 ; i < 3 ; i++ )
+        assert( !memcmp( bytes + 12 + 12*i, ids[i], 4 ) );
+    
+    for( int lazy = 0 ; lazy < 2 ; lazy++ ) {
+        file = lazy ? raff_openFileLazy( "test-list.riff" ) : raff_openFile( "test-list.riff" );
+        list = raff_chunkAsList( raff_fileAsChunk( file ) );
+        assert( raff_getID( raff_fileAsChunk( file ) ) == raff_newID( "\x80igh" ) );
+        for( int i = 0 ; i < 3 ; i++ ) {
+            raff_Chunk* chunk = raff_findID( list, raff_newID( ids[i] ) );
+            assert( chunk && raff_getID( chunk ) == raff_newID( ids[i] ) );
+        }
+        
+        raff_ID id;
+        size_t  size;
+        raff_start( list );
+        for( int i = 0 ; i < 3 ; i++ )
+            assert( raff_nextInfo( list, &id, &size ) && id == raff_newID( ids[i] ) );
+        raff_closeFile( file );
+    }
+    remove( "test-list.riff" );
+}
+
+#define DEEP_COUNT 400000
+
+static void
+putHead( FILE* f, char const* id, size_t size, char const* sub ) {
+    unsigned char b[4] = { size, size >> 8, size >> 16, size >> 24 };
+    fwrite( id, 1, 4, f );
+    fwrite( b, 1, 4, f );
+    fwrite( sub, 1, 4, f );
+}
+
+// Tests a file that's nothing but lists, each in the one before.
+static void
+testDeep( void ) {
+    FILE* f = fopen( "test-list.riff", "wb" );
+    putHead( f, "RIFF", 4 + 12*( DEEP_COUNT - 1 ), "DEEP" );
+    for( size_t i = 1 ; i < DEEP_COUNT ; i++ )
+        putHead( f, "LIST", 4 + 12*( DEEP_COUNT - 1 - i ), "nest" );
+    fclose( f );
+    
+    raff_File* file = raff_openFile( "test-list.riff" );
+    assert( file );
+    raff_Chunk* root  = raff_fileAsChunk( file );
+    raff_Query* query = raff_compileQuery( "**/zzzz" );
+    int         calls = 0;
+    assert( raff_queryAll( query, root, countCb, &calls ) == 0 );
+    raff_freeQuery( query );
+    
+    query = raff_compileQuery( "DEEP/**/nest" );
+    assert( raff_queryAll( query, root, countCb, &calls ) == DEEP_COUNT - 1 );
+    raff_freeQuery( query );
+    raff_closeFile( file );
+    
+    file = raff_openFile( "test-list.riff" );
+    assert( raff_parseTree( raff_fileAsChunk( file ), 1 ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    remove( "test-list.riff" );
+}
+
+int
+main( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* list = raff_newList( file, raff_newID( "TEST" ) );
+    for( int i = 0 ; i < NUM_CHUNKS ; i++ ) {
+        char       pos  = i;
+        raff_Data* data = raff_newData( file, raff_newID( ids[i % 3] ), &pos, 1 );
+        raff_append( list, raff_dataAsChunk( data ) );
+    }
+    checkList( list );
+    
+    raff_Chunk* chunk = raff_listAsChunk( list, true );
+    assert( raff_serializeChunkToFile( chunk, "test-list.riff" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( "test-list.riff" );
+    assert( file );
+    list = raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( list );
+    checkList( list );
+    
+    // Adding chunks to an indexed list should keep the
+    // index up to date.
+    char       pos   = 200;
+    raff_Data* back  = raff_newData( file, raff_newID( "aaaa" ), &pos, 1 );
+    raff_append( list, raff_dataAsChunk( back ) );
+    checkID( list, "aaaa", 0, 35 );
+    
+    pos = 0;
+    raff_Data* front = raff_newData( file, raff_newID( "dddd" ), &pos, 1 );
+    raff_prepend( list, raff_dataAsChunk( front ) );
+    checkID( list, "dddd", 0, 1 );
+    
+    raff_closeFile( file );
+    remove( "test-list.riff" );
+    
+    testTable();
+    testQueries();
+    testTree();
+    testHighIDs();
+    testDeep();
+    
+    printf( "Passed: List Test\n" );
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "raff.h"
 
 // Tests parsing capabilities of raff.  Note that I use
@@ -10,12 +11,46 @@
 // So this test should fail on big endian architectures.
 // This test parses the sample.wav WAV file.
 
-int
-main( void ) {
+// Streams as they were before raff_StreamEx, with just next()
+// and close(); whatever follows them shouldn't be looked at.
+typedef struct PlainStream {
+    raff_Stream s;
+    void*       junk[3];
+    FILE*       f;
+} PlainStream;
 
-    // Open the file.
-    raff_File* file = raff_openFile( "sample.wav" );
-    assert( file );
+typedef struct ExStream {
+    raff_StreamEx s;
+    FILE*         f;
+} ExStream;
+
+static int
+plainNext( raff_Stream* s ) {
+    return fgetc( ((PlainStream*)s)->f );
+}
+
+static void
+plainClose( raff_Stream* s ) {
+    fclose( ((PlainStream*)s)->f );
+}
+
+static int
+exNext( raff_Stream* s ) {
+    return fgetc( ((ExStream*)s)->f );
+}
+
+static size_t
+exRead( raff_Stream* s, char* buf, size_t size ) {
+    return fread( buf, 1, size, ((ExStream*)s)->f );
+}
+
+static void
+exClose( raff_Stream* s ) {
+    fclose( ((ExStream*)s)->f );
+}
+
+static void
+checkSample( raff_File* file ) {
     
     // Re-interpret as a chunk.
     raff_Chunk* riffCk = raff_fileAsChunk( file );
@@ -84,6 +119,12 @@ main( void ) {
     raff_Data* dataDat = raff_chunkAsData( dataCk );
     assert( dataDat );
     
+    // Read part of the data without the whole content.
+    uint16_t part[2];
+    size_t   got = raff_dataRead( dataDat, 4, (char*)part, sizeof(part) );
+    assert( got == 4 );
+    assert( part[0] == 65508 && part[1] == 65533 );
+    
     char const* dataBuf = raff_dataContent( dataDat );
     
     // Sample 1
@@ -97,8 +138,47 @@ main( void ) {
     uint16_t s2c2 = *(uint16_t*)( dataBuf + 6 );
     assert( s2c1 == 65508 );
     assert( s2c2 == 65533 );
+}
+
+int
+main( void ) {
+
+    // Open the file.
+    raff_File* file = raff_openFile( "sample.wav" );
+    assert( file );
+    checkSample( file );
+    raff_closeFile( file );
+    
+    // Same again, but with the file mapped into memory
+    // instead of read.
+    file = raff_mapFile( "sample.wav", raff_ACCESS_RANDOM );
+    assert( file );
+    checkSample( file );
+    raff_closeFile( file );
     
+    // And lazily, reading only what's asked for.
+    file = raff_openFileLazy( "sample.wav" );
+    assert( file );
+    checkSample( file );
+    raff_closeFile( file );
+    
+    // And from streams, with and without the extra methods.
+    PlainStream plain;
+    memset( &plain, 0xAB, sizeof(plain) );
+    plain.s.next  = plainNext;
+    plain.s.close = plainClose;
+    plain.f       = fopen( "sample.wav", "rb" );
+    file = raff_openStream( &plain.s );
+    assert( file );
+    checkSample( file );
     raff_closeFile( file );
+    
+    ExStream ex = { { { exNext, exClose }, exRead, NULL, NULL }, fopen( "sample.wav", "rb" ) };
+    file = raff_openStreamEx( &ex.s );
+    assert( file );
+    checkSample( file );
+    raff_closeFile( file );
+    
     printf( "Passed: Parse Test\n" );
     return 0;
 }
@@ -0,0 +1,266 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests the push parser.  Files are written, then walked to find
+// what the parser should give for them; and fed to it whole, a byte
+// at a time, and in pieces of odd sizes.  Every chunk should begin
+// and end in order, nested properly, with its content pieced back
+// together.  An RF64 file is put together by hand to check its
+// sizes are found from the ds64 chunk; and skipping, stopping, and
+// broken files are checked.
+
+static char const* path = "test-push.riff";
+
+#define MAX_CHUNKS 16
+
+static raff_Visit    want[MAX_CHUNKS];
+static char          wantContent[MAX_CHUNKS][32];
+static size_t        wantCount;
+static unsigned char bytes[512];
+static size_t        byteCount;
+
+static raff_WalkAction
+collect( raff_Visit const* visit, void* user ) {
+    (void)user;
+    assert( wantCount < MAX_CHUNKS );
+    if( !visit->list ) {
+        assert( visit->size <= sizeof(wantContent[0]) );
+        memcpy( wantContent[wantCount], visit->content, visit->size );
+    }
+    want[wantCount++] = *visit;
+    return raff_WALK_CONTINUE;
+}
+
+// Walks the file written to find what pushing it should give, and
+// reads it in to be pushed.
+static void
+load( void ) {
+    raff_File* file = raff_openFile( path );
+    assert( file );
+    wantCount = 0;
+    assert( raff_walk( raff_fileAsChunk( file ), collect, NULL ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    FILE* f = fopen( path, "rb" );
+    byteCount = fread( bytes, 1, sizeof(bytes), f );
+    fclose( f );
+}
+
+typedef struct Pushed {
+    size_t      begun;
+    size_t      ended;
+    size_t      open[MAX_CHUNKS];
+    size_t      depth;
+    char        content[32];
+    char const* skip;
+    char const* skipContent;
+    char const* stop;
+} Pushed;
+
+static bool
+sameChunk( raff_Visit const* a, raff_Visit const* b ) {
+    return a->depth == b->depth && a->list == b->list && a->riff == b->riff &&
+           a->id == b->id && a->size == b->size && a->offset == b->offset;
+}
+
+static raff_WalkAction
+handle( raff_PushEvent const* event, void* user ) {
+    Pushed* p = user;
+    assert( !event->chunk.content );
+    switch( event->kind ) {
+        case raff_PUSH_BEGIN: {
+            // Chunks in skipped lists aren't begun.
+            while( p->skip && want[p->begun].id != event->chunk.id )
+                p->begun++;
+            assert( p->begun < wantCount );
+            assert( sameChunk( &event->chunk, &want[p->begun] ) );
+            p->open[p->depth++] = p->begun++;
+            memset( p->content, 0, sizeof(p->content) );
+            
+            if( p->skip && event->chunk.id == raff_newID( p->skip ) )
+                return raff_WALK_SKIP;
+            if( p->stop && event->chunk.id == raff_newID( p->stop ) )
+                return raff_WALK_STOP;
+            break;
+        }
+        case raff_PUSH_CONTENT: {
+            assert( p->depth > 0 );
+            raff_Visit const* chunk = &want[p->open[p->depth - 1]];
+            assert( !chunk->list && sameChunk( &event->chunk, chunk ) );
+            assert( event->pieceSize > 0 );
+            assert( event->pieceOffset + event->pieceSize <= chunk->size );
+            memcpy( p->content + event->pieceOffset, event->piece, event->pieceSize );
+            
+            if( p->skipContent && event->chunk.id == raff_newID( p->skipContent ) )
+                return raff_WALK_SKIP;
+            break;
+        }
+        case raff_PUSH_END: {
+            assert( p->depth > 0 );
+            size_t at = p->open[--p->depth];
+            assert( sameChunk( &event->chunk, &want[at] ) );
+            if( !want[at].list && !( p->skipContent && event->chunk.id == raff_newID( p->skipContent ) ) )
+                assert( !memcmp( p->content, wantContent[at], want[at].size ) );
+            p->ended++;
+            break;
+        }
+    }
+    return raff_WALK_CONTINUE;
+}
+
+// Pushes the file in pieces of the given sizes, taken in turn.
+static raff_Error
+push( Pushed* p, size_t const* steps, size_t stepCount, size_t size ) {
+    raff_Parser* parser = raff_newParser( handle, p );
+    size_t       at     = 0;
+    for( size_t i = 0 ; at < size ; i++ ) {
+        size_t n = steps[i % stepCount];
+        if( n > size - at )
+            n = size - at;
+        raff_Error err = raff_parserFeed( parser, (char*)bytes + at, n );
+        at += n;
+        if( err != raff_ERR_NONE ) {
+            assert( raff_closeParser( parser ) == err );
+            return err;
+        }
+    }
+    return raff_closeParser( parser );
+}
+
+static void
+checkAll( void ) {
+    size_t const whole[] = { sizeof(bytes) };
+    size_t const one[]   = { 1 };
+    size_t const odd[]   = { 3, 1, 7, 2, 13, 5 };
+    size_t const* steps[] = { whole, one, odd };
+    size_t const  counts[] = { 1, 1, 6 };
+    for( int s = 0 ; s < 3 ; s++ ) {
+        Pushed p = { 0 };
+        assert( push( &p, steps[s], counts[s], byteCount ) == raff_ERR_NONE );
+        assert( p.begun == wantCount && p.ended == wantCount && p.depth == 0 );
+        
+        // Bytes after the end are ignored.
+        memset( &p, 0, sizeof(p) );
+        bytes[byteCount] = 'x';
+        assert( push( &p, steps[s], counts[s], byteCount + 1 ) == raff_ERR_NONE );
+        assert( p.ended == wantCount );
+    }
+}
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, strlen( content ) ) );
+}
+
+static void
+generate( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* deep = raff_newList( file, raff_newID( "deep" ) );
+    raff_append( deep, newData( file, "leaf", "odd" ) );
+    
+    raff_List* item = raff_newList( file, raff_newID( "item" ) );
+    raff_append( item, newData( file, "data", "some content" ) );
+    raff_append( item, newData( file, "none", "" ) );
+    raff_append( item, raff_listAsChunk( deep, false ) );
+    
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, newData( file, "head", "header" ) );
+    raff_append( root, raff_listAsChunk( item, false ) );
+    raff_append( root, raff_listAsChunk( raff_newList( file, raff_newID( "empt" ) ), false ) );
+    raff_append( root, newData( file, "tail", "tail" ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( root, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+}
+
+static void
+put( char const* b, size_t size ) {
+    memcpy( bytes + byteCount, b, size );
+    byteCount += size;
+}
+
+static void
+put32( unsigned long v ) {
+    unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    put( (char*)b, 4 );
+}
+
+// An RF64 file whose RIFF and data sizes are only in the ds64.
+static void
+generateRF64( void ) {
+    byteCount = 0;
+    put( "RF64", 4 );
+    put32( 0xFFFFFFFF );
+    put( "WAVE", 4 );
+    put( "ds64", 4 );
+    put32( 28 );
+    put32( 4 + 36 + 12 + 14 );
+    put32( 0 );
+    put32( 6 );
+    put32( 0 );
+    put32( 0 );
+    put32( 0 );
+    put32( 0 );
+    put( "fmt ", 4 );
+    put32( 4 );
+    put( "abcd", 4 );
+    put( "data", 4 );
+    put32( 0xFFFFFFFF );
+    put( "sample", 6 );
+    
+    FILE* f = fopen( path, "wb" );
+    assert( fwrite( bytes, 1, byteCount, f ) == byteCount );
+    fclose( f );
+}
+
+int
+main( void ) {
+    generate();
+    load();
+    checkAll();
+    
+    // Skipping a list leaves out what's in it, and skipping content
+    // leaves out the rest of it.
+    size_t const one[] = { 1 };
+    Pushed p = { 0 };
+    p.skip = "item";
+    assert( push( &p, one, 1, byteCount ) == raff_ERR_NONE );
+    assert( p.ended == wantCount - 4 && p.depth == 0 );
+    
+    memset( &p, 0, sizeof(p) );
+    p.skipContent = "data";
+    assert( push( &p, one, 1, byteCount ) == raff_ERR_NONE );
+    assert( p.ended == wantCount );
+    
+    // Stopping isn't an error, though nothing more is given.
+    memset( &p, 0, sizeof(p) );
+    p.stop = "deep";
+    assert( push( &p, one, 1, byteCount ) == raff_ERR_NONE );
+    assert( p.begun == 6 && p.ended == 3 );
+    
+    // Files cut short don't end.
+    memset( &p, 0, sizeof(p) );
+    assert( push( &p, one, 1, byteCount - 3 ) == raff_ERR_CORRUPT );
+    assert( p.depth == 2 );
+    
+    // The tail chunk's size runs past the end of the file.
+    memset( &p, 0, sizeof(p) );
+    bytes[byteCount - 8] = 9;
+    assert( push( &p, one, 1, byteCount ) == raff_ERR_CORRUPT );
+    assert( p.begun == wantCount - 1 );
+    
+    memset( &p, 0, sizeof(p) );
+    memcpy( bytes, "JUNK", 4 );
+    assert( push( &p, one, 1, byteCount ) == raff_ERR_NOT_RIFF );
+    assert( p.begun == 0 );
+    
+    generateRF64();
+    load();
+    assert( wantCount == 4 && want[0].size == 62 && want[3].size == 6 );
+    checkAll();
+    
+    remove( path );
+    printf( "Passed: Push Test\n" );
+    return 0;
+}
@@ -0,0 +1,382 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests RF64 support.  This is built together with raff.c
+// with RAFF_SIZE_LIMIT lowered to 1024, so a few KiB is enough
+// to go over the limit instead of 4 GiB.  A WAV like file with
+// a big data chunk and a big INFO list is written, which should
+// come out as RF64 with a ds64 chunk; then it's opened with
+// each of the open modes to check the sizes are read back, and
+// written again to check it comes out the same.
+
+static char const* path = "test-rf64.wav";
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content, size_t size ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, size ) );
+}
+
+static uint32_t
+get32( unsigned char const* b ) {
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint64_t
+get64( unsigned char const* b ) {
+    return get32( b ) | (uint64_t)get32( b + 4 ) << 32;
+}
+
+static void
+put64( unsigned char* b, uint64_t v ) {
+    for( int i = 0 ; i < 8 ; i++ )
+        b[i] = (unsigned char)( v >> 8*i );
+}
+
+// A stream over bytes in memory, which doesn't know its length.
+typedef struct ByteStream {
+    raff_Stream          stream;
+    unsigned char const* bytes;
+    size_t               size;
+    size_t               pos;
+} ByteStream;
+
+static int
+byteNext( raff_Stream* stream ) {
+    ByteStream* bs = (ByteStream*)stream;
+    return bs->pos < bs->size ? bs->bytes[bs->pos++] : -1;
+}
+
+static raff_WalkAction
+pushed( raff_PushEvent const* event, void* user ) {
+    (void)event;
+    (void)user;
+    return raff_WALK_CONTINUE;
+}
+
+static unsigned char*
+readAll( char const* p, size_t* size ) {
+    FILE* f = fopen( p, "rb" );
+    assert( f );
+    fseek( f, 0, SEEK_END );
+    *size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    
+    unsigned char* buf = malloc( *size );
+    assert( fread( buf, 1, *size, f ) == *size );
+    fclose( f );
+    return buf;
+}
+
+static void
+generate( void ) {
+    static char samples[2000];
+    static char name[1500];
+    for( size_t i = 0 ; i < sizeof(samples) ; i++ )
+        samples[i] = i * 7;
+    memset( name, 'n', sizeof(name) );
+    
+    // Format with a block alignment of 4 bytes.
+    char fmt[16] = { 1, 0, 2, 0, 0x44, 0xAC, 0, 0, 0x10, 0xB1, 2, 0, 4, 0, 16, 0 };
+    
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, newData( file, "fmt ", fmt, sizeof(fmt) ) );
+    raff_append( wave, newData( file, "data", samples, sizeof(samples) ) );
+    
+    raff_List* info = raff_newList( file, raff_newID( "INFO" ) );
+    raff_append( info, newData( file, "INAM", name, sizeof(name) ) );
+    raff_append( wave, raff_listAsChunk( info, false ) );
+    
+    raff_append( wave, newData( file, "smol", "tiny", 4 ) );
+    
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+}
+
+static void
+checkFormat( void ) {
+    size_t         size;
+    unsigned char* buf = readAll( path, &size );
+    
+    assert( !memcmp( buf, "RF64", 4 ) );
+    assert( get32( buf + 4 ) == 0xFFFFFFFF );
+    assert( !memcmp( buf + 8, "WAVE", 4 ) );
+    assert( !memcmp( buf + 12, "ds64", 4 ) );
+    
+    // Two table entries, for the INFO list and INAM chunk.
+    uint32_t ds64Size = get32( buf + 16 );
+    assert( ds64Size == 28 + 2*12 );
+    assert( get64( buf + 20 ) + 8 == size );
+    assert( get64( buf + 28 ) == 2000 );
+    assert( get64( buf + 36 ) == 500 );
+    assert( get32( buf + 44 ) == 2 );
+    assert( !memcmp( buf + 48, "LIST", 4 ) );
+    assert( get64( buf + 52 ) == 4 + 8 + 1500 );
+    assert( !memcmp( buf + 60, "INAM", 4 ) );
+    assert( get64( buf + 64 ) == 1500 );
+    
+    // Chunks that fit keep their sizes.
+    unsigned char* fmt = buf + 20 + ds64Size;
+    assert( !memcmp( fmt, "fmt ", 4 ) );
+    assert( get32( fmt + 4 ) == 16 );
+    
+    unsigned char* data = fmt + 8 + 16;
+    assert( !memcmp( data, "data", 4 ) );
+    assert( get32( data + 4 ) == 0xFFFFFFFF );
+    free( buf );
+}
+
+static void
+checkTree( raff_File* file ) {
+    raff_List* wave = raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( wave );
+    
+    // The ds64 chunk shows up as a chunk of its own.
+    raff_start( wave );
+    raff_Chunk* first = raff_next( wave );
+    assert( first && raff_getID( first ) == raff_newID( "ds64" ) );
+    
+    raff_Data* data = raff_chunkAsData( raff_findID( wave, raff_newID( "data" ) ) );
+    assert( data && raff_dataSize( data ) == 2000 );
+    char const* samples = raff_dataContent( data );
+    for( size_t i = 0 ; i < 2000 ; i++ )
+        assert( samples[i] == (char)( i * 7 ) );
+    
+    raff_List* info = raff_chunkAsList( raff_findID( wave, raff_newID( "INFO" ) ) );
+    assert( info );
+    raff_Data* name = raff_chunkAsData( raff_findID( info, raff_newID( "INAM" ) ) );
+    assert( name && raff_dataSize( name ) == 1500 );
+    assert( raff_dataContent( name )[1499] == 'n' );
+    
+    raff_Data* smol = raff_chunkAsData( raff_findID( wave, raff_newID( "smol" ) ) );
+    assert( smol && raff_dataSize( smol ) == 4 );
+    assert( !memcmp( raff_dataContent( smol ), "tiny", 4 ) );
+}
+
+static void
+checkSame( char const* a, char const* b ) {
+    size_t         sizeA, sizeB;
+    unsigned char* bufA = readAll( a, &sizeA );
+    unsigned char* bufB = readAll( b, &sizeB );
+    assert( sizeA == sizeB );
+    assert( !memcmp( bufA, bufB, sizeA ) );
+    free( bufA );
+    free( bufB );
+}
+
+// Puts together an RF64 file by hand, with the given RIFF size
+// and size in the ds64 table for a junk chunk.
+static size_t
+hostile( unsigned char* b, uint64_t riffSize, uint64_t junkSize ) {
+    size_t n = 0;
+    memcpy( b + n, "RF64\xFF\xFF\xFF\xFFWAVEds64", 16 );
+    n += 16;
+    memcpy( b + n, "\x28\0\0\0", 4 );
+    n += 4;
+    put64( b + n, riffSize );
+    put64( b + n + 8, 0 );
+    put64( b + n + 16, 0 );
+    put64( b + n + 24, 1 );
+    memcpy( b + n + 28, "junk", 4 );
+    put64( b + n + 32, junkSize );
+    n += 40;
+    memcpy( b + n, "junk\xFF\xFF\xFF\xFFjunkjunk", 16 );
+    n += 16;
+    memcpy( b + n, "data\x08\0\0\0datadata", 16 );
+    n += 16;
+    memcpy( b + n, "tail\x10\0\0\0tailtailtailtail", 24 );
+    n += 24;
+    if( riffSize == 0 )
+        put64( b + 20, n - 8 );
+    return n;
+}
+
+static void
+writeFile( char const* p, unsigned char const* b, size_t size ) {
+    FILE* f = fopen( p, "wb" );
+    assert( fwrite( b, 1, size, f ) == size );
+    fclose( f );
+}
+
+// Sizes in the ds64 chunk come straight from the file, so ones
+// big enough to wrap around, or that could never be read in,
+// should just be corrupt.
+static void
+checkHostile( void ) {
+    unsigned char b[128];
+    size_t        size = hostile( b, 0, (uint64_t)0 - 56 );
+    writeFile( path, b, size );
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        raff_File* file = mode == 0 ? raff_openFile( path ) :
+                          mode == 1 ? raff_mapFile( path, raff_ACCESS_RANDOM ) :
+                                      raff_openFileLazy( path );
+        assert( file );
+        assert( !raff_chunkAsList( raff_fileAsChunk( file ) ) );
+        assert( raff_errorNum() == raff_ERR_CORRUPT );
+        raff_closeFile( file );
+    }
+    
+    size = hostile( b, (uint64_t)1 << 62, 8 );
+    writeFile( path, b, size );
+    assert( !raff_openFile( path ) );
+    assert( raff_errorNum() == raff_ERR_CORRUPT );
+    
+    ByteStream bs = { .stream = { .next = byteNext }, .bytes = b, .size = size };
+    assert( !raff_openStream( &bs.stream ) );
+    assert( raff_errorNum() == raff_ERR_CORRUPT );
+    
+    size = hostile( b, (uint64_t)0 - 1, 8 );
+    raff_Parser* parser = raff_newParser( pushed, NULL );
+    raff_parserFeed( parser, (char*)b, size );
+    assert( raff_closeParser( parser ) == raff_ERR_CORRUPT );
+}
+
+// The streaming writer turns its reserved junk chunk into the
+// ds64 chunk when the file gets too big.
+// Appending in place can't take a RIFF file past the limit, for
+// lists too, whose headers are 12 bytes rather than 8.
+static void
+checkAppend( void ) {
+    static char filler[1024];
+    for( size_t n = 980 ; n < 1010 ; n++ ) {
+        raff_File* file = raff_newFile();
+        raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+        raff_append( wave, newData( file, "fill", filler, n ) );
+        assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+        raff_closeFile( file );
+        
+        file = raff_openFile( path );
+        assert( file );
+        raff_List*  root = raff_chunkAsList( raff_fileAsChunk( file ) );
+        raff_Chunk* list = raff_listAsChunk( raff_newList( file, raff_newID( "INFO" ) ), false );
+        raff_Error  err  = raff_appendInPlace( root, list );
+        assert( err == raff_ERR_NONE || err == raff_ERR_CANT_EDIT );
+        raff_closeFile( file );
+        
+        size_t         size;
+        unsigned char* buf = readAll( path, &size );
+        assert( !memcmp( buf, "RIFF", 4 ) );
+        assert( get32( buf + 4 ) <= 1024 && get32( buf + 4 ) + 8 == size );
+        free( buf );
+    }
+}
+
+static void
+checkWriter( void ) {
+    char fmt[16] = { 1, 0, 2, 0, 0x44, 0xAC, 0, 0, 0x10, 0xB1, 2, 0, 4, 0, 16, 0 };
+    
+    raff_Writer* writer = raff_newWriter( path, raff_newID( "WAVE" ) );
+    assert( writer );
+    raff_writerBeginData( writer, raff_newID( "fmt " ) );
+    raff_writerWrite( writer, fmt, 13 );
+    raff_writerWrite( writer, fmt + 13, 3 );
+    raff_writerEndData( writer );
+    raff_writerBeginData( writer, raff_newID( "data" ) );
+    for( int i = 0 ; i < 100 ; i++ )
+        raff_writerWrite( writer, "0123456789abcdefghij", 20 );
+    assert( raff_closeWriter( writer ) == raff_ERR_NONE );
+    
+    size_t         size;
+    unsigned char* buf = readAll( path, &size );
+    assert( !memcmp( buf, "RF64", 4 ) );
+    assert( get32( buf + 4 ) == 0xFFFFFFFF );
+    assert( !memcmp( buf + 12, "ds64", 4 ) );
+    assert( get32( buf + 16 ) == 28 );
+    assert( get64( buf + 20 ) + 8 == size );
+    assert( get64( buf + 28 ) == 2000 );
+    assert( get64( buf + 36 ) == 500 );
+    assert( get32( buf + 44 ) == 0 );
+    free( buf );
+    
+    raff_File* file = raff_openFile( path );
+    assert( file );
+    raff_List* wave = raff_chunkAsList( raff_fileAsChunk( file ) );
+    raff_Data* data = raff_chunkAsData( raff_findID( wave, raff_newID( "data" ) ) );
+    assert( data && raff_dataSize( data ) == 2000 );
+    assert( !memcmp( raff_dataContent( data ) + 1980, "0123456789abcdefghij", 20 ) );
+    
+    // Written again it comes out the same.
+    assert( raff_serializeChunkToFile( raff_fileAsChunk( file ), "test-rf64-copy.wav" ) == raff_ERR_NONE );
+    checkSame( path, "test-rf64-copy.wav" );
+    raff_closeFile( file );
+    
+    // Other chunks can't be that big, there's no room for them
+    // in the ds64 chunk.
+    writer = raff_newWriter( path, raff_newID( "WAVE" ) );
+    raff_writerBeginList( writer, raff_newID( "INFO" ) );
+    raff_writerBeginData( writer, raff_newID( "INAM" ) );
+    for( int i = 0 ; i < 100 ; i++ )
+        raff_writerWrite( writer, "0123456789abcdefghij", 20 );
+    assert( raff_writerEndData( writer ) == raff_ERR_CANT_WRITE );
+    assert( raff_closeWriter( writer ) == raff_ERR_CANT_WRITE );
+}
+
+int
+main( void ) {
+    generate();
+    checkFormat();
+    
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        raff_File* file;
+        if( mode == 0 )
+            file = raff_openFile( path );
+        else
+        if( mode == 1 )
+            file = raff_mapFile( path, raff_ACCESS_RANDOM );
+        else
+            file = raff_openFileLazy( path );
+        assert( file );
+        
+        checkTree( file );
+        
+        // Written again it should come out the same, with the
+        // old ds64 chunk replaced by a new one.
+        raff_Chunk* root = raff_fileAsChunk( file );
+        assert( raff_serializeChunkToFile( root, "test-rf64-copy.wav" ) == raff_ERR_NONE );
+        checkSame( path, "test-rf64-copy.wav" );
+        
+        // Same through the serialization stream.
+        FILE*        f      = fopen( "test-rf64-copy.wav", "rb" );
+        raff_Stream* stream = raff_serializeChunk( root );
+        int          c;
+        do {
+            c = stream->next( stream );
+            assert( c == fgetc( f ) );
+        } while( c >= 0 );
+        stream->close( stream );
+        fclose( f );
+        
+        raff_closeFile( file );
+    }
+    
+    // Without the big chunks it goes back to being RIFF, and
+    // the old ds64 chunk is left out.
+    raff_File* file = raff_openFile( path );
+    raff_List* wave = raff_chunkAsList( raff_fileAsChunk( file ) );
+    raff_List* copy = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_start( wave );
+    raff_append( copy, raff_copyChunk( raff_next( wave ) ) );
+    raff_append( copy, raff_copyChunk( raff_next( wave ) ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( copy, true ), "test-rf64-copy.wav" ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    size_t         size;
+    unsigned char* buf = readAll( "test-rf64-copy.wav", &size );
+    assert( !memcmp( buf, "RIFF", 4 ) );
+    assert( get32( buf + 4 ) + 8 == size );
+    assert( !memcmp( buf + 12, "fmt ", 4 ) );
+    free( buf );
+    
+    checkWriter();
+    checkHostile();
+    checkAppend();
+    
+    remove( "test-rf64-copy.wav" );
+    remove( path );
+    printf( "Passed: RF64 Test\n" );
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests stats and hooks, so has to be built with RAFF_STATS.  A
+// file of a few lists is written then opened each way, checking
+// what's counted for the file and globally, and which hooks are
+// called around what.
+
+static char const* path      = "test-stats.riff";
+static char const* indexPath = "test-stats.rafx";
+
+#define LISTS  3
+#define CHUNKS 10
+
+typedef struct Event {
+    raff_Phase phase;
+    bool       end;
+    raff_File* file;
+} Event;
+
+static Event  events[16];
+static size_t eventCount;
+
+static void
+record( raff_Phase phase, bool end, raff_File* file, void* user ) {
+    assert( user == path );
+    assert( eventCount < sizeof(events)/sizeof(events[0]) );
+    events[eventCount].phase = phase;
+    events[eventCount].end   = end;
+    events[eventCount].file  = file;
+    eventCount++;
+}
+
+// Checks the hooks called since last time were a begin and end
+// of the given phase, and takes them off.
+static void
+checkPhase( raff_Phase phase, raff_File* begin, raff_File* end ) {
+    assert( eventCount == 2 );
+    assert( events[0].phase == phase && !events[0].end && events[0].file == begin );
+    assert( events[1].phase == phase && events[1].end && events[1].file == end );
+    eventCount = 0;
+}
+
+static raff_WalkAction
+count( raff_Visit const* visit, void* user ) {
+    (void)visit;
+    (*(size_t*)user)++;
+    return raff_WALK_CONTINUE;
+}
+
+static size_t
+generate( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( "head" ), "header", 6 ) ) );
+    for( int l = 0 ; l < LISTS ; l++ ) {
+        raff_List* list = raff_newList( file, raff_newID( "item" ) );
+        for( int c = 0 ; c < CHUNKS ; c++ )
+            raff_append( list, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), "abc", 3 ) ) );
+        raff_append( root, raff_listAsChunk( list, false ) );
+    }
+    raff_append( root, raff_dataAsChunk( raff_newData( file, raff_newID( "tail" ), "tail", 4 ) ) );
+    
+    raff_Chunk* chunk = raff_listAsChunk( root, true );
+    eventCount = 0;
+    assert( raff_serializeChunkToFile( chunk, path ) == raff_ERR_NONE );
+    checkPhase( raff_PHASE_SERIALIZE, file, file );
+    
+    FILE* f = fopen( path, "rb" );
+    fseek( f, 0, SEEK_END );
+    size_t size = ftell( f );
+    fclose( f );
+    
+    raff_Stats stats;
+    raff_fileStats( file, &stats );
+    assert( stats.bytesSerialized == size );
+    assert( stats.allocs > 0 && stats.allocBytes > 0 );
+    assert( stats.bytesRead == 0 && stats.openTime == 0 );
+    raff_closeFile( file );
+    return size;
+}
+
+static void
+parseAll( raff_File* file ) {
+    raff_List* root = raff_chunkAsList( raff_fileAsChunk( file ) );
+    checkPhase( raff_PHASE_PARSE, file, file );
+    
+    raff_Chunk* iter;
+    raff_start( root );
+    while( ( iter = raff_next( root ) ) ) {
+        if( raff_chunkAsList( iter ) )
+            checkPhase( raff_PHASE_PARSE, file, file );
+    }
+    
+    // Lists already parsed aren't again.
+    raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( eventCount == 0 );
+}
+
+static void
+checkParsed( raff_File* file ) {
+    raff_Stats stats;
+    raff_fileStats( file, &stats );
+    assert( stats.listsParsed == 1 + LISTS );
+    assert( stats.chunksParsed == 2 + LISTS + LISTS*CHUNKS );
+    assert( stats.allocs > 0 && stats.allocBytes > 0 );
+}
+
+int
+main( void ) {
+    raff_setHooks( record, (void*)path );
+    size_t size = generate();
+    
+    raff_Stats before, after, stats;
+    raff_globalStats( &before );
+    
+    // Every byte of the file is read by an eager open.
+    raff_File* file = raff_openFile( path );
+    checkPhase( raff_PHASE_OPEN, NULL, file );
+    raff_fileStats( file, &stats );
+    assert( stats.bytesRead == size );
+    assert( stats.streamCalls > 0 );
+    assert( stats.listsParsed == 0 );
+    parseAll( file );
+    checkParsed( file );
+    raff_fileStats( file, &stats );
+    raff_closeFile( file );
+    
+    // Which the global counts have, even once the file's closed.
+    raff_globalStats( &after );
+    assert( after.bytesRead - before.bytesRead == stats.bytesRead );
+    assert( after.listsParsed - before.listsParsed == stats.listsParsed );
+    assert( after.chunksParsed - before.chunksParsed == stats.chunksParsed );
+    assert( after.allocs - before.allocs == stats.allocs );
+    assert( after.openTime - before.openTime == stats.openTime );
+    
+    // Workers' counts are added to the file's.
+    file = raff_openFile( path );
+    checkPhase( raff_PHASE_OPEN, NULL, file );
+    assert( raff_parseTree( raff_fileAsChunk( file ), 4 ) == raff_ERR_NONE );
+    checkPhase( raff_PHASE_PARSE, file, file );
+    checkParsed( file );
+    raff_closeFile( file );
+    
+    // Mapped files don't read anything, and walks don't allocate.
+    file = raff_mapFile( path, raff_ACCESS_SEQUENTIAL );
+    checkPhase( raff_PHASE_OPEN, NULL, file );
+    raff_fileStats( file, &before );
+    size_t visits = 0;
+    assert( raff_walk( raff_fileAsChunk( file ), count, &visits ) == raff_ERR_NONE );
+    assert( visits == 3 + LISTS + LISTS*CHUNKS );
+    raff_fileStats( file, &after );
+    assert( after.allocs == before.allocs && after.listsParsed == 0 );
+    parseAll( file );
+    checkParsed( file );
+    raff_fileStats( file, &stats );
+    assert( stats.bytesRead == 0 && stats.streamCalls == 0 );
+    raff_closeFile( file );
+    
+    // Lazily opened files only read what they need, as it's needed.
+    file = raff_openFileLazy( path );
+    checkPhase( raff_PHASE_OPEN, NULL, file );
+    raff_fileStats( file, &stats );
+    assert( stats.bytesRead == 12 );
+    parseAll( file );
+    checkParsed( file );
+    
+    raff_Stats parsed;
+    raff_fileStats( file, &parsed );
+    assert( parsed.bytesRead > stats.bytesRead && parsed.bytesRead < size );
+    
+    char        buf[8];
+    raff_Chunk* iter;
+    raff_Chunk* tail = raff_findID( raff_chunkAsList( raff_fileAsChunk( file ) ), raff_newID( "tail" ) );
+    assert( raff_dataRead( raff_chunkAsData( tail ), 0, buf, sizeof(buf) ) == 4 );
+    raff_fileStats( file, &stats );
+    assert( stats.bytesRead == parsed.bytesRead + 4 );
+    assert( stats.streamCalls > parsed.streamCalls );
+    raff_closeFile( file );
+    
+    // Files opened from an index have their lists already, so
+    // don't read anything to get at them.
+    file = raff_openFile( path );
+    assert( raff_saveIndex( file, indexPath ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    eventCount = 0;
+    
+    file = raff_openIndexed( path, indexPath );
+    checkPhase( raff_PHASE_OPEN, NULL, file );
+    raff_List* root = raff_chunkAsList( raff_fileAsChunk( file ) );
+    raff_start( root );
+    while( ( iter = raff_next( root ) ) )
+        raff_chunkAsList( iter );
+    assert( eventCount == 0 );
+    raff_fileStats( file, &stats );
+    assert( stats.bytesRead == 12 && stats.listsParsed == 0 );
+    raff_closeFile( file );
+    remove( indexPath );
+    
+    // Failed opens end with no file.
+    assert( !raff_openFile( "no such file" ) );
+    checkPhase( raff_PHASE_OPEN, NULL, NULL );
+    assert( raff_errorNum() == raff_ERR_CANT_OPEN );
+    
+    raff_setHooks( NULL, NULL );
+    file = raff_openFile( path );
+    assert( eventCount == 0 );
+    raff_closeFile( file );
+    
+    remove( path );
+    printf( "Passed: Stats Test\n" );
+    return 0;
+}
@@ -0,0 +1,277 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "raff.h"
+
+// Tests that independent files can be parsed on different
+// threads at the same time.  A set of files is generated,
+// each with a different number of chunks and contents, and
+// then a bunch of threads open and check them over and over
+// using each of the open modes; also making sure that errors
+// on one thread don't show up on another.  Then they're opened
+// again as batches, with different numbers of workers, along
+// with files that are missing or corrupt.
+
+#define NUM_FILES   16
+#define NUM_THREADS 8
+#define NUM_ROUNDS  400
+
+static void
+filePath( char* buf, int file ) {
+    sprintf( buf, "thread-%02d.wav", file );
+}
+
+static int
+numChunks( int file ) {
+    return 1 + file % 13;
+}
+
+static size_t
+chunkSize( int file, int chunk ) {
+    return 1 + ( file*31 + chunk*17 ) % 200;
+}
+
+static char
+chunkByte( int file, int chunk, size_t i ) {
+    return (char)( file + chunk*3 + i );
+}
+
+static raff_ID
+chunkID( int chunk ) {
+    char id[5];
+    sprintf( id, "d%03d", chunk );
+    return raff_newID( id );
+}
+
+static void
+generate( int fileNum ) {
+    raff_File* file = raff_newFile();
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    
+    for( int c = 0 ; c < numChunks( fileNum ) ; c++ ) {
+        char   buf[256];
+        size_t size = chunkSize( fileNum, c );
+        for( size_t i = 0 ; i < size ; i++ )
+            buf[i] = chunkByte( fileNum, c, i );
+        
+        raff_Data* data = raff_newData( file, chunkID( c ), buf, size );
+        raff_append( root, raff_dataAsChunk( data ) );
+    }
+    
+    // And a nested list, to have something to descend into.
+    raff_List* sub  = raff_newList( file, raff_newID( "sub " ) );
+    raff_Data* leaf = raff_newData( file, raff_newID( "leaf" ), "abc", 3 );
+    raff_append( sub, raff_dataAsChunk( leaf ) );
+    raff_append( root, raff_listAsChunk( sub, false ) );
+    
+    char path[32];
+    filePath( path, fileNum );
+    int err = raff_serializeChunkToFile( raff_listAsChunk( root, true ), path );
+    assert( err == raff_ERR_NONE );
+    raff_closeFile( file );
+}
+
+// Returns the number of problems found.
+static int
+check( raff_File* file, int fileNum ) {
+    int bad = 0;
+    
+    raff_Chunk* rootCk = raff_fileAsChunk( file );
+    raff_List*  root   = raff_chunkAsList( rootCk );
+    if( !root || raff_getID( rootCk ) != raff_newID( "TEST" ) )
+        return 1;
+    
+    int         c = 0;
+    raff_Chunk* iter;
+    raff_start( root );
+    while( ( iter = raff_next( root ) ) ) {
+        if( c == numChunks( fileNum ) ) {
+            raff_List* sub = raff_chunkAsList( iter );
+            if( !sub || raff_getID( iter ) != raff_newID( "sub " ) ) {
+                bad++;
+                break;
+            }
+            
+            raff_Data* leaf =
+                raff_chunkAsData( raff_findID( sub, raff_newID( "leaf" ) ) );
+            char const* content = leaf ? raff_dataContent( leaf ) : NULL;
+            if( !content || content[0] != 'a' || content[2] != 'c' )
+                bad++;
+            
+            c++;
+            continue;
+        }
+        
+        raff_Data* data = raff_chunkAsData( iter );
+        if( !data || raff_getID( iter ) != chunkID( c ) ||
+            raff_dataSize( data ) != chunkSize( fileNum, c ) ) {
+            bad++;
+            break;
+        }
+        
+        char const* content = raff_dataContent( data );
+        for( size_t i = 0 ; i < raff_dataSize( data ) ; i++ ) {
+            if( content[i] != chunkByte( fileNum, c, i ) ) {
+                bad++;
+                break;
+            }
+        }
+        c++;
+    }
+    
+    if( c != numChunks( fileNum ) + 1 )
+        bad++;
+    
+    // Lookups by ID on a different chunk.
+    int last = numChunks( fileNum ) - 1;
+    if( !raff_findID( root, chunkID( last ) ) )
+        bad++;
+    
+    return bad;
+}
+
+typedef struct Worker {
+    pthread_t thread;
+    int       id;
+    int       bad;
+} Worker;
+
+static void*
+work( void* arg ) {
+    Worker* w = arg;
+    
+    for( int r = 0 ; r < NUM_ROUNDS ; r++ ) {
+        int  fileNum = ( r*7 + w->id ) % NUM_FILES;
+        char path[32];
+        filePath( path, fileNum );
+        
+        // An error here shouldn't affect other threads.
+        if( r % 5 == w->id % 5 ) {
+            if( raff_openFile( "thread-missing.wav" ) ||
+                raff_errorNum() != raff_ERR_CANT_OPEN )
+                w->bad++;
+        }
+        
+        raff_File* file;
+        switch( ( r + w->id ) % 3 ) {
+            case 0:
+                file = raff_openFile( path );
+                break;
+            case 1:
+                file = raff_mapFile( path, raff_ACCESS_RANDOM );
+                break;
+            default:
+                file = raff_openFileLazy( path );
+                break;
+        }
+        if( !file || raff_errorNum() != raff_ERR_NONE ) {
+            w->bad++;
+            continue;
+        }
+        
+        w->bad += check( file, fileNum );
+        raff_closeFile( file );
+    }
+    
+    // The slabs this thread kept are freed as it exits.
+    return NULL;
+}
+
+#define BATCH_SIZE ( NUM_FILES*4 + 2 )
+
+static char const* badPath = "thread-bad.wav";
+
+// A file whose header's fine, but with a chunk in its root list
+// that goes past the end of it.
+static void
+generateBad( void ) {
+    FILE* f = fopen( badPath, "wb" );
+    fwrite( "RIFF\x14\0\0\0WAVEdata\x40\0\0\0\0\0\0\0\0\0\0\0", 1, 28, f );
+    fclose( f );
+}
+
+// What each file in a batch came out as; the number of problems
+// found, or -1 if it wasn't handed to the callback.  Each index
+// is only written by the one callback, so no locking's needed.
+static int batchBad[BATCH_SIZE];
+
+static void
+batchCb( size_t index, raff_File* file, raff_Error err, void* user ) {
+    // The last one is missing, and the one before is corrupt.
+    if( index == BATCH_SIZE - 1 ) {
+        batchBad[index] = file || err != raff_ERR_CANT_OPEN;
+        return;
+    }
+    if( index == BATCH_SIZE - 2 ) {
+        batchBad[index] = file || err != raff_ERR_CORRUPT;
+        return;
+    }
+    
+    if( !file || err != raff_ERR_NONE ) {
+        batchBad[index] = 1;
+        return;
+    }
+    
+    batchBad[index] = check( file, index % NUM_FILES );
+    raff_closeFile( file );
+}
+
+static int
+checkBatch( unsigned workers ) {
+    char        paths[BATCH_SIZE][32];
+    char const* ptrs[BATCH_SIZE];
+    for( int i = 0 ; i < BATCH_SIZE ; i++ ) {
+        if( i == BATCH_SIZE - 1 )
+            sprintf( paths[i], "thread-missing.wav" );
+        else if( i == BATCH_SIZE - 2 )
+            sprintf( paths[i], "%s", badPath );
+        else
+            filePath( paths[i], i % NUM_FILES );
+        ptrs[i]     = paths[i];
+        batchBad[i] = -1;
+    }
+    
+    raff_openFiles( ptrs, BATCH_SIZE, workers, batchCb, NULL );
+    
+    int bad = 0;
+    for( int i = 0 ; i < BATCH_SIZE ; i++ )
+        bad += batchBad[i] != 0;
+    return bad;
+}
+
+int
+main( void ) {
+    for( int f = 0 ; f < NUM_FILES ; f++ )
+        generate( f );
+    generateBad();
+    
+    Worker workers[NUM_THREADS];
+    for( int t = 0 ; t < NUM_THREADS ; t++ ) {
+        workers[t].id  = t;
+        workers[t].bad = 0;
+        pthread_create( &workers[t].thread, NULL, work, &workers[t] );
+    }
+    
+    int bad = 0;
+    for( int t = 0 ; t < NUM_THREADS ; t++ ) {
+        pthread_join( workers[t].thread, NULL );
+        bad += workers[t].bad;
+    }
+    
+    bad += checkBatch( 0 );
+    bad += checkBatch( 1 );
+    bad += checkBatch( 3 );
+    bad += checkBatch( NUM_THREADS );
+    bad += checkBatch( BATCH_SIZE + 10 );
+    
+    for( int f = 0 ; f < NUM_FILES ; f++ ) {
+        char path[32];
+        filePath( path, f );
+        remove( path );
+    }
+    remove( badPath );
+    
+    assert( bad == 0 );
+    printf( "Passed: Thread Test\n" );
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests walking a tree.  A small file of nested lists is built,
+// walked, written, then opened each way and walked again; checking
+// every chunk is visited in order with the right depth, size, and
+// content (or offset of it), and that subtrees can be skipped and
+// walks stopped.  Then a chunk that runs past the end of its list
+// should stop the walk as corrupt.  Lists nested far deeper than
+// any real file has should still be walked.
+
+static char const* path     = "test-walk.riff";
+static char const* deepPath = "test-walk-deep.riff";
+
+#define DEEP_COUNT 50000
+
+typedef struct Expect {
+    unsigned    depth;
+    bool        list;
+    char const* id;
+    size_t      size;
+    char const* content;
+} Expect;
+
+static Expect const expect[] = {
+    { 0, true,  "TEST", 86, NULL     },
+    { 1, false, "head", 6,  "header" },
+    { 1, true,  "item", 48, NULL     },
+    { 2, false, "data", 3,  "abc"    },
+    { 2, false, "data", 3,  "abc"    },
+    { 2, true,  "deep", 12, NULL     },
+    { 3, false, "leaf", 3,  "odd"    },
+    { 1, false, "tail", 4,  "tail"   }
+};
+
+#define EXPECT_COUNT ( sizeof(expect)/sizeof(expect[0]) )
+
+typedef struct Walked {
+    size_t      count;
+    bool        lazy;
+    bool        read;
+    char const* skip;
+    char const* stop;
+} Walked;
+
+static char fileBytes[256];
+
+static raff_WalkAction
+visit( raff_Visit const* v, void* user ) {
+    Walked* w = user;
+    assert( w->count < EXPECT_COUNT );
+    
+    // Skipped lists leave out what's in them.
+    Expect const* e = &expect[w->count++];
+    while( w->skip && v->id != raff_newID( e->id ) )
+        e = &expect[w->count++];
+    
+    assert( v->depth == e->depth );
+    assert( v->list == e->list );
+    assert( v->riff == ( e->depth == 0 ) );
+    assert( v->id == raff_newID( e->id ) );
+    assert( v->size == e->size );
+    if( w->lazy )
+        assert( !v->content );
+    else
+    if( e->content )
+        assert( !memcmp( v->content, e->content, e->size ) );
+    
+    // Chunks read from a file know where they came from.
+    if( w->read && e->content )
+        assert( !memcmp( fileBytes + v->offset, e->content, e->size ) );
+    
+    if( w->skip && v->id == raff_newID( w->skip ) )
+        return raff_WALK_SKIP;
+    if( w->stop && v->id == raff_newID( w->stop ) )
+        return raff_WALK_STOP;
+    return raff_WALK_CONTINUE;
+}
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, strlen( content ) ) );
+}
+
+static size_t
+generate( void ) {
+    raff_File* file = raff_newFile();
+    raff_List* deep = raff_newList( file, raff_newID( "deep" ) );
+    raff_append( deep, newData( file, "leaf", "odd" ) );
+    
+    raff_List* item = raff_newList( file, raff_newID( "item" ) );
+    raff_append( item, newData( file, "data", "abc" ) );
+    raff_append( item, newData( file, "data", "abc" ) );
+    raff_append( item, raff_listAsChunk( deep, false ) );
+    
+    raff_List* root = raff_newList( file, raff_newID( "TEST" ) );
+    raff_append( root, newData( file, "head", "header" ) );
+    raff_append( root, raff_listAsChunk( item, false ) );
+    raff_append( root, newData( file, "tail", "tail" ) );
+    
+    // Built lists are walked through the chunks they were made of.
+    raff_Chunk* chunk = raff_listAsChunk( root, true );
+    Walked      w     = { 0, false, false, NULL, NULL };
+    assert( raff_walk( chunk, visit, &w ) == raff_ERR_NONE );
+    assert( w.count == EXPECT_COUNT );
+    
+    assert( raff_serializeChunkToFile( chunk, path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    FILE*  f    = fopen( path, "rb" );
+    size_t size = fread( fileBytes, 1, sizeof(fileBytes), f );
+    fclose( f );
+    assert( size == 12 + 86 );
+    return size;
+}
+
+static void
+check( raff_File* file, bool lazy ) {
+    raff_Chunk* root = raff_fileAsChunk( file );
+    Walked      w    = { 0, lazy, true, NULL, NULL };
+    assert( raff_walk( root, visit, &w ) == raff_ERR_NONE );
+    assert( w.count == EXPECT_COUNT );
+    
+    w.count = 0;
+    w.skip  = "item";
+    assert( raff_walk( root, visit, &w ) == raff_ERR_NONE );
+    assert( w.count == EXPECT_COUNT );
+    
+    w.count = 0;
+    w.skip  = NULL;
+    w.stop  = "deep";
+    assert( raff_walk( root, visit, &w ) == raff_ERR_NONE );
+    assert( w.count == 6 );
+}
+
+static void
+putHead( FILE* f, char const* id, size_t size, char const* sub ) {
+    unsigned char b[4] = { size, size >> 8, size >> 16, size >> 24 };
+    fwrite( id, 1, 4, f );
+    fwrite( b, 1, 4, f );
+    fwrite( sub, 1, 4, f );
+}
+
+// Writes a file that's nothing but lists, each in the one before.
+static void
+generateDeep( void ) {
+    FILE* f = fopen( deepPath, "wb" );
+    putHead( f, "RIFF", 4 + 12*( DEEP_COUNT - 1 ), "DEEP" );
+    for( size_t i = 1 ; i < DEEP_COUNT ; i++ )
+        putHead( f, "LIST", 4 + 12*( DEEP_COUNT - 1 - i ), "nest" );
+    fclose( f );
+}
+
+static raff_WalkAction
+visitDeep( raff_Visit const* v, void* user ) {
+    size_t* count = user;
+    assert( v->list && v->depth == *count );
+    ++*count;
+    return raff_WALK_CONTINUE;
+}
+
+static void
+checkDeep( void ) {
+    generateDeep();
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        raff_File* file;
+        if( mode == 0 )
+            file = raff_openFile( deepPath );
+        else
+        if( mode == 1 )
+            file = raff_mapFile( deepPath, raff_ACCESS_RANDOM );
+        else
+            file = raff_openFileLazy( deepPath );
+        assert( file );
+        
+        size_t count = 0;
+        assert( raff_walk( raff_fileAsChunk( file ), visitDeep, &count ) == raff_ERR_NONE );
+        assert( count == DEEP_COUNT );
+        raff_closeFile( file );
+    }
+    remove( deepPath );
+}
+
+int
+main( void ) {
+    size_t size = generate();
+    for( int mode = 0 ; mode < 3 ; mode++ ) {
+        raff_File* file;
+        if( mode == 0 )
+            file = raff_openFile( path );
+        else
+        if( mode == 1 )
+            file = raff_mapFile( path, raff_ACCESS_RANDOM );
+        else
+            file = raff_openFileLazy( path );
+        assert( file );
+        
+        check( file, mode == 2 );
+        raff_closeFile( file );
+    }
+    
+    // The tail chunk's size runs past the end of the file.
+    fileBytes[size - 8]++;
+    FILE* f = fopen( path, "wb" );
+    assert( fwrite( fileBytes, 1, size, f ) == size );
+    fclose( f );
+    
+    for( int lazy = 0 ; lazy < 2 ; lazy++ ) {
+        raff_File* file = lazy ? raff_openFileLazy( path ) : raff_openFile( path );
+        Walked     w    = { 0, lazy, true, NULL, NULL };
+        assert( raff_walk( raff_fileAsChunk( file ), visit, &w ) == raff_ERR_CORRUPT );
+        assert( w.count == EXPECT_COUNT - 1 );
+        raff_closeFile( file );
+    }
+    
+    checkDeep();
+    
+    remove( path );
+    printf( "Passed: Walk Test\n" );
+    return 0;
+}
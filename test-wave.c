@@ -0,0 +1,192 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests the WAVE accessor.  A 16 bit stereo PCM file, and 24 bit
+// six channel and 32 bit float WAVE_FORMAT_EXTENSIBLE files are
+// written, each a couple of seconds long with every frame holding
+// its own number;
+// then they're opened with each of the open modes and ranges of
+// frames looked up by frame and by time.
+
+static char const* path = "test-wave.wav";
+
+#define RATE 8000
+#define FRAMES ( RATE*2 + 3 )
+
+typedef struct Format {
+    unsigned tag;
+    unsigned channels;
+    unsigned bits;
+    bool     extensible;
+} Format;
+
+static void
+put16( char* b, unsigned v ) {
+    b[0] = v;
+    b[1] = v >> 8;
+}
+
+static void
+put32( char* b, uint32_t v ) {
+    put16( b, v & 0xFFFF );
+    put16( b + 2, v >> 16 );
+}
+
+// Each frame starts with its number.
+static void
+fillFrame( char* frame, unsigned long long n, unsigned align ) {
+    memset( frame, (int)( n % 251 ), align );
+    put32( frame, (uint32_t)n );
+}
+
+static void
+generate( Format const* f ) {
+    unsigned align = f->channels*f->bits/8;
+    
+    char fmt[40] = { 0 };
+    put16( fmt, f->extensible ? 0xFFFE : f->tag );
+    put16( fmt + 2, f->channels );
+    put32( fmt + 4, RATE );
+    put32( fmt + 8, RATE*align );
+    put16( fmt + 12, align );
+    put16( fmt + 14, f->bits );
+    if( f->extensible ) {
+        put16( fmt + 16, 22 );
+        put16( fmt + 18, f->bits - 4 );
+        put32( fmt + 20, 0x3F );
+        put16( fmt + 24, f->tag );
+    }
+    
+    static char samples[FRAMES*18];
+    for( unsigned long long n = 0 ; n < FRAMES ; n++ )
+        fillFrame( samples + n*align, n, align );
+    
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "fmt " ), fmt, f->extensible ? 40 : 16 ) ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "LIST" ), "info", 4 ) ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), samples, FRAMES*align ) ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+}
+
+static void
+checkSlice( raff_Wave* wave, raff_WaveSlice const* slice, bool lazy ) {
+    unsigned align = raff_waveFormat( wave )->blockAlign;
+    assert( slice->offset == slice->first*align );
+    assert( slice->size == slice->count*align );
+    assert( lazy ? !slice->content : slice->content != NULL );
+    
+    char expect[18];
+    char got[18];
+    for( unsigned long long i = 0 ; i < slice->count ; i++ ) {
+        fillFrame( expect, slice->first + i, align );
+        if( !lazy )
+            assert( !memcmp( slice->content + i*align, expect, align ) );
+        assert( raff_waveRead( wave, slice, i*align, got, align ) == align );
+        assert( !memcmp( got, expect, align ) );
+    }
+    assert( raff_waveRead( wave, slice, slice->size, got, align ) == 0 );
+}
+
+static void
+check( raff_File* file, Format const* f, bool lazy ) {
+    raff_Wave* wave = raff_fileAsWave( file );
+    assert( wave );
+    
+    raff_WaveFormat const* format = raff_waveFormat( wave );
+    assert( format->format == f->tag );
+    assert( format->channels == f->channels );
+    assert( format->sampleRate == RATE );
+    assert( format->blockAlign == f->channels*f->bits/8 );
+    assert( format->bitsPerSample == f->bits );
+    assert( format->extensible == f->extensible );
+    assert( format->validBits == ( f->extensible ? f->bits - 4 : f->bits ) );
+    assert( format->channelMask == ( f->extensible ? 0x3F : 0 ) );
+    assert( raff_waveFrameCount( wave ) == FRAMES );
+    
+    raff_WaveSlice slice;
+    assert( raff_waveFrames( wave, 100, 50, &slice ) );
+    assert( slice.first == 100 && slice.count == 50 );
+    checkSlice( wave, &slice, lazy );
+    
+    // Ranges running off the end are cut short.
+    assert( raff_waveFrames( wave, FRAMES - 5, 50, &slice ) );
+    assert( slice.count == 5 );
+    checkSlice( wave, &slice, lazy );
+    assert( raff_waveFrames( wave, FRAMES, 1, &slice ) && slice.count == 0 );
+    assert( !raff_waveFrames( wave, FRAMES + 1, 1, &slice ) );
+    
+    // A 200 ms window from one second in.
+    assert( raff_waveTime( wave, 1.0, 0.2, &slice ) );
+    assert( slice.first == RATE && slice.count == RATE/5 );
+    checkSlice( wave, &slice, lazy );
+    
+    assert( raff_waveTime( wave, 1.9999, 10.0, &slice ) );
+    assert( slice.first == FRAMES - 4 && slice.count == 4 );
+    assert( !raff_waveTime( wave, 1e30, 1.0, &slice ) );
+    assert( !raff_waveTime( wave, NAN, 1.0, &slice ) );
+    assert( !raff_waveTime( wave, 0.0, INFINITY, &slice ) );
+    
+    // The ends are rounded, not the length; 0.4 to 0.6 frames in
+    // is the first frame.
+    assert( raff_waveTime( wave, 0.4/RATE, 0.2/RATE, &slice ) );
+    assert( slice.first == 0 && slice.count == 1 );
+}
+
+int
+main( void ) {
+    Format formats[] = {
+        { 1, 2, 16, false },
+        { 1, 6, 24, true  },
+        { 3, 1, 32, true  }
+    };
+    for( size_t i = 0 ; i < sizeof(formats)/sizeof(formats[0]) ; i++ ) {
+        generate( &formats[i] );
+        for( int mode = 0 ; mode < 3 ; mode++ ) {
+            raff_File* file;
+            if( mode == 0 )
+                file = raff_openFile( path );
+            else
+            if( mode == 1 )
+                file = raff_mapFile( path, raff_ACCESS_RANDOM );
+            else
+                file = raff_openFileLazy( path );
+            assert( file );
+            
+            check( file, &formats[i], mode == 2 );
+            raff_closeFile( file );
+        }
+    }
+    
+    // No fmt chunk.
+    raff_File* file = raff_newFile();
+    raff_List* wave = raff_newList( file, raff_newID( "WAVE" ) );
+    raff_append( wave, raff_dataAsChunk( raff_newData( file, raff_newID( "data" ), "data", 4 ) ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( wave, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( path );
+    assert( !raff_fileAsWave( file ) );
+    assert( raff_errorNum() == raff_ERR_CORRUPT );
+    raff_closeFile( file );
+    
+    // Not a WAVE file.
+    file = raff_newFile();
+    raff_List* avi = raff_newList( file, raff_newID( "AVI " ) );
+    assert( raff_serializeChunkToFile( raff_listAsChunk( avi, true ), path ) == raff_ERR_NONE );
+    raff_closeFile( file );
+    
+    file = raff_openFile( path );
+    assert( !raff_fileAsWave( file ) );
+    assert( raff_errorNum() == raff_ERR_NOT_WAVE );
+    raff_closeFile( file );
+    
+    remove( path );
+    printf( "Passed: WAVE Test\n" );
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "raff.h"
+
+// Tests the streaming writer.  A WAV like file is written a
+// piece at a time, with chunks copied in from a file built in
+// memory and lists left open for raff_closeWriter() to end;
+// then it's parsed to check everything's there with the right
+// sizes.
+
+static char const* path = "test-writer.wav";
+
+static raff_Chunk*
+newData( raff_File* file, char const* id, char const* content, size_t size ) {
+    return raff_dataAsChunk( raff_newData( file, raff_newID( id ), content, size ) );
+}
+
+static void
+checkContent( raff_Chunk* chunk, char const* content, size_t size ) {
+    raff_Data* data = raff_chunkAsData( chunk );
+    assert( data );
+    assert( raff_dataSize( data ) == size );
+    assert( !memcmp( raff_dataContent( data ), content, size ) );
+}
+
+static void
+writeFile( void ) {
+    raff_File* scratch = raff_newFile();
+    raff_List* cues    = raff_newList( scratch, raff_newID( "adtl" ) );
+    raff_append( cues, newData( scratch, "labl", "label", 5 ) );
+    
+    raff_Writer* writer = raff_newWriter( path, raff_newID( "WAVE" ) );
+    assert( writer );
+    assert( raff_writerChunk( writer, newData( scratch, "fmt ", "0123456789abcdef", 16 ) ) == raff_ERR_NONE );
+    
+    assert( raff_writerBeginList( writer, raff_newID( "INFO" ) ) == raff_ERR_NONE );
+    assert( raff_writerBeginData( writer, raff_newID( "INAM" ) ) == raff_ERR_NONE );
+    assert( raff_writerWrite( writer, "na", 2 ) == raff_ERR_NONE );
+    assert( raff_writerWrite( writer, "me", 3 ) == raff_ERR_NONE );
+    assert( raff_writerEndData( writer ) == raff_ERR_NONE );
+    assert( raff_writerEndList( writer ) == raff_ERR_NONE );
+    
+    // Data of an odd size, in lots of small pieces.
+    assert( raff_writerBeginData( writer, raff_newID( "data" ) ) == raff_ERR_NONE );
+    for( int i = 0 ; i < 999 ; i++ )
+        assert( raff_writerWrite( writer, "samples", 7 ) == raff_ERR_NONE );
+    assert( raff_writerEndData( writer ) == raff_ERR_NONE );
+    
+    // A list that's left open with its data.
+    assert( raff_writerBeginList( writer, raff_newID( "LIST" ) ) == raff_ERR_NONE );
+    assert( raff_writerChunk( writer, raff_listAsChunk( cues, false ) ) == raff_ERR_NONE );
+    assert( raff_writerBeginData( writer, raff_newID( "cue " ) ) == raff_ERR_NONE );
+    assert( raff_writerWrite( writer, "cue", 3 ) == raff_ERR_NONE );
+    assert( raff_closeWriter( writer ) == raff_ERR_NONE );
+    raff_closeFile( scratch );
+}
+
+static void
+check( void ) {
+    raff_File* file = raff_openFile( path );
+    assert( file );
+    
+    raff_List* wave = raff_chunkAsList( raff_fileAsChunk( file ) );
+    assert( wave );
+    assert( raff_getID( raff_fileAsChunk( file ) ) == raff_newID( "WAVE" ) );
+    
+    // Room for a ds64 chunk comes first.
+    raff_start( wave );
+    raff_Chunk* junk = raff_next( wave );
+    assert( raff_getID( junk ) == raff_newID( "JUNK" ) );
+    assert( raff_dataSize( raff_chunkAsData( junk ) ) == 28 );
+    
+    checkContent( raff_findID( wave, raff_newID( "fmt " ) ), "0123456789abcdef", 16 );
+    
+    raff_List* info = raff_chunkAsList( raff_findID( wave, raff_newID( "INFO" ) ) );
+    assert( info );
+    checkContent( raff_findID( info, raff_newID( "INAM" ) ), "name", 5 );
+    
+    raff_Data* data = raff_chunkAsData( raff_findID( wave, raff_newID( "data" ) ) );
+    assert( data && raff_dataSize( data ) == 999*7 );
+    for( int i = 0 ; i < 999 ; i++ )
+        assert( !memcmp( raff_dataContent( data ) + i*7, "samples", 7 ) );
+    
+    raff_List* list = raff_chunkAsList( raff_findID( wave, raff_newID( "LIST" ) ) );
+    assert( list );
+    checkContent( raff_findID( list, raff_newID( "cue " ) ), "cue", 3 );
+    
+    raff_List* cues = raff_chunkAsList( raff_findID( list, raff_newID( "adtl" ) ) );
+    assert( cues );
+    checkContent( raff_findID( cues, raff_newID( "labl" ) ), "label", 5 );
+    raff_closeFile( file );
+    
+    // The RIFF size should cover the whole file.
+    FILE* f = fopen( path, "rb" );
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    
+    unsigned char head[8];
+    assert( fread( head, 1, 8, f ) == 8 );
+    fclose( f );
+    assert( !memcmp( head, "RIFF", 4 ) );
+    uint32_t riffSize = head[4] | head[5] << 8 | head[6] << 16 | (uint32_t)head[7] << 24;
+    assert( riffSize + 8 == size );
+}
+
+int
+main( void ) {
+    writeFile();
+    check();
+    
+    assert( raff_newWriter( "no/such/dir/file.wav", raff_newID( "WAVE" ) ) == NULL );
+    assert( raff_errorNum() == raff_ERR_CANT_OPEN );
+    
+    remove( path );
+    printf( "Passed: Writer Test\n" );
+    return 0;
+}